@@ -0,0 +1,354 @@
+/*
+ * Measures every bm command end to end (process startup included) against synthetic stores.
+ * Build and run from the repository root with 'make bench', or:
+ *   gcc -O2 -Wall -Wextra bench/bench.c -o bm_bench && ./bm_bench ./bm [bookmarks...]
+ *
+ * Each size gets a throwaway HOME holding a generated store. For every command the harness
+ * reports a "cold" series, where bookmarks.idx is removed and the store files and the bm binary
+ * are dropped from the page cache before each run, and a "warm" series of back-to-back runs.
+ *
+ * Results go to stdout as one JSON object per line:
+ *   {"command":"go","bookmarks":1000,"mode":"warm","runs":200,"p50_us":612,"p99_us":931,"max_rss_kb":1544}
+ * A readable summary goes to stderr.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_ARGS 5
+
+typedef struct {
+    long p50_us;
+    long p99_us;
+    long max_rss_kb;
+} Result;
+
+static const char *syllables[] = { "ap", "web", "doc", "inf", "ra", "to", "ol", "da", "ta", "mo", "bi", "le",
+                                   "au", "th", "se", "ar", "ch", "bil", "ling", "src", "lib", "pro", "ject", "ops" };
+#define SYLLABLE_COUNT (sizeof(syllables) / sizeof(syllables[0]))
+
+static const size_t default_sizes[] = { 10, 1000, 100000, 1000000 };
+
+#define MAX_SAMPLES 64
+
+static char bm_path[PATH_MAX];
+static char home[256];
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+// Generated names spread across the store, looked up by go and mutated by rename and edit
+static char samples[MAX_SAMPLES][16];
+static size_t sample_count;
+
+// Mutation state carried across runs
+static int added, deleted, renamed;
+
+// Helper functions
+static uint64_t next_random(void);
+static size_t random_between(size_t low, size_t high);
+static size_t random_name_length(void);
+static void make_name(char *name, size_t index, size_t suffix_len);
+static int generate_store(size_t count);
+static void evict(const char *path);
+static void make_cold(void);
+static long run_once(char *const argv[], long *rss_kb);
+static int compare_longs(const void *a, const void *b);
+static int measure(const char *command, size_t count, const char *mode, int runs, int cold);
+static void fill_args(const char *command, int run, char *argv[], char buffers[][PATH_MAX]);
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to bm> [bookmarks...]\n", argv[0]);
+        return 1;
+    }
+    if (!realpath(argv[1], bm_path)) {
+        fprintf(stderr, "Failed to resolve %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    size_t sizes[16];
+    size_t size_count = 0;
+    if (argc > 2) {
+        for (int i = 2; i < argc && size_count < 16; i++) sizes[size_count++] = strtoul(argv[i], NULL, 10);
+    } else {
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+        size_count = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    }
+
+    const char *commands[] = { "go", "add", "delete", "rename", "edit", "which", "list" };
+    int status = 0;
+    for (size_t s = 0; s < size_count && status == 0; s++) {
+        size_t count = sizes[s];
+        // Fewer runs on large stores, so the whole suite finishes in a few minutes
+        int warm_runs = count <= 1000 ? 200 : count <= 100000 ? 50 : 10;
+        int cold_runs = count <= 100000 ? 10 : 3;
+
+        snprintf(home, sizeof(home), "/tmp/bm_bench.XXXXXX");
+        if (!mkdtemp(home)) {
+            fprintf(stderr, "Failed to create a temporary HOME: %s\n", strerror(errno));
+            return 1;
+        }
+        setenv("HOME", home, 1);
+        if (generate_store(count) != 0) return 1;
+
+        // The first load migrates bookmarks.tsv to bookmarks.snap: keep it out of the measured runs
+        char *migrate[] = { "bm", "export", "--tsv", NULL };
+        long migrate_rss_kb;
+        if (run_once(migrate, &migrate_rss_kb) < 0) {
+            fprintf(stderr, "Failed to migrate the generated bookmarks\n");
+            return 1;
+        }
+
+        for (size_t c = 0; c < sizeof(commands) / sizeof(commands[0]) && status == 0; c++) {
+            status = measure(commands[c], count, "cold", cold_runs, 1);
+            if (status == 0) status = measure(commands[c], count, "warm", warm_runs, 0);
+        }
+
+        char command[PATH_MAX + 16];
+        snprintf(command, sizeof(command), "rm -rf '%s'", home);
+        if (system(command) != 0) fprintf(stderr, "Failed to remove %s\n", home);
+    }
+    return status;
+}
+
+// Helper functions
+
+/*
+ * xorshift64*: deterministic, so every run benchmarks the same stores.
+ */
+static uint64_t next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static size_t random_between(size_t low, size_t high) {
+    return low + next_random() % (high - low + 1);
+}
+
+/*
+ * Name lengths cluster around 6-8 characters, with a tail up to the 15 character limit.
+ */
+static size_t random_name_length(void) {
+    size_t length = (random_between(2, 10) + random_between(2, 10)) / 2 + (next_random() % 8 == 0 ? random_between(0, 5) : 0);
+    return length > 15 ? 15 : length;
+}
+
+/*
+ * Builds a pronounceable name: a random stem followed by the index in base 36, zero-padded
+ * to suffix_len characters. The fixed-width suffix keeps every name in a store unique.
+ */
+static void make_name(char *name, size_t index, size_t suffix_len) {
+    size_t length = random_name_length();
+    if (length < suffix_len + 1) length = suffix_len + 1;
+
+    size_t stem_len = 0;
+    while (stem_len < length - suffix_len) {
+        const char *syllable = syllables[next_random() % SYLLABLE_COUNT];
+        for (size_t i = 0; syllable[i] && stem_len < length - suffix_len; i++) name[stem_len++] = syllable[i];
+    }
+    if (stem_len > 1 && next_random() % 4 == 0) name[stem_len - 1] = next_random() % 2 ? '-' : '_';
+
+    for (size_t i = suffix_len; i > 0; i--) {
+        name[stem_len + i - 1] = "0123456789abcdefghijklmnopqrstuvwxyz"[index % 36];
+        index /= 36;
+    }
+    name[stem_len + suffix_len] = '\0';
+}
+
+/*
+ * Writes ~/.bm/bookmarks.tsv with count bookmarks, which bm migrates to bookmarks.snap. Paths are 2-8 components deep, mostly
+ * under the home directory. They don't exist: go and list never touch them.
+ */
+static int generate_store(size_t count) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.bm", home);
+    if (mkdir(path, 0700) != 0) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // Real directories for add and edit, which validate their paths
+    snprintf(path, sizeof(path), "%s/projects", home);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/projects/other", home);
+    mkdir(path, 0755);
+
+    snprintf(path, sizeof(path), "%s/.bm/bookmarks.tsv", home);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    fprintf(file, "Bookmark Name\tDirectory Path\n");
+    sample_count = 0;
+    added = deleted = renamed = 0;
+    size_t suffix_len = 1;
+    for (size_t limit = 36; limit < count; limit *= 36) suffix_len++;
+    for (size_t i = 0; i < count; i++) {
+        char name[16];
+        make_name(name, i, suffix_len);
+        if (i % (count / MAX_SAMPLES + 1) == 0 && sample_count < MAX_SAMPLES) strcpy(samples[sample_count++], name);
+        fprintf(file, "%-15s\t%s", name, next_random() % 5 ? "/home/user" : "/srv");
+        size_t depth = random_between(1, 6);
+        for (size_t d = 0; d < depth; d++) {
+            fputc('/', file);
+            size_t length = random_between(3, 12);
+            for (size_t c = 0; c < length; c++) fputc('a' + next_random() % 26, file);
+        }
+        fputc('\n', file);
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Asks the kernel to drop a file's clean pages from the page cache.
+ */
+static void evict(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/*
+ * Removes the index (so the next run rebuilds it) and evicts the store and the binary.
+ */
+static void make_cold(void) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.bm/bookmarks.idx", home);
+    unlink(path);
+
+    const char *files[] = { "bookmarks.snap", "bookmarks.journal", "bookmarks.usage" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/.bm/%s", home, files[i]);
+        evict(path);
+    }
+    evict(bm_path);
+}
+
+/*
+ * Runs bm once with stdout and stderr discarded.
+ * Returns the wall-clock time in microseconds, or -1 if bm couldn't be run or failed.
+ */
+static long run_once(char *const argv[], long *rss_kb) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(bm_path, argv);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == -1) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *rss_kb = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    return (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+static int compare_longs(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Times runs invocations of one command and prints its p50, p99 and peak RSS.
+ * Returns 0 on success, 1 if any run failed.
+ */
+static int measure(const char *command, size_t count, const char *mode, int runs, int cold) {
+    long *times = malloc(runs * sizeof(long));
+    if (!times) return 1;
+
+    Result result = { 0 };
+    for (int run = 0; run < runs; run++) {
+        char buffers[MAX_ARGS][PATH_MAX];
+        char *argv[MAX_ARGS + 1];
+        fill_args(command, run, argv, buffers);
+
+        if (cold) make_cold();
+        long rss_kb = 0;
+        times[run] = run_once(argv, &rss_kb);
+        if (times[run] < 0) {
+            fprintf(stderr, "bm %s failed (%zu bookmarks, run %d)\n", command, count, run);
+            free(times);
+            return 1;
+        }
+        if (rss_kb > result.max_rss_kb) result.max_rss_kb = rss_kb;
+    }
+
+    qsort(times, runs, sizeof(long), compare_longs);
+    result.p50_us = times[runs / 2];
+    result.p99_us = times[(runs * 99 + 99) / 100 - 1];
+    free(times);
+
+    printf("{\"command\":\"%s\",\"bookmarks\":%zu,\"mode\":\"%s\",\"runs\":%d,\"p50_us\":%ld,\"p99_us\":%ld,\"max_rss_kb\":%ld}\n",
+           command, count, mode, runs, result.p50_us, result.p99_us, result.max_rss_kb);
+    fflush(stdout);
+    fprintf(stderr, "%-7s %8zu  %-4s  p50 %8ld us  p99 %8ld us  rss %7ld KiB\n",
+            command, count, mode, result.p50_us, result.p99_us, result.max_rss_kb);
+    return 0;
+}
+
+/*
+ * Fills argv for one run. Mutations are arranged so that every run succeeds and the store
+ * keeps its size: add uses fresh names, delete removes them again, and rename and edit
+ * flip one bookmark between two states.
+ */
+static void fill_args(const char *command, int run, char *argv[], char buffers[][PATH_MAX]) {
+    int argc = 0;
+    argv[argc++] = "bm";
+    argv[argc++] = (char *) command;
+
+    if (strcmp(command, "go") == 0) {
+        argv[argc++] = samples[run % sample_count];
+    } else if (strcmp(command, "add") == 0) {
+        snprintf(buffers[0], PATH_MAX, "bench-%d", added++);
+        snprintf(buffers[1], PATH_MAX, "%s/projects", home);
+        argv[argc++] = buffers[0];
+        argv[argc++] = buffers[1];
+    } else if (strcmp(command, "delete") == 0) {
+        snprintf(buffers[0], PATH_MAX, "bench-%d", deleted++);
+        argv[argc++] = buffers[0];
+    } else if (strcmp(command, "rename") == 0) {
+        argv[argc++] = renamed ? "bench-renamed" : samples[0];
+        argv[argc++] = renamed ? samples[0] : "bench-renamed";
+        renamed = !renamed;
+    } else if (strcmp(command, "edit") == 0) {
+        snprintf(buffers[0], PATH_MAX, run % 2 ? "%s/projects" : "%s/projects/other", home);
+        argv[argc++] = samples[sample_count - 1];
+        argv[argc++] = buffers[0];
+    } else if (strcmp(command, "which") == 0) {
+        // Below the directory edit left the last sample pointing at, whichever of the two it is
+        snprintf(buffers[0], PATH_MAX, "%s/projects/other/src/lib", home);
+        argv[argc++] = buffers[0];
+    }
+    argv[argc] = NULL;
+}
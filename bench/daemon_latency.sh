@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+# Compares 'bm go' latency with and without a running 'bm daemon'.
+# Usage: bench/daemon_latency.sh [bookmarks] [runs]
+# Runs against a throwaway HOME, so the real ~/.bm is never touched.
+
+set -euo pipefail
+shopt -s inherit_errexit    # A failing 'bm go' inside $(measure) aborts the run too
+
+BM="$(cd "$(dirname "$0")/.." && pwd)/bm"
+COUNT="${1:-100000}"
+RUNS="${2:-1000}"
+
+export HOME="$(mktemp -d)"
+trap 'kill "$DAEMON_PID" 2>/dev/null || true; rm -rf "$HOME"' EXIT
+DAEMON_PID=""
+
+# 'bm init' writes an empty bookmarks.snap, which shadows any bookmarks.tsv, so the rows are imported
+"$BM" init > /dev/null
+awk -v count="$COUNT" 'BEGIN {
+    print "Bookmark Name\tDirectory Path"
+    for (i = 0; i < count; i++) printf "bm%d\t/home/user/projects/service-%d/src\n", i, i
+}' > "$HOME/bookmarks.tsv"
+"$BM" import --from=tsv "$HOME/bookmarks.tsv" > /dev/null
+
+# Mean wall-clock time of one 'bm go', in microseconds
+measure() {
+    local name="bm$((COUNT / 2))"
+    # Warm the page cache and build the index. A lookup that fails would time an error path, so stop instead
+    local path
+    path=$("$BM" go "$name")
+    if [ "$path" != "/home/user/projects/service-$((COUNT / 2))/src" ]; then
+        echo "bm go $name printed '$path' instead of its path" >&2
+        exit 1
+    fi
+    local start end
+    start=$(date +%s%N)
+    for ((i = 0; i < RUNS; i++)); do
+        "$BM" go "$name" > /dev/null
+    done
+    end=$(date +%s%N)
+    echo $(( (end - start) / RUNS / 1000 ))
+}
+
+direct=$(measure)
+
+"$BM" daemon > /dev/null &
+DAEMON_PID=$!
+for _ in $(seq 50); do [ -S "$HOME/.bm/bm.sock" ] && break; sleep 0.1; done
+daemon=$(measure)
+
+echo "bookmarks: $COUNT, runs: $RUNS"
+echo "bm go (direct, mmapped index): ${direct} us"
+echo "bm go (bm daemon):             ${daemon} us"
@@ -0,0 +1,64 @@
+/*
+ * Measures how long one fuzzy query takes against a large store, without process startup.
+ * Build and run from the repository root:
+ *   gcc -O2 -pthread bench/fuzzy_match.c src/fuzzy.c src/store.c -o fuzzy_match && ./fuzzy_match [bookmarks] [runs]
+ */
+
+#include "../src/fuzzy.h"
+#include "../src/store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *words[] = { "api", "web", "docs", "infra", "tools", "data", "mobile", "auth", "search", "billing" };
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    int runs = argc > 2 ? atoi(argv[2]) : 200;
+
+    // Unique names like "search-7341" and "toomob-7342", in the bookmarks.tsv format
+    size_t capacity = 64 + count * 64;
+    char *contents = malloc(capacity);
+    if (!contents) return 1;
+    size_t size = snprintf(contents, capacity, "Bookmark Name\tDirectory Path\n");
+    for (size_t i = 0; i < count; i++) {
+        const char *first = words[i % WORD_COUNT], *second = words[(i / WORD_COUNT) % WORD_COUNT];
+        if (i % 2) size += snprintf(contents + size, capacity - size, "%s-%zu\t/srv/%zu\n", first, i, i);
+        else size += snprintf(contents + size, capacity - size, "%.3s%.3s-%zu\t/srv/%zu\n", first, second, i, i);
+    }
+
+    BookmarkStore store;
+    if (store_load_buffer(&store, contents, size) != 0) {
+        store_free(&store);
+        return 1;
+    }
+
+    FuzzyTable table;
+    double start = now_us();
+    if (fuzzy_build(&table, &store) != 0) return 1;
+    printf("bookmarks: %zu, runs: %d per query\n", store.count, runs);
+    printf("%-16s %10.1f us\n", "pack names", now_us() - start);
+
+    // A prefix, a sparse subsequence, a full name, and two queries that match nothing
+    const char *queries[] = { "sea", "tmob", "web-7341", "blilng", "zzz" };
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+        long best = -1;
+        start = now_us();
+        for (int i = 0; i < runs; i++) best = fuzzy_best(&table, queries[q], NULL);
+        double mean = (now_us() - start) / runs;
+        printf("%-16s %10.1f us  -> %s\n", queries[q], mean, best >= 0 ? bookmark_name(&store, &store.records[best]) : "(none)");
+    }
+
+    fuzzy_free(&table);
+    store_free(&store);
+    return 0;
+}
@@ -0,0 +1,628 @@
+/*
+ * Runs several processes that issue random bm commands against one store for a fixed time,
+ * then checks the store against a model of what every process did.
+ * Build and run from the repository root with 'make stress', or:
+ *   gcc -O2 -Wall -Wextra bench/stress.c -o bm_stress && ./bm_stress ./bm [-p processes] [-d seconds] [-n bookmarks]
+ *
+ * The store lives in a throwaway HOME and starts out with n "base-<i>" bookmarks that are only
+ * ever read. Each process then adds, deletes, renames and edits bookmarks it owns ("w<process>-<n>"),
+ * so while all of them contend for the same files and the same writer lock, the outcome of a
+ * process's commands doesn't depend on the others and its part of the model is exact. It also
+ * runs go on its own and the base bookmarks, and list over the whole store.
+ *
+ * Checks:
+ *   lost updates   Bookmarks of the model missing from the final store or pointing elsewhere,
+ *                  and bookmarks in the final store that the model doesn't have
+ *   torn reads     'bm go' printing anything but the path the model expects, during the run
+ *   corrupt lines  Lines of 'bm list --format=tsv' (during the run and at the end) that aren't
+ *                  a name, a tab and an absolute path
+ *   errors         Commands that failed although the model expected them to succeed. Before the run,
+ *                  a duplicate add and a go, delete, rename and edit of a missing name check that bm
+ *                  reports failures in its exit status, which is how they are counted
+ *
+ * Results go to stdout as one JSON object per command, then one for the checks:
+ *   {"command":"add","processes":8,"seconds":10,"ops":5120,"ops_per_sec":512.0,"p50_us":1610,"p99_us":5210,"p999_us":8120,"max_us":9800,"errors":0}
+ *   {"check":"consistency","processes":8,"seconds":10,"lost_updates":0,"torn_reads":0,"corrupt_lines":0,"errors":0}
+ * A readable summary goes to stderr. Exits with 1 if any check finds a problem.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_OWNED 128           // Bookmarks a process keeps at most, so deletes and adds stay balanced
+#define DIRECTORY_COUNT 16      // Directories per process for add and edit, which check that paths exist
+#define MAX_NAME 16
+
+typedef enum { OP_GO, OP_ADD, OP_DELETE, OP_RENAME, OP_EDIT, OP_LIST, OP_COUNT } Operation;
+
+static const char *operation_names[OP_COUNT] = { "go", "add", "delete", "rename", "edit", "list" };
+
+// Out of 100: reads dominate, as they do in everyday use
+static const int operation_weights[OP_COUNT] = { 45, 15, 10, 10, 15, 5 };
+
+// One bookmark a process owns
+typedef struct {
+    char name[MAX_NAME];
+    int directory;
+} OwnedBookmark;
+
+// Latencies of one command, in microseconds
+typedef struct {
+    long *samples;
+    size_t count;
+    size_t capacity;
+    long errors;
+} Series;
+
+// A bookmark of the model or of the final store
+typedef struct {
+    char *name;
+    char *path;
+} Entry;
+
+typedef struct {
+    Entry *entries;
+    size_t count;
+    size_t capacity;
+} EntryList;
+
+static char bm_path[PATH_MAX];
+static char home[256];
+static uint64_t rng_state;
+
+// Helper functions
+static uint64_t next_random(void);
+static int create_store(size_t count);
+static int check_failures(void);
+static void directory_path(char *path, int process, int directory);
+static int run_worker(int process, double seconds, size_t base_count);
+static long run_bm(char *const argv[], char **output, size_t *output_len, int *exit_status);
+static long check_list_output(char *output, size_t len, EntryList *entries);
+static int series_add(Series *series, long sample);
+static int entry_add(EntryList *list, const char *name, const char *path);
+static int compare_entries(const void *a, const void *b);
+static int compare_longs(const void *a, const void *b);
+static long percentile(const Series *series, int per_thousand);
+static double elapsed_seconds(const struct timespec *start);
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to bm> [-p processes] [-d seconds] [-n bookmarks]\n", argv[0]);
+        return 1;
+    }
+    if (!realpath(argv[1], bm_path)) {
+        fprintf(stderr, "Failed to resolve %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    int processes = 8;
+    double seconds = 10;
+    size_t base_count = 1000;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-p") == 0) processes = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-d") == 0) seconds = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-n") == 0) base_count = strtoul(argv[i + 1], NULL, 10);
+    }
+    if (processes < 1 || processes > 999 || seconds <= 0) {
+        fprintf(stderr, "Need 1-999 processes and a positive duration\n");
+        return 1;
+    }
+
+    // bm stores resolved paths, which the model has to match
+    char template[] = "/tmp/bm_stress.XXXXXX", resolved[PATH_MAX];
+    if (!mkdtemp(template) || !realpath(template, resolved)) {
+        fprintf(stderr, "Failed to create a temporary HOME: %s\n", strerror(errno));
+        return 1;
+    }
+    if (strlen(resolved) >= sizeof(home)) {
+        fprintf(stderr, "The temporary HOME %s is too long\n", resolved);
+        return 1;
+    }
+    strcpy(home, resolved);
+    setenv("HOME", home, 1);
+    if (create_store(base_count) != 0 || check_failures() != 0) return 1;
+
+    for (int process = 0; process < processes; process++) {
+        for (int directory = 0; directory < DIRECTORY_COUNT; directory++) {
+            char path[PATH_MAX];
+            directory_path(path, process, directory);
+            char *slash = strrchr(path, '/');
+            *slash = '\0';
+            mkdir(path, 0755);
+            *slash = '/';
+            if (mkdir(path, 0755) != 0) {
+                fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+                return 1;
+            }
+        }
+    }
+
+    fprintf(stderr, "Running %d processes for %.0f s against %zu bookmarks in %s\n", processes, seconds, base_count, home);
+    pid_t *pids = calloc(processes, sizeof(pid_t));
+    if (!pids) return 1;
+    for (int process = 0; process < processes; process++) {
+        pids[process] = fork();
+        if (pids[process] == -1) {
+            fprintf(stderr, "Failed to start a process: %s\n", strerror(errno));
+            return 1;
+        }
+        if (pids[process] == 0) _exit(run_worker(process, seconds, base_count));
+    }
+
+    int status = 0;
+    for (int process = 0; process < processes; process++) {
+        int worker_status;
+        if (waitpid(pids[process], &worker_status, 0) == -1 || !WIFEXITED(worker_status) || WEXITSTATUS(worker_status) != 0) {
+            fprintf(stderr, "Process %d failed\n", process);
+            status = 1;
+        }
+    }
+    free(pids);
+    if (status != 0) return 1;
+
+    // Gather every process's latencies, counters and model
+    Series series[OP_COUNT] = { 0 };
+    EntryList model = { 0 };
+    long torn_reads = 0, corrupt_lines = 0;
+    for (size_t i = 0; i < base_count; i++) {
+        char name[MAX_NAME], path[64];
+        snprintf(name, sizeof(name), "base-%zu", i);
+        snprintf(path, sizeof(path), "/srv/stress/base-%zu", i);
+        if (entry_add(&model, name, path) != 0) return 1;
+    }
+    for (int process = 0; process < processes; process++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/results-%d", home, process);
+        FILE *file = fopen(path, "r");
+        if (!file) {
+            fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+
+        char line[PATH_MAX + 64];
+        while (fgets(line, sizeof(line), file)) {
+            line[strcspn(line, "\n")] = '\0';
+            long a, b, c;
+            char name[MAX_NAME], owned_path[PATH_MAX];
+            if (sscanf(line, "L %ld %ld", &a, &b) == 2 && a >= 0 && a < OP_COUNT) {
+                if (series_add(&series[a], b) != 0) return 1;
+            }
+            else if (sscanf(line, "E %ld %ld", &a, &b) == 2 && a >= 0 && a < OP_COUNT) {
+                series[a].errors += b;
+            }
+            else if (sscanf(line, "C %ld %ld %ld", &a, &b, &c) == 3) {
+                torn_reads += a;
+                corrupt_lines += b;
+            }
+            else if (sscanf(line, "M %15s %4095s", name, owned_path) == 2) {
+                if (entry_add(&model, name, owned_path) != 0) return 1;
+            }
+        }
+        fclose(file);
+    }
+
+    // Compare the final store with the model, both sorted by name
+    char *list_argv[] = { "bm", "list", "--format=tsv", "--no-pager", NULL };
+    char *output = NULL;
+    size_t output_len = 0;
+    int exit_status;
+    EntryList store = { 0 };
+    if (run_bm(list_argv, &output, &output_len, &exit_status) < 0 || exit_status != 0) {
+        fprintf(stderr, "Failed to list the final store\n");
+        return 1;
+    }
+    corrupt_lines += check_list_output(output, output_len, &store);
+
+    qsort(model.entries, model.count, sizeof(Entry), compare_entries);
+    qsort(store.entries, store.count, sizeof(Entry), compare_entries);
+    long lost_updates = 0;
+    size_t m = 0, s = 0;
+    while (m < model.count || s < store.count) {
+        int order = m == model.count ? 1 : s == store.count ? -1 : strcmp(model.entries[m].name, store.entries[s].name);
+        if (order < 0) {
+            fprintf(stderr, "Lost: %s --> %s is missing\n", model.entries[m].name, model.entries[m].path);
+            lost_updates++;
+            m++;
+        }
+        else if (order > 0) {
+            fprintf(stderr, "Lost: %s --> %s shouldn't exist\n", store.entries[s].name, store.entries[s].path);
+            lost_updates++;
+            s++;
+        }
+        else {
+            if (strcmp(model.entries[m].path, store.entries[s].path) != 0) {
+                fprintf(stderr, "Lost: %s --> %s points to %s\n", model.entries[m].name, model.entries[m].path, store.entries[s].path);
+                lost_updates++;
+            }
+            m++;
+            s++;
+        }
+    }
+
+    long errors = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        Series *current = &series[op];
+        qsort(current->samples, current->count, sizeof(long), compare_longs);
+        double rate = current->count / seconds;
+        long p50 = percentile(current, 500), p99 = percentile(current, 990), p999 = percentile(current, 999);
+        long max = current->count ? current->samples[current->count - 1] : 0;
+        printf("{\"command\":\"%s\",\"processes\":%d,\"seconds\":%.0f,\"ops\":%zu,\"ops_per_sec\":%.1f,"
+               "\"p50_us\":%ld,\"p99_us\":%ld,\"p999_us\":%ld,\"max_us\":%ld,\"errors\":%ld}\n",
+               operation_names[op], processes, seconds, current->count, rate, p50, p99, p999, max, current->errors);
+        fprintf(stderr, "%-7s %7zu ops  %8.1f ops/s  p50 %7ld us  p99 %7ld us  p99.9 %7ld us  max %7ld us  errors %ld\n",
+                operation_names[op], current->count, rate, p50, p99, p999, max, current->errors);
+        errors += current->errors;
+        free(current->samples);
+    }
+    printf("{\"check\":\"consistency\",\"processes\":%d,\"seconds\":%.0f,\"lost_updates\":%ld,\"torn_reads\":%ld,\"corrupt_lines\":%ld,\"errors\":%ld}\n",
+           processes, seconds, lost_updates, torn_reads, corrupt_lines, errors);
+    fprintf(stderr, "lost updates %ld, torn reads %ld, corrupt lines %ld, errors %ld\n", lost_updates, torn_reads, corrupt_lines, errors);
+
+    free(output);
+    free(model.entries);
+    free(store.entries);
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", home);
+    if (system(command) != 0) fprintf(stderr, "Failed to remove %s\n", home);
+    return lost_updates || torn_reads || corrupt_lines || errors ? 1 : 0;
+}
+
+// Helper functions
+
+/*
+ * xorshift64*, seeded per process.
+ */
+static uint64_t next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+/*
+ * Initializes the store and fills it with count base bookmarks. Their paths don't exist:
+ * they are only read by go and list, which never touch them.
+ */
+static int create_store(size_t count) {
+    char *init_argv[] = { "bm", "init", NULL };
+    int exit_status;
+    if (run_bm(init_argv, NULL, NULL, &exit_status) < 0 || exit_status != 0) {
+        fprintf(stderr, "Failed to initialize the store\n");
+        return 1;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/base.tsv", home);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fprintf(file, "Bookmark Name\tDirectory Path\n");
+    for (size_t i = 0; i < count; i++) fprintf(file, "base-%zu\t/srv/stress/base-%zu\n", i, i);
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    char *import_argv[] = { "bm", "import", "--from=tsv", path, NULL };
+    if (count > 0 && (run_bm(import_argv, NULL, NULL, &exit_status) < 0 || exit_status != 0)) {
+        fprintf(stderr, "Failed to import the base bookmarks\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Runs commands that must fail and checks that bm exits non-zero for each, since that is the only
+ * way a failed command is counted as an error. Leaves the store as it found it.
+ * Returns 0 on success, 1 if a failure goes unreported (or bm couldn't be run).
+ */
+static int check_failures(void) {
+    char *add_argv[] = { "bm", "add", "stress-probe", home, NULL };
+    char *delete_argv[] = { "bm", "delete", "stress-probe", NULL };
+    char *failing[][5] = {
+        { "bm", "add", "stress-probe", home, NULL },                 // Duplicate name
+        { "bm", "go", "stress-missing", NULL },
+        { "bm", "delete", "stress-missing", NULL },
+        { "bm", "rename", "stress-missing", "stress-other", NULL },
+        { "bm", "edit", "stress-missing", home, NULL },
+    };
+
+    int exit_status;
+    if (run_bm(add_argv, NULL, NULL, &exit_status) < 0 || exit_status != 0) {
+        fprintf(stderr, "Failed to add the probe bookmark\n");
+        return 1;
+    }
+    int status = 0;
+    for (size_t i = 0; i < sizeof(failing) / sizeof(failing[0]); i++) {
+        if (run_bm(failing[i], NULL, NULL, &exit_status) < 0 || exit_status == 0) {
+            fprintf(stderr, "'bm %s %s' exited 0, so failed commands can't be counted as errors\n", failing[i][1], failing[i][2]);
+            status = 1;
+        }
+    }
+    if (run_bm(delete_argv, NULL, NULL, &exit_status) < 0 || exit_status != 0) {
+        fprintf(stderr, "Failed to delete the probe bookmark\n");
+        return 1;
+    }
+    return status;
+}
+
+static void directory_path(char *path, int process, int directory) {
+    snprintf(path, PATH_MAX, "%s/w%d/d%d", home, process, directory);
+}
+
+/*
+ * Issues random commands until the time is up, checking every read against the process's model,
+ * then writes its latencies, counters and model to results-<process> in HOME:
+ *   L <operation> <microseconds>   one per command
+ *   E <operation> <errors>
+ *   C <torn reads> <corrupt lines> 0
+ *   M <name> <path>                one per bookmark the process owns at the end
+ * Returns 0 on success, 1 if the results couldn't be written.
+ */
+static int run_worker(int process, double seconds, size_t base_count) {
+    rng_state = 0x9e3779b97f4a7c15ull ^ ((uint64_t) (process + 1) * 0xbf58476d1ce4e5b9ull);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/results-%d", home, process);
+    FILE *results = fopen(path, "w");
+    if (!results) return 1;
+
+    OwnedBookmark owned[MAX_OWNED];
+    size_t owned_count = 0;
+    unsigned next_name = 0;
+    long errors[OP_COUNT] = { 0 };
+    long torn_reads = 0, corrupt_lines = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (elapsed_seconds(&start) < seconds) {
+        int roll = next_random() % 100;
+        Operation op = OP_GO;
+        while (roll >= operation_weights[op]) roll -= operation_weights[op++];
+
+        // Commands on an owned bookmark need one; deletes only make room once the process is full
+        if (owned_count == 0 && op != OP_LIST && (op != OP_GO || base_count == 0)) op = OP_ADD;
+        if (owned_count == MAX_OWNED && op == OP_ADD) op = OP_DELETE;
+
+        size_t target = owned_count ? next_random() % owned_count : 0;
+        char name[MAX_NAME], directory[PATH_MAX], expected[PATH_MAX];
+        char *argv[6] = { "bm", (char *) operation_names[op], NULL, NULL, NULL, NULL };
+        int new_directory = next_random() % DIRECTORY_COUNT;
+        expected[0] = '\0';
+        switch (op) {
+            case OP_GO:
+                if (owned_count == 0 || (base_count > 0 && next_random() % 2)) {
+                    unsigned base = next_random() % base_count;
+                    snprintf(name, sizeof(name), "base-%u", base);
+                    snprintf(expected, sizeof(expected), "/srv/stress/base-%u", base);
+                }
+                else {
+                    strcpy(name, owned[target].name);
+                    directory_path(expected, process, owned[target].directory);
+                }
+                argv[2] = name;
+                break;
+            case OP_ADD:
+                snprintf(name, sizeof(name), "w%d-%u", process, next_name++);
+                directory_path(directory, process, new_directory);
+                argv[2] = name;
+                argv[3] = directory;
+                break;
+            case OP_DELETE:
+                argv[2] = owned[target].name;
+                break;
+            case OP_RENAME:
+                snprintf(name, sizeof(name), "w%d-%u", process, next_name++);
+                argv[2] = owned[target].name;
+                argv[3] = name;
+                break;
+            case OP_EDIT:
+                directory_path(directory, process, new_directory);
+                argv[2] = owned[target].name;
+                argv[3] = directory;
+                break;
+            case OP_LIST:
+                argv[2] = "--format=tsv";
+                argv[3] = "--no-pager";
+                break;
+            case OP_COUNT:
+                break;
+        }
+
+        char *output = NULL;
+        size_t output_len = 0;
+        int exit_status;
+        bool capture = op == OP_GO || op == OP_LIST;
+        long latency = run_bm(argv, capture ? &output : NULL, capture ? &output_len : NULL, &exit_status);
+        if (latency < 0) {
+            fclose(results);
+            return 1;
+        }
+        fprintf(results, "L %d %ld\n", op, latency);
+
+        if (exit_status != 0) {
+            errors[op]++;
+        }
+        else if (op == OP_GO) {
+            // bm go prints the path and a newline, and nothing else
+            size_t expected_len = strlen(expected);
+            if (output_len != expected_len + 1 || memcmp(output, expected, expected_len) != 0 || output[expected_len] != '\n') torn_reads++;
+        }
+        else if (op == OP_LIST) {
+            corrupt_lines += check_list_output(output, output_len, NULL);
+        }
+        else if (op == OP_ADD) {
+            strcpy(owned[owned_count].name, name);
+            owned[owned_count++].directory = new_directory;
+        }
+        else if (op == OP_DELETE) {
+            owned[target] = owned[--owned_count];
+        }
+        else if (op == OP_RENAME) {
+            strcpy(owned[target].name, name);
+        }
+        else if (op == OP_EDIT) {
+            owned[target].directory = new_directory;
+        }
+        free(output);
+    }
+
+    for (int op = 0; op < OP_COUNT; op++) fprintf(results, "E %d %ld\n", op, errors[op]);
+    fprintf(results, "C %ld %ld 0\n", torn_reads, corrupt_lines);
+    for (size_t i = 0; i < owned_count; i++) {
+        directory_path(path, process, owned[i].directory);
+        fprintf(results, "M %s %s\n", owned[i].name, path);
+    }
+    return fclose(results) == 0 ? 0 : 1;
+}
+
+/*
+ * Runs bm once with stderr discarded, and stdout captured into a malloc'd *output
+ * (or discarded if output is NULL).
+ * Returns the wall-clock time in microseconds, or -1 if bm couldn't be run.
+ */
+static long run_bm(char *const argv[], char **output, size_t *output_len, int *exit_status) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int fds[2] = { -1, -1 };
+    if (output && pipe2(fds, O_CLOEXEC) != 0) return -1;
+
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(output ? fds[1] : null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(bm_path, argv);
+        _exit(127);
+    }
+
+    if (output) {
+        close(fds[1]);
+        size_t capacity = 4096;
+        *output = malloc(capacity);
+        *output_len = 0;
+        for (;;) {
+            if (*output_len == capacity) {
+                capacity *= 2;
+                char *grown = realloc(*output, capacity);
+                if (!grown) break;
+                *output = grown;
+            }
+            ssize_t bytes = read(fds[0], *output + *output_len, capacity - *output_len);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) break;
+            *output_len += bytes;
+        }
+        close(fds[0]);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) return -1;
+    *exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128;
+    return (long) (elapsed_seconds(&start) * 1e6);
+}
+
+/*
+ * Checks that every line of 'bm list --format=tsv' output is a name, a tab and an absolute path,
+ * and collects the bookmarks into entries (unless it is NULL). The lines are split in place.
+ * Returns the number of corrupt lines.
+ */
+static long check_list_output(char *output, size_t len, EntryList *entries) {
+    long corrupt = 0;
+    char *line = output;
+    char *end = output + len;
+    while (line < end) {
+        char *newline = memchr(line, '\n', end - line);
+        if (!newline) {
+            corrupt++;      // Cut off before its newline
+            break;
+        }
+        *newline = '\0';
+
+        char *tab = strchr(line, '\t');
+        if (!tab || tab == line || tab - line >= MAX_NAME || tab[1] != '/' || strchr(tab + 1, '\t') || strpbrk(line, " \r")) {
+            corrupt++;
+        }
+        else if (entries) {
+            *tab = '\0';
+            if (entry_add(entries, line, tab + 1) != 0) corrupt++;
+        }
+        line = newline + 1;
+    }
+    return corrupt;
+}
+
+/*
+ * Returns 0 on success, 1 if memory runs out.
+ */
+static int series_add(Series *series, long sample) {
+    if (series->count == series->capacity) {
+        size_t capacity = series->capacity ? series->capacity * 2 : 1024;
+        long *samples = realloc(series->samples, capacity * sizeof(long));
+        if (!samples) return 1;
+        series->samples = samples;
+        series->capacity = capacity;
+    }
+    series->samples[series->count++] = sample;
+    return 0;
+}
+
+/*
+ * Adds a copy of a bookmark to a list. The copies are never freed: the harness exits right after.
+ * Returns 0 on success, 1 if memory runs out.
+ */
+static int entry_add(EntryList *list, const char *name, const char *path) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+        Entry *entries = realloc(list->entries, capacity * sizeof(Entry));
+        if (!entries) return 1;
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+    Entry *entry = &list->entries[list->count];
+    entry->name = strdup(name);
+    entry->path = strdup(path);
+    if (!entry->name || !entry->path) return 1;
+    list->count++;
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const Entry *) a)->name, ((const Entry *) b)->name);
+}
+
+static int compare_longs(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Returns the sample at a percentile given in thousandths, from sorted samples (0 if there are none).
+ */
+static long percentile(const Series *series, int per_thousand) {
+    if (series->count == 0) return 0;
+    size_t rank = (series->count * per_thousand + 999) / 1000;
+    return series->samples[rank ? rank - 1 : 0];
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -1,37 +1,115 @@
+#define _GNU_SOURCE     // strcasestr and FNM_CASEFOLD
+
 #include "bookmarks.h"
+#include "completion.h"
+#include "daemon.h"
+#include "fuzzy.h"
+#include "history.h"
+#include "index.h"
+#include "interop.h"
+#include "layers.h"
+#include "output.h"
+#include "stats.h"
+#include "store.h"
+#include "tags.h"
+#include "trace.h"
+#include "usage.h"
+#include "validate.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+
+// One non-blank line of a batch, split in place
+typedef struct {
+    size_t line_number;
+    char *text;         // Owned copy of the line
+    char *op;
+    char *name;
+    char *rest;         // The path or the new name
+    char *path;         // Owned, tilde-expanded path of add and edit lines, NULL otherwise
+} BatchLine;
+
+// A bookmark's position in the store and its rank, for sorting 'bm list'
+typedef struct {
+    size_t index;
+    double frecency;
+} RankedBookmark;
+
+// The store whose records list_bookmarks is sorting (qsort has no context argument)
+static const BookmarkStore *sorting_store;
 
 // Helper functions
-static void free_bookmarks(BookmarkNode *head);
-static BookmarkNode *load_bookmarks(void);
-static int save_bookmarks(BookmarkNode *head);
-static void trim_trailing_space(char *name);
-static BookmarkNode *find_bookmark(BookmarkNode *head, char *name);
-static bool bookmark_exists(BookmarkNode *head, char *name);
 static bool is_initialized(void);
 static char *resolve_tilde(char *path);
-static char *get_bookmark_file_path(void);
-static char *get_bookmark_dir_path(void);
+static int load_for_reading(BookmarkStore *store);
+static bool matches_filter(const char *filter, const char *name, const char *path);
+static bool list_includes(const ListOptions *options, const BookmarkStore *store, size_t position, const uint64_t *selected);
+static uint64_t *select_tagged(const LayerStack *stack, const BookmarkStore *store, const ListOptions *options);
+static int change_tags(char *name, char **tags, int tag_count, bool remove);
+static int compare_names(const void *a, const void *b);
+static int compare_paths(const void *a, const void *b);
+static int compare_frecency(const void *a, const void *b);
+static FILE *start_pager(void);
+static int stream_list(const ListOptions *options, StoreStream *stream);
+static void print_list_row(OutputBuffer *out, ListFormat format, const StreamedBookmark *row, const UsageRecord *record,
+                           bool show_usage, int longest_path, time_t now, bool first);
+static void print_border(OutputBuffer *out, int longest_path, bool show_usage);
+static void format_age(char *buffer, size_t size, int64_t last_visit, time_t now);
+static int go_fuzzy(const BookmarkStore *store, const char *query);
+static int resolve_which_path(const char *path, char *resolved);
+static int resolve_name(OutputBuffer *out, const BookmarkView *view, const char *name, char delimiter);
+static void print_completions(const BookmarkIndex *index, const char *prefix);
+static void parse_batch_line(BatchLine *line);
+static int apply_batch_line(BookmarkStore *store, const BatchLine *line, const PathCheck *check);
+static char *next_token(char **cursor);
+static int write_line(int fd, const char *text);
+static int load_history(BookmarkStore *store, History *history);
+static int restore_generation(BookmarkStore *store, const History *history, uint64_t generation, const char *verb);
+static void print_generation(const HistoryRecord *records, size_t count, bool current);
 
 void print_helper(void) {
-    printf("Usage: bm <command> [<args>]\n");
+    printf("Usage: bm [--trace] <command> [<args>]\n");
     printf("Commands:\n");
     printf("  init                                  Initialize bookmark system\n");
     printf("  add <name> <path>                     Add a bookmark\n");
     printf("  delete <name>                         Delete a bookmark\n");
-    printf("  list                                  List all bookmarks\n");
+    printf("  list [<options>]                      List bookmarks. Options: --sort=name|path|frecency,\n");
+    printf("                                        --filter <glob|substring>, --format=table|tsv|json|null, --no-pager,\n");
+    printf("                                        --tag <a,b> (all of), --any-tag <a,b>, --not-tag <a,b>\n");
     printf("  rename <old_name> <new_name>          Rename a bookmark\n");
     printf("  edit <name> <new_path>                Edit a bookmark's path\n");
-    printf("  go <name>                             Print path of a bookmark\n");
+    printf("  tag <name> [<tag>...]                 Add tags to a bookmark, or print its tags\n");
+    printf("  untag <name> <tag>...                 Remove tags from a bookmark\n");
+    printf("  go <name>                             Print path of a bookmark (or of its best fuzzy match)\n");
+    printf("  which [<path>]                        Print the bookmark of a directory or its nearest bookmarked parent\n");
+    printf("  resolve [-0]                          Print the path of each name read from stdin (-0: NUL-delimited)\n");
+    printf("  batch [<file>]                        Apply add/delete/rename/edit lines from a file or stdin\n");
+    printf("  complete <prefix>                     Print bookmark names starting with prefix\n");
+    printf("  completion <bash|zsh|fish>            Print a shell completion script\n");
+    printf("  daemon [--watch]                      Serve lookups from memory until stopped\n");
+    printf("  doctor [--prune] [--relink]           Check every bookmarked directory in parallel\n");
+    printf("  import --from=<format> [<file>]       Add the directories of another tool's database (or stdin).\n");
+    printf("                                        Formats: tsv, autojump, z, fasd, zoxide, cdpath\n");
+    printf("  export [--to=<format>]                Print the bookmarks in one of the import formats (default: tsv)\n");
+    printf("  history                               List the generations of the bookmarks, newest first\n");
+    printf("  undo                                  Go back to the bookmarks before the last change\n");
+    printf("  restore <generation>                  Go back to the bookmarks of a generation (the undo can be undone)\n");
+    printf("  stats [--json]                        Show latency percentiles, lookup misses and the size of the store\n");
     printf("  help                                  Print this message\n");
+    printf("Options:\n");
+    printf("  --trace                               Report phase timings and call counts to stderr (or set BM_TRACE)\n");
 }
 
 int init_bookmark(void) {
@@ -46,39 +124,19 @@ int init_bookmark(void) {
     }
     free(dir_path);
 
-    char *file_path = get_bookmark_file_path();
-    if (!file_path) {
-        printf("Error initializing bookmark system!\n");
-        return 1;
-    }
-    FILE *file = fopen(file_path, "r");
-    if (!file) {
-        file = fopen(file_path, "w");
-        if (file) {
-            fprintf(file, "Bookmark Name\tDirectory Path\n");
-            if (fclose(file) == -1) {
-              fprintf(stderr, "Failed to close %s: %s\n", file_path, strerror(errno));
-            }
-            free(file_path);
-
-            printf("Bookmark system initialized!\n");
-            return 0;
-        }
-        else {
-            fprintf(stderr, "Failed to open %s: %s\n", file_path, strerror(errno));
-            free(file_path);
-            return 1;
-        }
-    }
-    else {
-        if (fclose(file) == -1) {
-            fprintf(stderr, "Failed to close %s: %s\n", file_path, strerror(errno));
-        }
-        free(file_path);
-
+    // An existing bookmarks.tsv counts too: it is migrated the first time it is loaded
+    StoreVersion version;
+    if (store_version(&version) == 0) {
         printf("Bookmark system already initialized!\n");
         return 0;
     }
+
+    if (store_create() != 0) {
+        printf("Error initializing bookmark system!\n");
+        return 1;
+    }
+    printf("Bookmark system initialized!\n");
+    return 0;
 }
 
 int add_bookmark(char *name, char *path) {
@@ -99,6 +157,7 @@ int add_bookmark(char *name, char *path) {
         return 1;
     }
 
+    TRACE_PHASE("resolve_path");
     char *tilde_expanded = resolve_tilde(path);
     if (!tilde_expanded) {
         printf("Error: Could not resolve the path.\n");
@@ -117,99 +176,173 @@ int add_bookmark(char *name, char *path) {
         return 1;
     }
 
-    BookmarkNode *head = load_bookmarks();
-
-    if (head) {
-        if (bookmark_exists(head, name)) {
-            printf("Error: A bookmark named '%s' already exists --> %s\n", name, find_bookmark(head, name)->bookmark.path);
-            printf("Try using a different name.\n");
-            free(resolved_path);
-            free_bookmarks(head);
-            return 1;
-        }
+    TRACE_PHASE("load");
+    BookmarkStore store;
+    if (store_load_for_update(&store, NULL) != 0) {
+        free(resolved_path);
+        store_free(&store);
+        return 1;
     }
 
-    BookmarkNode *added_bookmark = malloc(sizeof(BookmarkNode));
-    if (!added_bookmark) {
-        fprintf(stderr, "Failed to allocate memory for bookmark: %s\n", strerror(errno));
+    TRACE_PHASE("lookup");
+    Bookmark *existing = store_find(&store, name);
+    if (existing) {
+        printf("Error: A bookmark named '%s' already exists --> %s\n", name, bookmark_path(&store, existing));
+        printf("Try using a different name.\n");
         free(resolved_path);
-        free_bookmarks(head);
+        store_free(&store);
         return 1;
     }
-    strcpy(added_bookmark->bookmark.name, name);
-    strcpy(added_bookmark->bookmark.path, resolved_path);
-    free(resolved_path);
-    added_bookmark->next = NULL;
 
-    if (!head) {
-        head = added_bookmark;
+    if (store_add(&store, name, resolved_path) != 0) {
+        free(resolved_path);
+        store_free(&store);
+        return 1;
     }
-    else {
-        BookmarkNode *temp = head;
-        while (temp->next) {
-            temp = temp->next;
-        }
-        temp->next = added_bookmark;
+
+    TRACE_PHASE("commit");
+    if (store_commit(&store, JOURNAL_ADD, name, resolved_path) != 0) {
+        free(resolved_path);
+        store_free(&store);
+        return 1;
     }
+    free(resolved_path);
 
-    save_bookmarks(head);
-    free_bookmarks(head);
+    store_free(&store);
     printf("Bookmark added successfully!\n");
     return 0;
 }
 
-int list_bookmarks(void) {
+int list_bookmarks(const ListOptions *options) {
     if (!is_initialized()) {
         printf("You haven't initialized the bookmark system yet.\n");
         printf("Run 'bm init' first to initialize the bookmark system!\n");
         return 1;
     }
 
-    BookmarkNode *head = load_bookmarks();
+    // Project and system stores are merged in memory; neither the stream nor the daemon knows about them
+    LayerStack stack;
+    bool layered = layers_find(&stack) == 0 && stack.count > 1;
+    bool tagged = options->all_tags || options->any_tags || options->no_tags;
+
+    // Unsorted machine-readable output streams straight from the snapshot in constant memory
+    StoreStream stream;
+    if (!layered && !tagged && options->sort == LIST_SORT_NONE && options->format != LIST_FORMAT_TABLE &&
+        store_stream_open(&stream) == 0) {
+        int status = stream_list(options, &stream);
+        store_stream_close(&stream);
+        return status;
+    }
 
-    if (!head) {
-        printf("+------------------+------------------+\n");
-        printf("|  Bookmark Name   |  Directory Path  |\n");
-        printf("+------------------+------------------+\n");
-        printf("|          No bookmarks yet           |\n");
-        printf("+------------------+------------------+\n");
-        return 0;
+    // Tag queries need the store in the same order as the index's bitmaps
+    BookmarkStore store;
+    uint64_t *selected = NULL;
+    if (layered || tagged) {
+        TRACE_PHASE("load");
+        if (layers_load(&stack, &store) != 0) store.count = 0;
+    }
+    else if (load_for_reading(&store) != 0) {
+        store.count = 0;
+    }
+    if (tagged) {
+        TRACE_PHASE("tags");
+        selected = select_tagged(&stack, &store, options);
+        if (!selected) {
+            store_free(&store);
+            return 1;
+        }
     }
 
-    int longest_path = strlen(head->bookmark.path);
+    TRACE_PHASE("sort");
+    bool show_usage = options->sort == LIST_SORT_FRECENCY;
+    UsageMap usage = {0};
+    time_t now = time(NULL);
+    if (show_usage) usage_open(&usage);
+
+    // Only sorting needs an order: otherwise rows are filtered and printed straight from the store
+    RankedBookmark *order = NULL;
+    size_t count = store.count;
+    if (options->sort != LIST_SORT_NONE && store.count > 0) {
+        order = malloc(store.count * sizeof(RankedBookmark));
+        if (!order) {
+            fprintf(stderr, "Failed to allocate memory for the list: %s\n", strerror(errno));
+            usage_close(&usage);
+            free(selected);
+            store_free(&store);
+            return 1;
+        }
 
-    BookmarkNode *temp = head;
-    while (temp) {
-        int len = strlen(temp->bookmark.path);
-        if (len > longest_path) longest_path = len;
-        temp = temp->next;
+        count = 0;
+        for (size_t i = 0; i < store.count; i++) {
+            if (!list_includes(options, &store, i, selected)) continue;
+            order[count].index = i;
+            order[count].frecency = show_usage ? usage_frecency(usage_get(&usage, store.records[i].id), now) : 0;
+            count++;
+        }
+        sorting_store = &store;
+        qsort(order, count, sizeof(RankedBookmark), options->sort == LIST_SORT_NAME ? compare_names :
+                                                    options->sort == LIST_SORT_PATH ? compare_paths : compare_frecency);
     }
 
-    printf("+-----------------+");
-    for (int i = 0; i < longest_path + 2; i++) {
-        printf("-");
-    }
-    printf("+\n");
-    printf("| %-15s | %-*s |\n", " Bookmark Name", longest_path, "Directory Path");
-    printf("+-----------------+");
-    for (int i = 0; i < longest_path + 2; i++) {
-        printf("-");
+    TRACE_PHASE("print");
+    FILE *pager = options->paginate ? start_pager() : NULL;
+    OutputBuffer buffer;
+    OutputBuffer *out = &buffer;
+    output_init(out, pager ? fileno(pager) : STDOUT_FILENO);
+
+    // The table needs the widest path before its first row; the other formats are a single pass
+    int longest_path = 0;
+    bool any = false;
+    for (size_t i = 0; i < count; i++) {
+        const Bookmark *bookmark = &store.records[order ? order[i].index : i];
+        if (!order && !list_includes(options, &store, i, selected)) continue;
+        any = true;
+        if (options->format != LIST_FORMAT_TABLE) break;
+        if (bookmark->path_len > longest_path) longest_path = bookmark->path_len;
     }
-    printf("+\n");
 
-    temp = head;
-    while (temp) {
-        printf("| %-15s | %-*s |\n", temp->bookmark.name, longest_path, temp->bookmark.path);
-        temp = temp->next;
+    if (options->format == LIST_FORMAT_TABLE && !any) {
+        output_string(out, "+------------------+------------------+\n");
+        output_string(out, "|  Bookmark Name   |  Directory Path  |\n");
+        output_string(out, "+------------------+------------------+\n");
+        output_string(out, store.count == 0 ? "|          No bookmarks yet           |\n" : "|        No matching bookmarks        |\n");
+        output_string(out, "+------------------+------------------+\n");
+    }
+    else if (options->format == LIST_FORMAT_TABLE) {
+        print_border(out, longest_path, show_usage);
+        output_string(out, "| ");
+        output_padded(out, " Bookmark Name", 14, 15);
+        output_string(out, " | ");
+        output_padded(out, "Directory Path", 14, longest_path);
+        output_string(out, show_usage ? " | Visits | Last Used |\n" : " |\n");
+        print_border(out, longest_path, show_usage);
     }
-    printf("+-----------------+");
-    for (int i = 0; i < longest_path + 2; i++) {
-        printf("-");
+    else if (options->format == LIST_FORMAT_JSON) {
+        output_string(out, "[");
     }
-    printf("+\n");
 
-    free_bookmarks(head);
-    return 0;
+    bool first = true;
+    for (size_t i = 0; i < count; i++) {
+        const Bookmark *bookmark = &store.records[order ? order[i].index : i];
+        if (!order && !list_includes(options, &store, i, selected)) continue;
+        StreamedBookmark row = { bookmark_name(&store, bookmark), bookmark_path(&store, bookmark), bookmark_tags(&store, bookmark),
+                                 bookmark->id, bookmark->name_len, bookmark->path_len, bookmark->tags_len };
+        print_list_row(out, options->format, &row, show_usage ? usage_get(&usage, bookmark->id) : NULL, show_usage, longest_path, now, first);
+        first = false;
+    }
+
+    if (options->format == LIST_FORMAT_TABLE && any) print_border(out, longest_path, show_usage);
+    else if (options->format == LIST_FORMAT_JSON) output_string(out, first ? "]\n" : "\n]\n");
+
+    // A pager closed early is not an error
+    int status = output_flush(out) != 0 && !pager;
+    if (pager) pclose(pager);
+
+    usage_close(&usage);
+    free(order);
+    free(selected);
+    store_free(&store);
+    return status;
 }
 
 int delete_bookmark(char *name) {
@@ -220,40 +353,33 @@ int delete_bookmark(char *name) {
         return 1;
     }
 
-    BookmarkNode *head = load_bookmarks();
-    BookmarkNode *target = find_bookmark(head, name);
-
-    if (!head) {
+    TRACE_PHASE("load");
+    BookmarkStore store;
+    if (store_load_for_update(&store, NULL) != 0 || store.count == 0) {
+        store_free(&store);
         printf("You don't have any bookmarks yet.\n");
         printf("Use bm add <name> <path> to add one.\n");
         return 1;
     }
 
-    if (target) {
-        if (head == target) {
-            head = head->next;
-            free(target);
-            printf("Bookmark '%s' deleted successfully!\n", name);
-        }
-        else {
-            BookmarkNode *temp = head;
-            while (temp->next != target) {
-                temp = temp->next;
-            }
-            temp->next = target->next;
-            free(target);
-            printf("Bookmark '%s' deleted successfully!\n", name);
-        }
-    }
-    else {
+    TRACE_PHASE("lookup");
+    Bookmark *target = store_find(&store, name);
+    if (!target) {
         printf("Error: There isn't a bookmark named '%s' to delete.\n", name);
         printf("Use 'bm add %s <path>' to add one.\n", name);
-        free_bookmarks(head);
+        store_free(&store);
+        return 1;
+    }
+
+    store_remove(&store, target);
+    TRACE_PHASE("commit");
+    if (store_commit(&store, JOURNAL_DEL, name, NULL) != 0) {
+        store_free(&store);
         return 1;
     }
+    printf("Bookmark '%s' deleted successfully!\n", name);
 
-    save_bookmarks(head);
-    free_bookmarks(head);
+    store_free(&store);
     return 0;
 }
 
@@ -265,42 +391,51 @@ int rename_bookmark(char *old_name, char *new_name) {
         return 1;
     }
 
-    BookmarkNode *head = load_bookmarks();
-    BookmarkNode *target = find_bookmark(head, old_name);
-
-    if (!head) {
+    TRACE_PHASE("load");
+    BookmarkStore store;
+    if (store_load_for_update(&store, NULL) != 0 || store.count == 0) {
+        store_free(&store);
         printf("You don't have any bookmarks yet.\n");
         printf("Use bm add <name> <path> to add one.\n");
         return 1;
     }
 
-    if (target) {
-        if (!bookmark_exists(head, new_name)) {
-            if (strlen(new_name) >= MAX_NAME) {
-                printf("The new bookmark name is too long. Try again\n");
-                free_bookmarks(head);
-                return 1;
-            }
-            strcpy(target->bookmark.name, new_name);
-
-            printf("Bookmark '%s' has been renamed successfully!\n", old_name);
-            printf("'%s' --> %s\n", new_name, target->bookmark.path);
-        }
-        else {
-            printf("There is already a bookmark named '%s'.\n", new_name);
-            free_bookmarks(head);
-            return 1;
-        }
-    }
-    else {
+    TRACE_PHASE("lookup");
+    Bookmark *target = store_find(&store, old_name);
+    if (!target) {
         printf("Error: There isn't a bookmark named '%s' to rename.\n", old_name);
         printf("Use 'bm add %s <path>' to add one.\n", old_name);
-        free_bookmarks(head);
+        store_free(&store);
+        return 1;
+    }
+
+    if (store_find(&store, new_name)) {
+        printf("There is already a bookmark named '%s'.\n", new_name);
+        store_free(&store);
         return 1;
     }
 
-    save_bookmarks(head);
-    free_bookmarks(head);
+    if (strlen(new_name) >= MAX_NAME) {
+        printf("The new bookmark name is too long. Try again\n");
+        store_free(&store);
+        return 1;
+    }
+
+    if (store_rename(&store, target, new_name) != 0) {
+        store_free(&store);
+        return 1;
+    }
+
+    TRACE_PHASE("commit");
+    if (store_commit(&store, JOURNAL_REN, old_name, new_name) != 0) {
+        store_free(&store);
+        return 1;
+    }
+
+    printf("Bookmark '%s' has been renamed successfully!\n", old_name);
+    printf("'%s' --> %s\n", new_name, bookmark_path(&store, target));
+
+    store_free(&store);
     return 0;
 }
 
@@ -312,6 +447,7 @@ int edit_path(char *name, char *new_path) {
         return 1;
     }
 
+    TRACE_PHASE("resolve_path");
     char *tilde_expanded = resolve_tilde(new_path);
     if (!tilde_expanded) {
         printf("Error: Could not resolve the path.\n");
@@ -330,201 +466,731 @@ int edit_path(char *name, char *new_path) {
         return 1;
     }
 
-    BookmarkNode *head = load_bookmarks();
-    BookmarkNode *target = find_bookmark(head, name);
-
-    if (!head) {
+    TRACE_PHASE("load");
+    BookmarkStore store;
+    if (store_load_for_update(&store, NULL) != 0 || store.count == 0) {
+        store_free(&store);
+        free(resolved_path);
         printf("You don't have any bookmarks yet.\n");
         printf("Use bm add <name> <path> to add one.\n");
         return 1;
     }
 
-    if (target) {
-        if (strlen(resolved_path) >= MAX_PATH) {
-            printf("The new directory path is too long. Try again.\n");
-            free(resolved_path);
-            free_bookmarks(head);
-            return 1;
-        }
-        strcpy(target->bookmark.path, resolved_path);
-        printf("Bookmark '%s' has been edited successfully!\n", name);
-        printf("'%s' --> %s\n", name, resolved_path);
-        free(resolved_path);
-    }
-    else {
+    TRACE_PHASE("lookup");
+    Bookmark *target = store_find(&store, name);
+    if (!target) {
         printf("Error: There isn't a bookmark named '%s' to edit.\n", name);
         printf("Use 'bm add %s %s to add it.\n", name, resolved_path);
         free(resolved_path);
-        free_bookmarks(head);
+        store_free(&store);
         return 1;
     }
 
-    save_bookmarks(head);
-    free_bookmarks(head);
+    if (strlen(resolved_path) >= MAX_PATH) {
+        printf("The new directory path is too long. Try again.\n");
+        free(resolved_path);
+        store_free(&store);
+        return 1;
+    }
+
+    if (store_set_path(&store, target, resolved_path) != 0) {
+        free(resolved_path);
+        store_free(&store);
+        return 1;
+    }
+    TRACE_PHASE("commit");
+    if (store_commit(&store, JOURNAL_EDIT, name, resolved_path) != 0) {
+        free(resolved_path);
+        store_free(&store);
+        return 1;
+    }
+    printf("Bookmark '%s' has been edited successfully!\n", name);
+    printf("'%s' --> %s\n", name, resolved_path);
+    free(resolved_path);
+
+    store_free(&store);
     return 0;
 }
 
+int tag_bookmark(char *name, char **tags, int tag_count) {
+    return change_tags(name, tags, tag_count, false);
+}
+
+int untag_bookmark(char *name, char **tags, int tag_count) {
+    return change_tags(name, tags, tag_count, true);
+}
+
 int go(char *name) {
-    if (!is_initialized()) {
+    TRACE_PHASE("layers");
+    // Stats the snapshot and the project and system stores instead of opening them:
+    // on a hit, the index is the only file read
+    BookmarkView view;
+    if (layers_find(&view.stack) != 0) {
         fprintf(stderr,"You haven't initialized the bookmark system yet.\nRun 'bm init' first to initialize the bookmark system!\n");
         return 1;
     }
 
-    BookmarkNode *head = load_bookmarks();
-    BookmarkNode *target = find_bookmark(head, name);
+    // A running daemon answers from memory without touching the files, but it only serves the user store.
+    // Like the index lookup below, this path never allocates and prints with a single write.
+    TRACE_PHASE("daemon");
+    char response[MAX_NAME + MAX_PATH + 16];
+    size_t size;
+    if (view.stack.count == 1 && daemon_request_buffer(DAEMON_GO, name, response, sizeof(response), &size) == 0) {
+        int status = 0;
+        char *matched_path;
+        if (strncmp(response, "OK\t", 3) == 0) {
+            stats_lookup(STATS_LOOKUP_HIT);
+            status = write_all(STDOUT_FILENO, response + 3, size - 3);
+        }
+        else if (strncmp(response, "FUZZY\t", 6) == 0 && (matched_path = strchr(response + 6, '\t'))) {
+            *matched_path++ = '\0';
+            stats_lookup(STATS_LOOKUP_FUZZY);
+            fprintf(stderr, "'%s' matched '%s'\n", name, response + 6);
+            status = write_all(STDOUT_FILENO, matched_path, size - (matched_path - response));
+        }
+        else if (strcmp(response, "EMPTY\n") == 0) {
+            stats_lookup(STATS_LOOKUP_MISS);
+            fprintf(stderr, "You don't have any bookmarks yet.\n");
+            fprintf(stderr, "Use bm add <name> <path> to add one.\n");
+            status = 1;
+        }
+        else {
+            stats_lookup(STATS_LOOKUP_MISS);
+            fprintf(stderr, "'%s' is not a valid bookmark.\n", name);
+            status = 1;
+        }
+        return status;
+    }
 
-    if (!head) {
+    // Fast path: resolve the name through the mmapped index without decoding the snapshot or the journal
+    TRACE_PHASE("index_open");
+    bool opened = view_open(&view) == 0;
+    if (!opened || view_count(&view) == 0) {
+        if (opened) view_close(&view);
+        stats_lookup(STATS_LOOKUP_MISS);
         fprintf(stderr, "You don't have any bookmarks yet.\n");
         fprintf(stderr, "Use bm add <name> <path> to add one.\n");
         return 1;
     }
 
-    if (target) {
-        printf("%s\n", target->bookmark.path);
+    TRACE_PHASE("lookup");
+    uint32_t id;
+    const char *path = view_find(&view, name, &id);
+    if (!path) {
+        // Not a bookmark name: fall back to the best fuzzy match, which needs every name
+        view_close(&view);
+        TRACE_PHASE("load");
+        BookmarkStore store;
+        int status = layers_load(&view.stack, &store) == 0 ? go_fuzzy(&store, name) : 1;
+        store_free(&store);
+        stats_lookup(status == 0 ? STATS_LOOKUP_FUZZY : STATS_LOOKUP_MISS);
+        return status;
+    }
+
+    // Straight from the mapping to stdout
+    stats_lookup(STATS_LOOKUP_HIT);
+    int status = write_line(STDOUT_FILENO, path);
+    view_close(&view);
+
+    // Counted in place in the mmapped sidecar: no lock, no rewrite of the snapshot.
+    // Bookmarks of project and system stores have id 0 and aren't counted.
+    TRACE_PHASE("usage");
+    if (id != 0) usage_record_visit(id);
+    return status;
+}
+
+int which_bookmark(char *path) {
+    TRACE_PHASE("resolve_path");
+    char resolved[MAX_PATH];
+    if (resolve_which_path(path, resolved) != 0) return 1;
+
+    // Fast path: one binary search over the path-sorted index per component, without parsing anything.
+    // A stale index is rebuilt for the next prompt; the loaded store is scanned if that fails.
+    TRACE_PHASE("index_open");
+    BookmarkView view;
+    if (layers_find(&view.stack) != 0 || view_open(&view) != 0) return 1;
+
+    TRACE_PHASE("lookup");
+    const char *name;
+    if (view.from_store) {
+        const Bookmark *bookmark = store_find_by_path(&view.store, resolved);
+        name = bookmark ? bookmark_name(&view.store, bookmark) : NULL;
     }
     else {
-        fprintf(stderr, "'%s' is not a valid bookmark.\n", name);
-        free_bookmarks(head);
+        name = index_find_by_path(&view.index, resolved);
+    }
+    int status = name ? write_line(STDOUT_FILENO, name) : 1;
+    view_close(&view);
+    return status;
+}
+
+int resolve_bookmarks(bool null_delimited) {
+    char delimiter = null_delimited ? '\0' : '\n';
+
+    TRACE_PHASE("index_open");
+    BookmarkView view;
+    if (layers_find(&view.stack) != 0 || view_open(&view) != 0) {
+        fprintf(stderr, "You haven't initialized the bookmark system yet.\nRun 'bm init' first to initialize the bookmark system!\n");
         return 1;
     }
 
-    free_bookmarks(head);
-    return 0;
+    TRACE_PHASE("resolve");
+    char input[RESOLVE_BUFFER + 1];     // One spare byte to terminate a last record without a delimiter
+    size_t start = 0, end = 0;
+    bool discarding = false, eof = false;
+    OutputBuffer out;
+    output_init(&out, STDOUT_FILENO);
+    int status = 0;
+    while (!eof) {
+        ssize_t bytes = read(STDIN_FILENO, input + end, RESOLVE_BUFFER - end);
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Failed to read stdin: %s\n", strerror(errno));
+            status = 1;
+            break;
+        }
+        if (bytes == 0) {
+            eof = true;
+            if (end > start || discarding) input[end++] = delimiter;
+        }
+        end += bytes;
+
+        // A long-running coprocess must see bookmarks added after it started
+        LayerStack current;
+        if (layers_find(&current) == 0 && !layers_equal(&current, &view.stack)) {
+            view_close(&view);
+            view.stack = current;
+            if (view_open(&view) != 0) {
+                status = 1;
+                break;
+            }
+        }
+
+        char *cursor = input + start, *limit = input + end, *next;
+        while ((next = memchr(cursor, delimiter, limit - cursor))) {
+            *next = '\0';
+            if (discarding) {
+                // The rest of a record longer than the buffer, which can't be a name
+                discarding = false;
+                output_write(&out, &delimiter, 1);
+                status = 1;
+            }
+            else if (resolve_name(&out, &view, cursor, delimiter) != 0) {
+                status = 1;
+            }
+            cursor = next + 1;
+        }
+
+        start = cursor - input;
+        if (start == end) {
+            start = end = 0;
+        }
+        else if (end == RESOLVE_BUFFER) {
+            if (start == 0) discarding = true;
+            else memmove(input, input + start, end - start);
+            end = discarding ? 0 : end - start;
+            start = 0;
+        }
+
+        // Flushing before every read answers an interactive caller as soon as its record is complete,
+        // while piped input still arrives in large chunks and is answered with one write per chunk
+        if (output_flush(&out) != 0) {
+            status = 1;
+            break;
+        }
+    }
+
+    view_close(&view);
+    return status;
 }
 
-// Helper functions
+int batch_bookmarks(char *file_path) {
+    if (!is_initialized()) {
+        printf("Error applying batch!\n");
+        printf("You haven't initialized the bookmark system yet.\n");
+        printf("Run 'bm init' first to initialize the bookmark system!\n");
+        return 1;
+    }
 
-/*
- * Frees all bookmarks in the linked list.
- */
-static void free_bookmarks(BookmarkNode *head) {
-    BookmarkNode *temp = head;
+    FILE *input = stdin;
+    if (file_path && strcmp(file_path, "-") != 0) {
+        input = fopen(file_path, "r");
+        if (!input) {
+            fprintf(stderr, "Failed to open %s: %s\n", file_path, strerror(errno));
+            return 1;
+        }
+    }
 
-    while (temp) {
-        BookmarkNode *next = temp->next;
-        free(temp);
-        temp = next;
+    // First pass: split every line and collect the paths of add and edit lines
+    BatchLine *lines = NULL;
+    size_t line_count = 0, line_capacity = 0, check_count = 0;
+    char *buffer = NULL;
+    size_t buffer_capacity = 0, line_number = 0;
+    int status = 0;
+    while (getline(&buffer, &buffer_capacity, input) != -1) {
+        line_number++;
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+
+        char *start = buffer;
+        while (isspace((unsigned char) *start)) start++;
+        if (*start == '\0' || *start == '#') continue;     // Blank lines and comments
+
+        if (line_count == line_capacity) {
+            size_t capacity = line_capacity ? line_capacity * 2 : 64;
+            BatchLine *grown = realloc(lines, capacity * sizeof(BatchLine));
+            if (!grown) {
+                fprintf(stderr, "Failed to allocate memory for the batch: %s\n", strerror(errno));
+                status = 1;
+                break;
+            }
+            lines = grown;
+            line_capacity = capacity;
+        }
+
+        BatchLine *line = &lines[line_count];
+        line->line_number = line_number;
+        line->text = strdup(start);
+        line->path = NULL;
+        if (!line->text) {
+            fprintf(stderr, "Failed to allocate memory for the batch: %s\n", strerror(errno));
+            status = 1;
+            break;
+        }
+        line_count++;
+
+        parse_batch_line(line);
+        if (line->op && (strcmp(line->op, "add") == 0 || strcmp(line->op, "edit") == 0) &&
+            line->name && line->rest[0] != '\0' && strlen(line->rest) < MAX_PATH) {
+            char *tilde_expanded = resolve_tilde(line->rest);
+            line->path = tilde_expanded == line->rest ? strdup(line->rest) : tilde_expanded;
+            if (line->path) check_count++;
+        }
+    }
+    free(buffer);
+    if (input != stdin) fclose(input);
+
+    PathCheck *checks = NULL;
+    if (status == 0 && check_count > 0) {
+        checks = malloc(check_count * sizeof(PathCheck));
+        if (!checks) {
+            fprintf(stderr, "Failed to allocate memory for the batch: %s\n", strerror(errno));
+            status = 1;
+        }
+    }
+
+    // Validate every path at once, before taking the lock, so slow mounts don't hold up other writers
+    if (checks) {
+        size_t next = 0;
+        for (size_t i = 0; i < line_count; i++) {
+            if (lines[i].path) checks[next++].path = lines[i].path;
+        }
+        if (validate_paths(checks, check_count, VALIDATE_TIMEOUT_MS) != 0) status = 1;
+    }
+
+    // Second pass: one load and one lock for the whole batch, instead of one per operation
+    BookmarkStore store;
+    size_t applied = 0, failed = 0;
+    if (status == 0) {
+        if (store_load_for_update(&store, NULL) != 0) {
+            store_free(&store);
+            status = 1;
+        }
+    }
+    if (status == 0) {
+        size_t next = 0;
+        for (size_t i = 0; i < line_count; i++) {
+            const PathCheck *check = lines[i].path ? &checks[next++] : NULL;
+            if (apply_batch_line(&store, &lines[i], check) == 0) applied++;
+            else failed++;
+        }
+
+        store_purge_removed(&store);
+
+        // All changes land together: a single snapshot replaces bookmarks.snap with rename()
+        snprintf(store.change, sizeof(store.change), "batch");
+        if (applied > 0 && store_save(&store) != 0) {
+            printf("Error: Failed to save the batch. No changes were applied.\n");
+            status = 1;
+        }
+        store_free(&store);
+    }
+
+    for (size_t i = 0, next = 0; i < line_count; i++) {
+        if (lines[i].path) free(checks ? checks[next++].resolved : NULL);
+        free(lines[i].path);
+        free(lines[i].text);
     }
+    free(checks);
+    free(lines);
+    if (status != 0) return 1;
+
+    printf("Batch complete: %zu change%s applied, %zu error%s.\n", applied, applied == 1 ? "" : "s", failed, failed == 1 ? "" : "s");
+    return failed > 0 ? 1 : 0;
 }
 
-/*
- * Load bookmarks from bookmarks.tsv file into  linked list.
- * Returns head of list, or NULL if file doesn't exist or if file is empty.
- * Caller must free the returned list using free_bookmarks.
- */
-static BookmarkNode *load_bookmarks(void) {
-    BookmarkNode *head = NULL;
-    char *file_path = get_bookmark_file_path();
+int doctor_bookmarks(bool prune, bool relink, int timeout_ms) {
+    if (!is_initialized()) {
+        printf("You haven't initialized the bookmark system yet.\n");
+        printf("Run 'bm init' first to initialize the bookmark system!\n");
+        return 1;
+    }
 
-    FILE *file = fopen(file_path, "r");
-    if (!file) {
-        fprintf(stderr, "Failed to open %s: %s\n", file_path, strerror(errno));
-        return NULL;
+    // Checking can take seconds on slow mounts, so it runs on a lock-free snapshot
+    BookmarkStore store;
+    if (store_load(&store, NULL) != 0) {
+        store_free(&store);
+        return 1;
+    }
+    if (store.count == 0) {
+        store_free(&store);
+        printf("You don't have any bookmarks yet.\n");
+        return 0;
     }
-    char line [MAX_LINE];
 
-    fgets(line, MAX_LINE, file); // Skip headers
+    PathCheck *checks = malloc(store.count * sizeof(PathCheck));
+    if (!checks) {
+        fprintf(stderr, "Failed to allocate memory for checks: %s\n", strerror(errno));
+        store_free(&store);
+        return 1;
+    }
+    for (size_t i = 0; i < store.count; i++) {
+        checks[i].path = bookmark_path(&store, &store.records[i]);
+    }
 
-    while (fgets(line, MAX_LINE, file)) {
-        char *name = strtok(line,"\t");
-        char *path = strtok(NULL, "\n");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (validate_paths(checks, store.count, timeout_ms) != 0) {
+        free(checks);
+        store_free(&store);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000L + (end.tv_nsec - start.tv_nsec) / 1000000L;
 
-        if (name && path){
-            BookmarkNode *bookmark_node = malloc(sizeof(BookmarkNode));
-            if (!bookmark_node) {
-                printf("Failed to load bookmarks due to insufficient memory.\n");
-                free_bookmarks(head);
-                free(file_path);
-                return NULL;
-            }
+    size_t totals[PATH_UNREACHABLE + 1] = {0};
+    for (size_t i = 0; i < store.count; i++) {
+        const PathCheck *check = &checks[i];
+        const char *name = bookmark_name(&store, &store.records[i]);
+        totals[check->status]++;
+
+        if (check->status == PATH_MOVED) {
+            printf("%-15s  %-15s  %s --> %s\n", path_status_name(check->status), name, check->path, check->resolved);
+        }
+        else if (check->status == PATH_UNREACHABLE) {
+            printf("%-15s  %-15s  %s (%s)\n", path_status_name(check->status), name, check->path, strerror(check->error));
+        }
+        else if (check->status != PATH_OK) {
+            printf("%-15s  %-15s  %s\n", path_status_name(check->status), name, check->path);
+        }
+    }
+    printf("Checked %zu bookmark%s in %ld ms: %zu ok, %zu moved, %zu missing, %zu not a directory, %zu unreachable.\n",
+           store.count, store.count == 1 ? "" : "s", elapsed_ms, totals[PATH_OK], totals[PATH_MOVED],
+           totals[PATH_MISSING], totals[PATH_NOT_DIRECTORY], totals[PATH_UNREACHABLE]);
+
+    size_t fixable = (prune ? totals[PATH_MISSING] + totals[PATH_NOT_DIRECTORY] : 0) + (relink ? totals[PATH_MOVED] : 0);
+    size_t remaining = store.count - totals[PATH_OK] - fixable;
+    int status = 0;
+
+    if (fixable > 0) {
+        // Unreachable bookmarks are never pruned: the mount may just be down
+        BookmarkStore fresh;
+        size_t pruned = 0, relinked = 0;
+        if (store_load_for_update(&fresh, NULL) != 0) {
+            status = 1;
+        }
+        else {
+            for (size_t i = 0; i < store.count; i++) {
+                const PathCheck *check = &checks[i];
+                bool prunable = prune && (check->status == PATH_MISSING || check->status == PATH_NOT_DIRECTORY);
+                bool relinkable = relink && check->status == PATH_MOVED;
+                if (!prunable && !relinkable) continue;
+
+                // Leave bookmarks alone that another command changed while they were being checked
+                Bookmark *target = store_find(&fresh, bookmark_name(&store, &store.records[i]));
+                if (!target || strcmp(bookmark_path(&fresh, target), check->path) != 0) {
+                    remaining++;
+                    continue;
+                }
 
-            trim_trailing_space(name);
+                if (prunable && store_record(&fresh, JOURNAL_DEL, bookmark_name(&fresh, target), NULL) == 0) {
+                    store_mark_removed(&fresh, target);
+                    pruned++;
+                }
+                else if (relinkable && store_set_path(&fresh, target, check->resolved) == 0 &&
+                         store_record(&fresh, JOURNAL_EDIT, bookmark_name(&fresh, target), check->resolved) == 0) {
+                    relinked++;
+                }
+                else {
+                    remaining++;
+                }
+            }
+            store_purge_removed(&fresh);
 
-            strcpy(bookmark_node->bookmark.name, name);
-            strcpy(bookmark_node->bookmark.path, path);
-            bookmark_node->next = NULL;
-            if (!head) {
-                head = bookmark_node;
+            snprintf(fresh.change, sizeof(fresh.change), "doctor");
+            if (pruned + relinked > 0 && store_save(&fresh) != 0) {
+                printf("Error: Failed to save the changes. No bookmarks were pruned or relinked.\n");
+                status = 1;
             }
             else {
-                BookmarkNode *temp = head;
-                while (temp->next) {
-                    temp = temp->next;
-                }
-                temp->next = bookmark_node;
+                printf("Pruned %zu bookmark%s, relinked %zu.\n", pruned, pruned == 1 ? "" : "s", relinked);
             }
         }
+        store_free(&fresh);
     }
 
-    if (fclose(file) == -1) {
-        fprintf(stderr, "Failed to close %s: %s\n", file_path, strerror(errno));
+    for (size_t i = 0; i < store.count; i++) {
+        free(checks[i].resolved);
     }
-    
-    free(file_path);
-    
-    return head;
+    free(checks);
+    store_free(&store);
+    return status != 0 || remaining > 0 ? 1 : 0;
 }
 
-/*
- * Overwrites bookmarks.tsv with the modified bookmarks from the linked list.
- * Returns 0 on success, 1 on error.
- */
-static int save_bookmarks(BookmarkNode *head) {
-    char *path = get_bookmark_file_path();
-    FILE *file = fopen(path, "w");
-    if (!file) {
-        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
-        free(path);
-        return 1;
+int complete_bookmarks(char *prefix) {
+    BookmarkView view;
+    if (layers_find(&view.stack) != 0) return 1;
+
+    // Fast path: a binary search over the sorted names in the mmapped index, without parsing anything
+    if (view_open_index(&view) != 0) {
+        // The daemon only serves the user store
+        char *response;
+        size_t size;
+        if (view.stack.count == 1 && daemon_request(DAEMON_COMPLETE, prefix, &response, &size) == 0) {
+            if (strncmp(response, "OK\n", 3) == 0) fputs(response + 3, stdout);
+            free(response);
+            return 0;
+        }
+
+        // Rebuild the stale index for the next completion; scan the store if that fails
+        if (view_open(&view) != 0) return 1;
     }
 
-    fprintf(file, "Bookmark Name\tDirectory Path\n");
+    if (view.from_store) {
+        size_t len = strlen(prefix);
+        for (size_t i = 0; i < view.store.count; i++) {
+            const char *name = bookmark_name(&view.store, &view.store.records[i]);
+            if (strncasecmp(name, prefix, len) == 0) printf("%s\n", name);
+        }
+    }
+    else {
+        print_completions(&view.index, prefix);
+    }
+    view_close(&view);
+    return 0;
+}
+
+int print_completion(char *shell) {
+    return print_completion_script(shell);
+}
+
+int start_daemon(bool watch) {
+    return run_daemon(watch);
+}
+
+int import_bookmarks(char *format_name, char *file_path) {
+    InteropFormat format;
+    if (interop_parse_format(format_name, &format) != 0) {
+        printf("Unknown format '%s'. Try tsv, autojump, z, fasd, zoxide or cdpath.\n", format_name);
+        return 1;
+    }
+    if (!is_initialized()) {
+        printf("Error importing bookmarks!\n");
+        printf("You haven't initialized the bookmark system yet.\n");
+        printf("Run 'bm init' first to initialize the bookmark system!\n");
+        return 1;
+    }
 
-    BookmarkNode *temp = head;
-    while (temp) {
-        fprintf(file, "%-15s\t%s\n", temp->bookmark.name, temp->bookmark.path);
-        temp = temp->next;
+    int fd = STDIN_FILENO;
+    if (file_path && strcmp(file_path, "-") != 0) {
+        fd = open(file_path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "Failed to open %s: %s\n", file_path, strerror(errno));
+            return 1;
+        }
     }
 
-    if (fclose(file) == -1) {
-        fprintf(stderr, "Failed to close %s: %s\n", path, strerror(errno));
+    int status = interop_import(format, fd);
+    if (fd != STDIN_FILENO) close(fd);
+    return status;
+}
+
+int export_bookmarks(char *format_name) {
+    InteropFormat format;
+    if (interop_parse_format(format_name, &format) != 0) {
+        printf("Unknown format '%s'. Try tsv, autojump, z, fasd, zoxide or cdpath.\n", format_name);
+        return 1;
+    }
+    if (!is_initialized()) {
+        printf("You haven't initialized the bookmark system yet.\n");
+        printf("Run 'bm init' first to initialize the bookmark system!\n");
+        return 1;
     }
 
-    free(path);
+    return interop_export(format, STDOUT_FILENO);
+}
+
+int list_history(void) {
+    BookmarkStore store;
+    History history;
+    if (load_history(&store, &history) != 0) return 1;
+    store_free(&store);
+
+    // Newest first, one line per generation
+    size_t end = history.count;
+    while (end > 0) {
+        size_t first = end - 1;
+        while (first > 0 && history.records[first - 1].generation == history.records[end - 1].generation) first--;
+        print_generation(&history.records[first], end - first, history.records[first].generation == history.current);
+        end = first;
+    }
+    printf("%c %6llu  %-16s  oldest generation kept\n", history.current == history.base ? '*' : ' ',
+           (unsigned long long) history.base, "");
 
+    history_free(&history);
     return 0;
 }
 
+int undo_bookmarks(void) {
+    BookmarkStore store;
+    History history;
+    if (load_history(&store, &history) != 0) return 1;
+
+    uint64_t generation;
+    int status = 0;
+    if (!history_undo_target(&history, &generation)) {
+        printf("There is nothing to undo: the history doesn't go back any further.\n");
+        status = 1;
+    }
+    else {
+        status = restore_generation(&store, &history, generation, "undo");
+    }
+
+    history_free(&history);
+    store_free(&store);
+    return status;
+}
+
+int restore_bookmarks(char *generation_text) {
+    char *end;
+    errno = 0;
+    unsigned long long generation = strtoull(generation_text, &end, 10);
+    if (errno != 0 || end == generation_text || *end != '\0') {
+        printf("'%s' is not a generation. Run 'bm history' to list them.\n", generation_text);
+        return 1;
+    }
+
+    BookmarkStore store;
+    History history;
+    if (load_history(&store, &history) != 0) return 1;
+
+    int status = 0;
+    if (generation < history.base || generation > history.current) {
+        printf("There is no generation %llu: the history goes from %llu to %llu.\n", generation,
+               (unsigned long long) history.base, (unsigned long long) history.current);
+        status = 1;
+    }
+    else if (generation == history.current) {
+        printf("The bookmarks are already at generation %llu.\n", generation);
+    }
+    else {
+        status = restore_generation(&store, &history, generation, "restore");
+    }
+
+    history_free(&history);
+    store_free(&store);
+    return status;
+}
+
+int print_stats(bool json) {
+    if (!is_initialized()) {
+        printf("You haven't initialized the bookmark system yet.\n");
+        printf("Run 'bm init' first to initialize the bookmark system!\n");
+        return 1;
+    }
+
+    return stats_report(json);
+}
+
+// Helper functions
+
 /*
- * Removes trailing whitespace from bookmark names.
- * Needed because TSV file uses fixed-width padding for alignment.
+ * Takes the writer lock, so no compaction moves records while the history is read, and loads
+ * the store and its history.
+ * Returns 0 on success, 1 if not initialized or on error, in which case there is nothing to release.
  */
-static void trim_trailing_space(char *name) {
-    for (int i = 0, len = strlen(name); i < len; i++) {
-        if (isspace(name[i])) {
-            name[i] = '\0';
-            break;
-        }
+static int load_history(BookmarkStore *store, History *history) {
+    memset(history, 0, sizeof(*history));
+    if (!is_initialized()) {
+        printf("You haven't initialized the bookmark system yet.\n");
+        printf("Run 'bm init' first to initialize the bookmark system!\n");
+        return 1;
     }
+
+    if (store_load_for_update(store, NULL) != 0 || history_load(history, store) != 0) {
+        history_free(history);
+        store_free(store);
+        return 1;
+    }
+    return 0;
 }
 
-static BookmarkNode *find_bookmark(BookmarkNode *head, char *name) {
-    if (!head) return head;
+/*
+ * Turns the store into the bookmarks of an earlier generation, as a new generation whose
+ * change is named after verb ("undo" or "restore") and the generation.
+ * Returns 0 on success, 1 on error.
+ */
+static int restore_generation(BookmarkStore *store, const History *history, uint64_t generation, const char *verb) {
+    char change[sizeof(store->change)];
+    snprintf(change, sizeof(change), "%s %llu", verb, (unsigned long long) generation);
 
-    BookmarkNode *temp = head;
-    while (temp && strcasecmp(temp->bookmark.name, name) != 0) {
-        temp = temp->next;
+    if (history_restore(store, history, generation, change) != 0 || store_save(store) != 0) {
+        printf("Error: Failed to restore generation %llu. No changes were applied.\n", (unsigned long long) generation);
+        return 1;
     }
-
-    return temp;
+    printf("Restored the bookmarks of generation %llu as generation %llu.\n", (unsigned long long) generation,
+           (unsigned long long) history->current + 1);
+    return 0;
 }
 
 /*
- * Checks if the bookmark exists.
- * Returns true if it exists, false otherwise.
+ * Prints one line of 'bm history': the generation, when it was made and what it changed.
+ * records are the records of the generation, count of them.
  */
-static bool bookmark_exists(BookmarkNode *head, char *name) {
-    return find_bookmark(head, name) != NULL;
+static void print_generation(const HistoryRecord *records, size_t count, bool current) {
+    char when[32] = "";
+    time_t made = records->time;
+    struct tm local;
+    if (made > 0 && localtime_r(&made, &local)) strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &local);
+    printf("%c %6llu  %-16s  ", current ? '*' : ' ', (unsigned long long) records->generation, when);
+
+    const char *name = records->fields[2];
+    const char *argument = records->field_count == 4 ? records->fields[3] : "";
+    switch (records->op) {
+        case JOURNAL_ADD:
+            printf("add %s --> %s\n", name, argument);
+            break;
+        case JOURNAL_DEL:
+            printf("delete %s\n", name);
+            break;
+        case JOURNAL_REN:
+            printf("rename %s --> %s\n", name, argument);
+            break;
+        case JOURNAL_EDIT:
+            printf("edit %s --> %s\n", name, argument);
+            break;
+        case JOURNAL_TAGS:
+            printf("tag %s: %s\n", name, argument[0] ? argument : "(none)");
+            break;
+        case JOURNAL_UNDEL:
+            printf("undelete %s --> %s\n", name, strchr(argument, '\t') ? strchr(argument, '\t') + 1 : "");
+            break;
+        case JOURNAL_MARK:
+            printf("%s (%zu change%s)\n", argument, count - 1, count == 2 ? "" : "s");
+            break;
+        default:
+            printf("%s\n", records->fields[1]);
+            break;
+    }
 }
 
 /*
@@ -532,18 +1198,15 @@ static bool bookmark_exists(BookmarkNode *head, char *name) {
  * Returns true if it is initialized, false otherwise.
  */
 static bool is_initialized(void) {
+    TRACE_PHASE("init_check");
+    StoreVersion version;
+    if (store_version(&version) == 0) return true;
+
+    int error = errno;
     char *path = get_bookmark_file_path();
-    FILE *file = fopen(path, "r");
-    if (!file) {
-        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
-        free(path);
-        return false;
-    }
-    if (fclose(file) == -1) {
-        fprintf(stderr, "Failed to close %s: %s\n", path, strerror(errno));
-    }
+    if (path) fprintf(stderr, "Failed to open %s: %s\n", path, strerror(error));
     free(path);
-    return true;
+    return false;
 }
 
 /*
@@ -577,43 +1240,536 @@ static char *resolve_tilde(char *path) {
 }
 
 /*
- * Returns the path to bookmarks.tsv.
- * If the HOME environment variable is not set, NULL is returned.
+ * Loads the store for a read-only command, from a running daemon if there is one.
+ * Returns 0 on success, 1 on error.
+ * Caller must release the store using store_free, even on error.
  */
-static char *get_bookmark_file_path(void) {
-    const char *home = getenv("HOME");
-    if (!home) {
-        printf("HOME environment variable is not set.\n");
-        return NULL;
+static int load_for_reading(BookmarkStore *store) {
+    TRACE_PHASE("load");
+    char *response;
+    size_t size;
+    if (daemon_request(DAEMON_LIST, NULL, &response, &size) == 0) {
+        if (strncmp(response, "OK\n", 3) == 0) {
+            // The payload after the status line is in the bookmarks.tsv format
+            memmove(response, response + 3, size - 2);
+            return store_load_buffer(store, response, size - 3);
+        }
+        free(response);
     }
+    return store_load(store, NULL);
+}
 
-    char *file_path = malloc(strlen(home) + strlen(BOOKMARK_DIRECTORY) + strlen(BOOKMARK_FILE) + 1); //home + "/.bm/bookmarks.tsv" + null terminator
-    if (!file_path) {
-            fprintf(stderr, "Failed to allocate memory for file_path: %s\n", strerror(errno));
-            return NULL;
+/*
+ * Prints the names in the index that start with prefix, in case-folded sorted order.
+ */
+static void print_completions(const BookmarkIndex *index, const char *prefix) {
+    size_t first;
+    size_t count = index_prefix_range(index, prefix, &first);
+    for (size_t i = 0; i < count; i++) {
+        puts(index_sorted_name(index, first + i));
+    }
+}
+
+/*
+ * Checks a bookmark against a list filter: a glob (if the filter has *, ? or [)
+ * or a substring, matched case-insensitively against the name and the path.
+ * Returns true if there is no filter or it matches.
+ */
+static bool matches_filter(const char *filter, const char *name, const char *path) {
+    if (!filter) return true;
+    if (strpbrk(filter, "*?[")) {
+        return fnmatch(filter, name, FNM_CASEFOLD) == 0 || fnmatch(filter, path, FNM_CASEFOLD) == 0;
     }
+    return strcasestr(name, filter) || strcasestr(path, filter);
+}
 
-    sprintf(file_path, "%s%s%s", home, BOOKMARK_DIRECTORY, BOOKMARK_FILE);
-    return file_path;
+/*
+ * Checks if the record at position is listed: selected by the tag conditions (if any), then matching the filter.
+ */
+static bool list_includes(const ListOptions *options, const BookmarkStore *store, size_t position, const uint64_t *selected) {
+    if (selected && !bitmap_test(selected, position)) return false;
+    const Bookmark *bookmark = &store->records[position];
+    return matches_filter(options->filter, bookmark_name(store, bookmark), bookmark_path(store, bookmark));
 }
 
 /*
- * Returns the path to /.bm/ unless the HOME environment variable is not set
- * If it is not set, then NULL is returned
+ * Evaluates the list's tag conditions over the store, which was loaded from the layers in stack.
+ * The bitmaps come from the index when it was built from exactly these files, so its bit
+ * positions are the store's; otherwise they are built from the store's tag lists.
+ * Returns a malloc'd bitmap over the store's records, or NULL on error.
  */
-static char *get_bookmark_dir_path(void) {
+static uint64_t *select_tagged(const LayerStack *stack, const BookmarkStore *store, const ListOptions *options) {
+    // A layer that changed while the store was loaded may not match the index
+    BookmarkView view;
+    if (layers_find(&view.stack) == 0 && layers_equal(&view.stack, stack) && view_open_loaded(&view, store) == 0) {
+        uint64_t *selected = NULL;
+        if (view.index.header->entry_count == store->count) {
+            selected = tags_select(options->all_tags, options->any_tags, options->no_tags, index_tag_lookup, &view.index, store->count);
+        }
+        view_close(&view);
+        if (selected) return selected;
+    }
+
+    TagTable table;
+    uint64_t *selected = NULL;
+    if (tag_table_build(&table, store) == 0) {
+        selected = tags_select(options->all_tags, options->any_tags, options->no_tags, tag_table_lookup, &table, store->count);
+    }
+    tag_table_free(&table);
+    return selected;
+}
+
+/*
+ * Adds tags to a bookmark, or removes them, with a single journal record.
+ * Without tags to add, prints the bookmark's tags instead.
+ * Returns 0 on success, 1 on error.
+ */
+static int change_tags(char *name, char **tags, int tag_count, bool remove) {
+    if (!is_initialized()) {
+        printf("Error changing bookmark tags in file!\n");
+        printf("You haven't initialized the bookmark system yet.\n");
+        printf("Run 'bm init' first to initialize the bookmark system!\n");
+        return 1;
+    }
+
+    for (int i = 0; i < tag_count; i++) {
+        if (!tag_normalize(tags[i])) {
+            printf("'%s' is not a valid tag.\n", tags[i]);
+            printf("Tags are 1-%d letters, digits, '.', '_' or '-' (e.g., team-a, env.prod).\n", MAX_TAG - 1);
+            return 1;
+        }
+    }
+
+    TRACE_PHASE("load");
+    BookmarkStore store;
+    if (store_load_for_update(&store, NULL) != 0 || store.count == 0) {
+        store_free(&store);
+        printf("You don't have any bookmarks yet.\n");
+        printf("Use bm add <name> <path> to add one.\n");
+        return 1;
+    }
+
+    TRACE_PHASE("lookup");
+    Bookmark *target = store_find(&store, name);
+    if (!target) {
+        printf("Error: There isn't a bookmark named '%s'.\n", name);
+        store_free(&store);
+        return 1;
+    }
+
+    if (tag_count == 0) {
+        for (const char *tag = bookmark_tags(&store, target); *tag;) {
+            size_t len = strcspn(tag, ",");
+            printf("%.*s\n", (int) len, tag);
+            tag += len + (tag[len] == ',');
+        }
+        store_free(&store);
+        return 0;
+    }
+
+    char current[MAX_TAG_LIST], updated[MAX_TAG_LIST];
+    snprintf(current, sizeof(current), "%s", bookmark_tags(&store, target));
+    for (int i = 0; i < tag_count; i++) {
+        if (remove) {
+            tags_remove(updated, current, tags[i]);
+        }
+        else if (tags_insert(updated, current, tags[i]) != 0) {
+            printf("Error: A bookmark can't have more than %d tags.\n", MAX_TAGS);
+            store_free(&store);
+            return 1;
+        }
+        strcpy(current, updated);
+    }
+
+    if (strcmp(current, bookmark_tags(&store, target)) != 0) {
+        TRACE_PHASE("commit");
+        if (store_set_tags(&store, target, current) != 0 || store_commit(&store, JOURNAL_TAGS, name, current) != 0) {
+            store_free(&store);
+            return 1;
+        }
+    }
+    printf("'%s' tags: %s\n", name, current[0] ? current : "(none)");
+    store_free(&store);
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    const RankedBookmark *left = a, *right = b;
+    int result = strcasecmp(bookmark_name(sorting_store, &sorting_store->records[left->index]),
+                            bookmark_name(sorting_store, &sorting_store->records[right->index]));
+    if (result != 0) return result;
+    return left->index < right->index ? -1 : left->index > right->index;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    const RankedBookmark *left = a, *right = b;
+    int result = strcmp(bookmark_path(sorting_store, &sorting_store->records[left->index]),
+                        bookmark_path(sorting_store, &sorting_store->records[right->index]));
+    if (result != 0) return result;
+    return left->index < right->index ? -1 : left->index > right->index;
+}
+
+/*
+ * Orders bookmarks by descending frecency, keeping file order between equals.
+ */
+static int compare_frecency(const void *a, const void *b) {
+    const RankedBookmark *left = a, *right = b;
+    if (left->frecency != right->frecency) return left->frecency < right->frecency ? 1 : -1;
+    return left->index < right->index ? -1 : left->index > right->index;
+}
+
+/*
+ * Prints a horizontal border of the 'bm list' table.
+ */
+static void print_border(OutputBuffer *out, int longest_path, bool show_usage) {
+    output_string(out, "+-----------------+");
+    output_repeat(out, '-', longest_path + 2);
+    output_string(out, show_usage ? "+--------+-----------+\n" : "+\n");
+}
+
+/*
+ * Formats the time since the last visit, e.g. "5m ago", or "never". Ages past 9999 days (a
+ * corrupt or far-off time) print as "9999d ago", so the text fits the 9-character column.
+ */
+static void format_age(char *buffer, size_t size, int64_t last_visit, time_t now) {
+    int64_t age = now - last_visit;
+    if (last_visit == 0) snprintf(buffer, size, "never");
+    else if (age < 60) snprintf(buffer, size, "just now");
+    else if (age < 3600) snprintf(buffer, size, "%dm ago", (int) (age / 60));
+    else if (age < 86400) snprintf(buffer, size, "%dh ago", (int) (age / 3600));
+    else snprintf(buffer, size, "%dd ago", age / 86400 < 9999 ? (int) (age / 86400) : 9999);
+}
+
+/*
+ * Resolves a query that isn't a bookmark name to its best fuzzy match and prints the path.
+ * The matched name goes to stderr, so the shell wrapper only sees the path.
+ * Returns 0 on success, 1 if nothing matches.
+ */
+static int go_fuzzy(const BookmarkStore *store, const char *query) {
+    TRACE_PHASE("fuzzy");
+    // Equally good matches go to the most frecent bookmark
+    UsageMap usage;
+    double *frecency = usage_open(&usage) == 0 ? usage_frecency_table(&usage, store, time(NULL)) : NULL;
+    usage_close(&usage);
+
+    FuzzyTable table;
+    long best = -1;
+    if (fuzzy_build(&table, store) == 0) best = fuzzy_best(&table, query, frecency);
+    fuzzy_free(&table);
+    free(frecency);
+
+    if (best < 0) {
+        fprintf(stderr, "'%s' is not a valid bookmark.\n", query);
+        return 1;
+    }
+
+    const Bookmark *bookmark = &store->records[best];
+    fprintf(stderr, "'%s' matched '%s'\n", query, bookmark_name(store, bookmark));
+    printf("%s\n", bookmark_path(store, bookmark));
+    if (bookmark->id != 0) usage_record_visit(bookmark->id);
+    return 0;
+}
+
+/*
+ * Turns the argument of 'bm which' into an absolute path without trailing slashes:
+ * the current directory if path is NULL, else path with ~ expanded and symlinks resolved
+ * like bookmarked paths are. A path that no longer exists is used as written, if absolute.
+ * resolved must hold MAX_PATH bytes.
+ * Returns 0 on success, 1 on error.
+ */
+static int resolve_which_path(const char *path, char *resolved) {
+    if (!path) {
+        if (!getcwd(resolved, MAX_PATH)) {
+            fprintf(stderr, "Failed to get the current directory: %s\n", strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    char expanded[MAX_PATH];
     const char *home = getenv("HOME");
-    if (!home) {
-        printf("HOME environment variable is not set.\n");
-        return NULL;
+    if (path[0] == '~' && (path[1] == '/' || path[1] == '\0') && home) {
+        if (snprintf(expanded, sizeof(expanded), "%s%s", home, path + 1) >= (int) sizeof(expanded)) {
+            fprintf(stderr, "The path is too long.\n");
+            return 1;
+        }
+        path = expanded;
     }
 
-    char *dir_path = malloc(strlen(home) + strlen(BOOKMARK_DIRECTORY) + 1); //home + "/.bm/" + null terminator
-    if (!dir_path) {
-        fprintf(stderr, "Failed to allocate memory for dir_path: %s\n", strerror(errno));
+    if (!realpath(path, resolved)) {
+        if (path[0] != '/' || strlen(path) >= MAX_PATH) {
+            fprintf(stderr, "Failed to resolve %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+        strcpy(resolved, path);
+    }
+
+    size_t len = strlen(resolved);
+    while (len > 1 && resolved[len - 1] == '/') resolved[--len] = '\0';
+    return 0;
+}
+
+/*
+ * Appends the path of a bookmark followed by the delimiter, or an empty record if there is no
+ * bookmark with that name. Unlike 'bm go', names aren't matched fuzzily and visits aren't counted.
+ * Returns 0 if the name was found, 1 otherwise.
+ */
+static int resolve_name(OutputBuffer *out, const BookmarkView *view, const char *name, char delimiter) {
+    const char *path = view_find(view, name, NULL);
+    if (path) output_string(out, path);
+    else fprintf(stderr, "'%s' is not a valid bookmark.\n", name);
+    output_write(out, &delimiter, 1);
+    return path ? 0 : 1;
+}
+
+/*
+ * Splits a batch line in place into its operation, name and the rest of the line.
+ * The rest is the path or the new name, trimmed, and empty if missing.
+ */
+static void parse_batch_line(BatchLine *line) {
+    char *cursor = line->text;
+    line->op = next_token(&cursor);
+    line->name = next_token(&cursor);
+
+    char *rest = cursor;
+    while (isspace((unsigned char) *rest)) rest++;
+    size_t rest_len = strlen(rest);
+    while (rest_len > 0 && isspace((unsigned char) rest[rest_len - 1])) rest[--rest_len] = '\0';
+    line->rest = rest;
+}
+
+/*
+ * Applies one batch line ("add <name> <path>", "delete <name>", "rename <old_name> <new_name>"
+ * or "edit <name> <new_path>") to the store. Paths may contain spaces.
+ * check is the result of validating the path of an add or edit line, NULL otherwise.
+ * Errors are reported on stderr with the line number.
+ * Returns 0 on success, 1 on error.
+ */
+static int apply_batch_line(BookmarkStore *store, const BatchLine *line, const PathCheck *check) {
+    const char *op = line->op;
+    const char *name = line->name;
+    const char *rest = line->rest;
+    size_t line_number = line->line_number;
+    size_t rest_len = strlen(rest);
+
+    if (strcmp(op, "add") != 0 && strcmp(op, "delete") != 0 && strcmp(op, "rename") != 0 && strcmp(op, "edit") != 0) {
+        fprintf(stderr, "line %zu: unknown operation '%s'\n", line_number, op);
+        return 1;
+    }
+
+    bool is_delete = strcmp(op, "delete") == 0;
+    if (!name || (is_delete && rest_len > 0) || (!is_delete && rest_len == 0)) {
+        fprintf(stderr, "line %zu: expected 'add <name> <path>', 'delete <name>', 'rename <old_name> <new_name>' or 'edit <name> <new_path>'\n", line_number);
+        return 1;
+    }
+
+    if (strcmp(op, "add") == 0 || strcmp(op, "edit") == 0) {
+        bool is_add = op[0] == 'a';
+        Bookmark *existing = store_find(store, name);
+        if (is_add && existing) {
+            fprintf(stderr, "line %zu: a bookmark named '%s' already exists --> %s\n", line_number, name, bookmark_path(store, existing));
+            return 1;
+        }
+        if (!is_add && !existing) {
+            fprintf(stderr, "line %zu: there isn't a bookmark named '%s' to edit\n", line_number, name);
+            return 1;
+        }
+        if (is_add && strlen(name) >= MAX_NAME) {
+            fprintf(stderr, "line %zu: the bookmark name '%s' is too long\n", line_number, name);
+            return 1;
+        }
+        if (rest_len >= MAX_PATH) {
+            fprintf(stderr, "line %zu: the directory path is too long\n", line_number);
+            return 1;
+        }
+        if (!check) {
+            fprintf(stderr, "line %zu: could not resolve '%s'\n", line_number, rest);
+            return 1;
+        }
+        if (check->status != PATH_OK && check->status != PATH_MOVED) {
+            fprintf(stderr, "line %zu: '%s' is not a valid path: %s\n", line_number, rest, strerror(check->error));
+            return 1;
+        }
+
+        int status = is_add ? store_add(store, name, check->resolved) : store_set_path(store, existing, check->resolved);
+        return status != 0 ? status : store_record(store, is_add ? JOURNAL_ADD : JOURNAL_EDIT, name, check->resolved);
+    }
+
+    if (is_delete) {
+        Bookmark *target = store_find(store, name);
+        if (!target) {
+            fprintf(stderr, "line %zu: there isn't a bookmark named '%s' to delete\n", line_number, name);
+            return 1;
+        }
+        store_mark_removed(store, target);
+        return store_record(store, JOURNAL_DEL, name, NULL);
+    }
+
+    // rename
+    Bookmark *target = store_find(store, name);
+    if (!target) {
+        fprintf(stderr, "line %zu: there isn't a bookmark named '%s' to rename\n", line_number, name);
+        return 1;
+    }
+    if (store_find(store, rest)) {
+        fprintf(stderr, "line %zu: there is already a bookmark named '%s'\n", line_number, rest);
+        return 1;
+    }
+    if (rest_len >= MAX_NAME || strpbrk(rest, " \t")) {
+        fprintf(stderr, "line %zu: '%s' is not a valid bookmark name\n", line_number, rest);
+        return 1;
+    }
+    if (store_rename(store, target, rest) != 0) return 1;
+    return store_record(store, JOURNAL_REN, name, rest);
+}
+
+/*
+ * Splits the next whitespace-separated token off the cursor.
+ * Returns the token, or NULL if there are none left.
+ */
+static char *next_token(char **cursor) {
+    char *start = *cursor;
+    while (isspace((unsigned char) *start)) start++;
+    if (*start == '\0') {
+        *cursor = start;
         return NULL;
     }
 
-    sprintf(dir_path, "%s%s", home, BOOKMARK_DIRECTORY);
-    return dir_path;
-}
\ No newline at end of file
+    char *end = start;
+    while (*end && !isspace((unsigned char) *end)) end++;
+    if (*end) *end++ = '\0';
+    *cursor = end;
+    return start;
+}
+
+/*
+ * Writes text followed by a newline with one writev() call, without copying or allocating.
+ * Returns 0 on success, 1 on error.
+ */
+static int write_line(int fd, const char *text) {
+    size_t len = strlen(text);
+    struct iovec parts[2] = { { (void *) text, len }, { "\n", 1 } };
+    ssize_t written = writev(fd, parts, 2);
+    if (written == (ssize_t) len + 1) return 0;
+
+    // Short write (e.g. a pipe filled up): finish the rest the slow way
+    if (written < 0) written = 0;
+    if ((size_t) written < len && write_all(fd, text + written, len - written) != 0) return 1;
+    return write_all(fd, "\n", 1);
+}
+
+/*
+ * Starts $PAGER (less -FRX by default, which exits at once if the output fits on one screen)
+ * when stdout is a terminal.
+ * Returns the pager's stdin, or NULL to write to stdout directly.
+ */
+static FILE *start_pager(void) {
+    if (!isatty(STDOUT_FILENO)) return NULL;
+
+    const char *pager = getenv("PAGER");
+    if (!pager) pager = "less -FRX";
+    if (pager[0] == '\0' || strcmp(pager, "cat") == 0) return NULL;
+
+    // Quitting the pager early closes the pipe: stop writing instead of dying on SIGPIPE
+    fflush(stdout);
+    signal(SIGPIPE, SIG_IGN);
+    return popen(pager, "w");
+}
+
+/*
+ * Lists the bookmarks of a stream in file order, in one of the non-table formats.
+ * Memory use doesn't depend on the number of bookmarks.
+ * Returns 0 on success, 1 on error.
+ */
+static int stream_list(const ListOptions *options, StoreStream *stream) {
+    TRACE_PHASE("stream");
+    FILE *pager = options->paginate ? start_pager() : NULL;
+    OutputBuffer out;
+    output_init(&out, pager ? fileno(pager) : STDOUT_FILENO);
+
+    if (options->format == LIST_FORMAT_JSON) output_string(&out, "[");
+    bool first = true;
+    StreamedBookmark row;
+    int status;
+    while ((status = store_stream_next(stream, &row)) == 1) {
+        if (!matches_filter(options->filter, row.name, row.path)) continue;
+        print_list_row(&out, options->format, &row, NULL, false, 0, 0, first);
+        first = false;
+    }
+    if (options->format == LIST_FORMAT_JSON) output_string(&out, first ? "]\n" : "\n]\n");
+
+    if (status < 0) fprintf(stderr, "Failed to read the bookmarks: %s\n", strerror(errno));
+    if (output_flush(&out) != 0 && !pager) status = -1;
+    if (pager) pclose(pager);
+    return status < 0;
+}
+
+/*
+ * Appends one bookmark to the list output in the given format.
+ * record is the bookmark's usage (NULL if never visited) and is only printed if show_usage is true.
+ * first is true for the first row.
+ */
+static void print_list_row(OutputBuffer *out, ListFormat format, const StreamedBookmark *row, const UsageRecord *record,
+                           bool show_usage, int longest_path, time_t now, bool first) {
+    const char *name = row->name;
+    const char *path = row->path;
+    char field[64];
+
+    switch (format) {
+        case LIST_FORMAT_TABLE:
+            output_string(out, "| ");
+            output_padded(out, name, row->name_len, 15);
+            output_string(out, " | ");
+            output_padded(out, path, row->path_len, longest_path);
+            output_string(out, " |");
+            if (show_usage) {
+                char age[24];   // Room for any int, though format_age never writes more than 10
+                format_age(age, sizeof(age), record ? record->last_visit : 0, now);
+                snprintf(field, sizeof(field), " %6llu | %-9s |", record ? (unsigned long long) record->visits : 0ull, age);
+                output_string(out, field);
+            }
+            output_string(out, "\n");
+            break;
+
+        case LIST_FORMAT_TSV:
+            output_write(out, name, row->name_len);
+            output_string(out, "\t");
+            output_write(out, path, row->path_len);
+            if (show_usage) {
+                snprintf(field, sizeof(field), "\t%llu\t%lld", record ? (unsigned long long) record->visits : 0ull,
+                         record ? (long long) record->last_visit : 0ll);
+                output_string(out, field);
+            }
+            output_string(out, "\n");
+            break;
+
+        case LIST_FORMAT_JSON:
+            output_string(out, first ? "\n  {\"name\": " : ",\n  {\"name\": ");
+            output_json_string(out, name, row->name_len);
+            output_string(out, ", \"path\": ");
+            output_json_string(out, path, row->path_len);
+            output_string(out, ", \"tags\": [");
+            for (const char *tag = row->tags; *tag;) {
+                const char *comma = strchr(tag, ',');
+                size_t len = comma ? (size_t) (comma - tag) : strlen(tag);
+                if (tag != row->tags) output_string(out, ", ");
+                output_json_string(out, tag, len);
+                tag += len + (comma ? 1 : 0);
+            }
+            output_string(out, "]");
+            if (show_usage) {
+                snprintf(field, sizeof(field), ", \"visits\": %llu, \"last_visit\": %lld",
+                         record ? (unsigned long long) record->visits : 0ull, record ? (long long) record->last_visit : 0ll);
+                output_string(out, field);
+            }
+            output_string(out, "}");
+            break;
+
+        case LIST_FORMAT_NULL:
+            output_write(out, name, row->name_len + 1);    // Including the null terminators
+            output_write(out, path, row->path_len + 1);
+            break;
+    }
+}
+
+
@@ -2,23 +2,22 @@
 
 #define BOOKMARKS_H
 
+#include <stdbool.h>
+
 #define BOOKMARK_DIRECTORY "/.bm/"
-#define BOOKMARK_FILE "bookmarks.tsv"
+#define BOOKMARK_FILE "bookmarks.snap"
+#define TSV_BOOKMARK_FILE "bookmarks.tsv"      // The text format, migrated to BOOKMARK_FILE on first use
 
 #define MAX_NAME 16        // Max buffer size (15 visible chars + null terminator)
 #define MAX_PATH 4096       // Max buffer size (4095 visible chars + null terminator) (Same size as PATH_MAX in linux/limits.h)
 
-#define MAX_LINE (MAX_NAME + MAX_PATH + 2) // Max line in bookmarks.tsv (MAX_NAME + MAX_PATH + tab + newline)
+#define MAX_TAG 32          // Max buffer size of one tag (31 visible chars + null terminator)
+#define MAX_TAGS 16         // Tags per bookmark
+#define MAX_TAG_LIST (MAX_TAGS * MAX_TAG)   // Comma-separated tags of a bookmark, with the null terminator
 
-typedef struct {
-    char name[MAX_NAME];
-    char path[MAX_PATH];
-} Bookmark;
+#define MAX_LINE (MAX_NAME + MAX_PATH + 2) // Max line in bookmarks.tsv (MAX_NAME + MAX_PATH + tab + newline)
 
-typedef struct node{
-    Bookmark bookmark;
-    struct node *next;
-} BookmarkNode;
+#define RESOLVE_BUFFER 65536    // Size of the reads of 'bm resolve' from stdin
 
 /*
  * Prints usage information and available commands.
@@ -27,7 +26,7 @@ void print_helper(void);
 
 /*
  * Initialize the bookmark system by creating ~/.bm/ directory
- * and bookmarks.tsv file if they don't exist.
+ * and an empty bookmarks.snap if they don't exist.
  * Returns 0 on success, 1 on error.
  */
 int init_bookmark(void);
@@ -40,10 +39,43 @@ int init_bookmark(void);
 int add_bookmark(char *name, char *path);
 
 /*
- * List all the bookmarks in a formatted table.
- * Returns 0 on success, 1 if not initialized.
+ * Orders understood by list_bookmarks.
+ */
+typedef enum {
+    LIST_SORT_NONE,         // File order
+    LIST_SORT_NAME,         // Case-insensitive, by name
+    LIST_SORT_PATH,
+    LIST_SORT_FRECENCY,     // Most frequently and recently visited first, with visit counts
+} ListSort;
+
+/*
+ * Output formats understood by list_bookmarks.
  */
-int list_bookmarks(void);
+typedef enum {
+    LIST_FORMAT_TABLE,      // Boxed table for people
+    LIST_FORMAT_TSV,        // name<TAB>path per line
+    LIST_FORMAT_JSON,       // An array of {"name", "path", "tags"} objects
+    LIST_FORMAT_NULL,       // name<NUL>path<NUL>, for xargs -0 and read -d ''
+} ListFormat;
+
+typedef struct {
+    ListSort sort;
+    ListFormat format;
+    const char *filter;     // Glob (if it has *, ? or [) or substring matched against names and paths, or NULL
+    bool paginate;          // Page through $PAGER when stdout is a terminal
+    const char *all_tags;   // Comma-separated tags a bookmark must all have, or NULL
+    const char *any_tags;   // Comma-separated tags a bookmark must have at least one of, or NULL
+    const char *no_tags;    // Comma-separated tags a bookmark must have none of, or NULL
+} ListOptions;
+
+/*
+ * List the bookmarks that match the filter and the tags, in the requested order and format.
+ * Tag conditions are answered with the tag bitmaps of the index (see tags.h).
+ * Rows are written through one 64 KiB buffer. Unless sorting, they stream straight
+ * from the loaded store without any per-row allocation.
+ * Returns 0 on success, 1 if not initialized or on error.
+ */
+int list_bookmarks(const ListOptions *options);
 
 /*
  * Remove bookmark by name.
@@ -64,11 +96,126 @@ int rename_bookmark(char *old_name, char *new_name);
  */
 int edit_path(char *name, char *new_path);
 
+/*
+ * Adds tags to a bookmark, or prints its tags (one per line) if there are none to add.
+ * Returns 0 on success, 1 if not initialized, if a tag is invalid or if bookmark not found.
+ */
+int tag_bookmark(char *name, char **tags, int tag_count);
+
+/*
+ * Removes tags from a bookmark. Tags it doesn't have are ignored.
+ * Returns 0 on success, 1 if not initialized, if a tag is invalid or if bookmark not found.
+ */
+int untag_bookmark(char *name, char **tags, int tag_count);
+
 /*
  * Prints the path of a bookmark to stdout for the shell wrapper.
+ * If no bookmark has that name, it is matched fuzzily (as a subsequence) against
+ * every name, and the path of the best match is printed instead.
  * Error messages are printed to stderr to not interfere with the shell wrapper.
  * Returns 0 on success, 1 if bookmark not found.
  */
 int go(char *name);
 
+/*
+ * Prints the name of the bookmark for path (the current directory if NULL), or for its nearest
+ * bookmarked parent, e.g. for a shell prompt. Answered from the path-sorted array in bookmarks.idx,
+ * with one binary search per path component.
+ * Prints nothing, not even an error, when no bookmark contains the path.
+ * Returns 0 on success, 1 if no bookmark contains the path or on error.
+ */
+int which_bookmark(char *path);
+
+/*
+ * Reads bookmark names from stdin, one per line (or NUL-delimited), and prints the path of each
+ * in the same order and with the same delimiter. An unknown name prints an empty record, so
+ * output records always line up with the input, and an error on stderr. The index is opened
+ * once; it is reopened when the store changes, so 'bm resolve' can run as a long-lived coprocess.
+ * Returns 0 if every name was found, 1 otherwise.
+ */
+int resolve_bookmarks(bool null_delimited);
+
+/*
+ * Applies add/delete/rename/edit operations, one per line, from a file (or stdin if file_path is NULL or "-").
+ * The store is loaded and locked once, and all successful operations are committed together in a single save.
+ * Failed lines are reported with their line number and skipped.
+ * Returns 0 if every line succeeded, 1 otherwise.
+ */
+int batch_bookmarks(char *file_path);
+
+/*
+ * Checks every bookmarked directory concurrently and reports the missing, moved,
+ * non-directory and unreachable ones. A path that takes longer than timeout_ms counts as unreachable.
+ * With prune, missing and non-directory bookmarks are deleted; with relink, moved ones are
+ * pointed at their canonical path. Unreachable bookmarks are only reported.
+ * Returns 0 if every bookmark is (now) valid, 1 otherwise.
+ */
+int doctor_bookmarks(bool prune, bool relink, int timeout_ms);
+
+/*
+ * Prints the names of the bookmarks starting with prefix (case-insensitive), one per line,
+ * in case-folded alphabetical order. Answered from the sorted names in bookmarks.idx
+ * with a binary search, so the store isn't parsed unless the index is stale.
+ * Used by shell completion, so nothing but names is printed to stdout.
+ * Returns 0 on success, 1 if not initialized.
+ */
+int complete_bookmarks(char *prefix);
+
+/*
+ * Prints the completion script for a shell ("bash", "zsh" or "fish").
+ * Returns 0 on success, 1 if the shell isn't supported.
+ */
+int print_completion(char *shell);
+
+/*
+ * Runs 'bm daemon' in the foreground, serving go, list and complete from memory
+ * over ~/.bm/bm.sock. Other commands use it automatically while it is running.
+ * With watch, bookmarks follow their directories when they are renamed, and deleted
+ * ones are reported.
+ * Returns 0 when stopped, 1 on error.
+ */
+int start_daemon(bool watch);
+
+/*
+ * Adds the directories of another tool's database (see interop.h for the formats and the
+ * naming of the new bookmarks) read from file_path, or from stdin if it is NULL or "-".
+ * Returns 0 on success, 1 if not initialized or on error.
+ */
+int import_bookmarks(char *format, char *file_path);
+
+/*
+ * Prints the bookmarks of ~/.bm/ to stdout in one of the import formats. In the tsv format
+ * (the text format of bookmarks.tsv, with ids and tags) the output, saved as ~/.bm/bookmarks.tsv
+ * without a bookmarks.snap, is migrated back into a snapshot on the next load.
+ * Returns 0 on success, 1 if not initialized or on error.
+ */
+int export_bookmarks(char *format);
+
+/*
+ * Lists the generations of ~/.bm/ kept in its history (see history.h), newest first: when each
+ * was made and what it changed. The current generation is marked with '*'.
+ * Returns 0 on success, 1 if not initialized or on error.
+ */
+int list_history(void);
+
+/*
+ * Goes back to the bookmarks before the last change, as a new generation. Repeated undos keep
+ * walking back; 'bm restore' to a later generation undoes them.
+ * Returns 0 on success, 1 if there is nothing to undo, if not initialized or on error.
+ */
+int undo_bookmarks(void);
+
+/*
+ * Goes back to the bookmarks of a generation listed by 'bm history', as a new generation.
+ * Returns 0 on success, 1 if there is no such generation, if not initialized or on error.
+ */
+int restore_bookmarks(char *generation);
+
+/*
+ * Prints the health of ~/.bm/: latency percentiles of each command, the miss rate of 'bm go'
+ * lookups, and the size and entry count of the store (see stats.h), as text or as JSON.
+ * Returns 0 on success, 1 if not initialized or on error.
+ */
+int print_stats(bool json);
+
 #endif
@@ -0,0 +1,195 @@
+#include "completion.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef enum {
+    ARG_NONE,
+    ARG_BOOKMARK,           // Completed with 'bm complete'
+    ARG_DIRECTORY,
+    ARG_FILE,
+} ArgumentKind;
+
+typedef struct {
+    const char *name;
+    const char *description;
+    ArgumentKind arguments[2];  // Kinds of the first two arguments
+    const char *words;          // Fixed words (options) offered for any argument, or NULL
+} CompletionCommand;
+
+static const CompletionCommand commands[] = {
+    { "init", "Initialize bookmark system", { ARG_NONE, ARG_NONE }, NULL },
+    { "add", "Add a bookmark", { ARG_NONE, ARG_DIRECTORY }, NULL },
+    { "delete", "Delete a bookmark", { ARG_BOOKMARK, ARG_NONE }, NULL },
+    { "list", "List all bookmarks", { ARG_NONE, ARG_NONE },
+      "--sort=name --sort=path --sort=frecency --filter --format=table --format=tsv --format=json --format=null --no-pager "
+      "--tag --any-tag --not-tag" },
+    { "rename", "Rename a bookmark", { ARG_BOOKMARK, ARG_NONE }, NULL },
+    { "edit", "Edit the path of a bookmark", { ARG_BOOKMARK, ARG_DIRECTORY }, NULL },
+    { "tag", "Add tags to a bookmark", { ARG_BOOKMARK, ARG_NONE }, NULL },
+    { "untag", "Remove tags from a bookmark", { ARG_BOOKMARK, ARG_NONE }, NULL },
+    { "go", "Go to a bookmark", { ARG_BOOKMARK, ARG_NONE }, NULL },
+    { "which", "Print the bookmark of a directory", { ARG_DIRECTORY, ARG_NONE }, NULL },
+    { "resolve", "Print the path of each name read from stdin", { ARG_NONE, ARG_NONE }, "-0 --null" },
+    { "batch", "Apply changes from a file or stdin", { ARG_FILE, ARG_NONE }, NULL },
+    { "complete", "Print bookmark names starting with a prefix", { ARG_NONE, ARG_NONE }, NULL },
+    { "completion", "Print a shell completion script", { ARG_NONE, ARG_NONE }, "bash zsh fish" },
+    { "daemon", "Serve lookups from memory until stopped", { ARG_NONE, ARG_NONE }, "-w --watch" },
+    { "doctor", "Check every bookmarked directory", { ARG_NONE, ARG_NONE }, "--prune --relink --timeout" },
+    { "import", "Add the directories of another tool", { ARG_FILE, ARG_NONE },
+      "--from=tsv --from=autojump --from=z --from=fasd --from=zoxide --from=cdpath" },
+    { "export", "Print the bookmarks for another tool", { ARG_NONE, ARG_NONE },
+      "--to=tsv --to=autojump --to=z --to=fasd --to=zoxide --to=cdpath --tsv" },
+    { "history", "List the generations of the bookmarks", { ARG_NONE, ARG_NONE }, NULL },
+    { "undo", "Go back to the bookmarks before the last change", { ARG_NONE, ARG_NONE }, NULL },
+    { "restore", "Go back to the bookmarks of a generation", { ARG_NONE, ARG_NONE }, NULL },
+    { "stats", "Show latency percentiles and lookup misses", { ARG_NONE, ARG_NONE }, "--json" },
+    { "help", "Print usage", { ARG_NONE, ARG_NONE }, NULL },
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+// Helper functions
+static void print_bash(void);
+static void print_zsh(void);
+static void print_fish(void);
+static void print_positions(ArgumentKind kind, const char *format, int first_position);
+
+int print_completion_script(const char *shell) {
+    if (strcmp(shell, "bash") == 0) print_bash();
+    else if (strcmp(shell, "zsh") == 0) print_zsh();
+    else if (strcmp(shell, "fish") == 0) print_fish();
+    else {
+        fprintf(stderr, "Unsupported shell '%s'. Try bash, zsh or fish.\n", shell);
+        return 1;
+    }
+    return 0;
+}
+
+// Helper functions
+
+/*
+ * Prints the bash script. Load it with: eval "$(bm completion bash)"
+ */
+static void print_bash(void) {
+    printf("# bm completion for bash. Load with: eval \"$(bm completion bash)\"\n");
+    printf("_bm() {\n");
+    printf("    local cur=${COMP_WORDS[COMP_CWORD]}\n");
+    printf("    if [ \"$COMP_CWORD\" -eq 1 ]; then\n");
+    printf("        COMPREPLY=($(compgen -W \"");
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        printf("%s%s", i ? " " : "", commands[i].name);
+    }
+    printf("\" -- \"$cur\"))\n");
+    printf("        return\n");
+    printf("    fi\n");
+    printf("    local IFS=$'\\n'\n");
+    printf("    case \"${COMP_WORDS[1]}:$COMP_CWORD\" in\n");
+
+    printf("        ");
+    print_positions(ARG_BOOKMARK, "%s:%d", 2);
+    printf(") COMPREPLY=($(command bm complete \"$cur\" 2>/dev/null)) ;;\n");
+    printf("        ");
+    print_positions(ARG_DIRECTORY, "%s:%d", 2);
+    printf(") compopt -o filenames; COMPREPLY=($(compgen -d -- \"$cur\")) ;;\n");
+    printf("        ");
+    print_positions(ARG_FILE, "%s:%d", 2);
+    printf(") compopt -o filenames; COMPREPLY=($(compgen -f -- \"$cur\")) ;;\n");
+
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        if (!commands[i].words) continue;
+        printf("        %s:*) IFS=' ' COMPREPLY=($(compgen -W \"%s\" -- \"$cur\")) ;;\n", commands[i].name, commands[i].words);
+    }
+    printf("    esac\n");
+    printf("}\n");
+    printf("complete -F _bm bm\n");
+}
+
+/*
+ * Prints the zsh script. Load it with: eval "$(bm completion zsh)"
+ */
+static void print_zsh(void) {
+    printf("#compdef bm\n");
+    printf("# bm completion for zsh. Load with: eval \"$(bm completion zsh)\"\n");
+    printf("_bm() {\n");
+    printf("    if (( CURRENT == 2 )); then\n");
+    printf("        local -a commands\n");
+    printf("        commands=(\n");
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        printf("            '%s:%s'\n", commands[i].name, commands[i].description);
+    }
+    printf("        )\n");
+    printf("        _describe 'command' commands\n");
+    printf("        return\n");
+    printf("    fi\n");
+    printf("    case \"$words[2]:$CURRENT\" in\n");
+
+    printf("        ");
+    print_positions(ARG_BOOKMARK, "%s:%d", 3);
+    printf(")\n");
+    printf("            local -a names\n");
+    printf("            names=(${(f)\"$(command bm complete \"$PREFIX\" 2>/dev/null)\"})\n");
+    printf("            compadd -M 'm:{a-zA-Z}={A-Za-z}' -a names ;;\n");
+    printf("        ");
+    print_positions(ARG_DIRECTORY, "%s:%d", 3);
+    printf(") _path_files -/ ;;\n");
+    printf("        ");
+    print_positions(ARG_FILE, "%s:%d", 3);
+    printf(") _files ;;\n");
+
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        if (!commands[i].words) continue;
+        printf("        %s:*) compadd -- %s ;;\n", commands[i].name, commands[i].words);
+    }
+    printf("    esac\n");
+    printf("}\n");
+    printf("(( $+functions[compdef] )) || { autoload -U compinit && compinit }\n");
+    printf("compdef _bm bm\n");
+}
+
+/*
+ * Prints the fish script. Load it with: bm completion fish | source
+ */
+static void print_fish(void) {
+    printf("# bm completion for fish. Load with: bm completion fish | source\n");
+    printf("complete -c bm -f\n");
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        printf("complete -c bm -n __fish_use_subcommand -a %s -d '%s'\n", commands[i].name, commands[i].description);
+    }
+
+    // (commandline -opc) holds the words before the cursor: 'bm', the command, then the arguments
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        for (int argument = 0; argument < 2; argument++) {
+            const char *source = NULL;
+            switch (commands[i].arguments[argument]) {
+                case ARG_BOOKMARK: source = "-a '(command bm complete (commandline -ct) 2>/dev/null)'"; break;
+                case ARG_DIRECTORY: source = "-a '(__fish_complete_directories (commandline -ct))'"; break;
+                case ARG_FILE: source = "-F"; break;
+                case ARG_NONE: break;
+            }
+            if (!source) continue;
+            printf("complete -c bm -n '__fish_seen_subcommand_from %s; and test (count (commandline -opc)) -eq %d' %s\n",
+                   commands[i].name, argument + 2, source);
+        }
+        if (commands[i].words) {
+            printf("complete -c bm -n '__fish_seen_subcommand_from %s' -a '%s'\n", commands[i].name, commands[i].words);
+        }
+    }
+}
+
+/*
+ * Prints a case pattern like "go:2|delete:2|edit:3" matching every command
+ * argument of the given kind, where the first argument is at first_position.
+ */
+static void print_positions(ArgumentKind kind, const char *format, int first_position) {
+    bool first = true;
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        for (int argument = 0; argument < 2; argument++) {
+            if (commands[i].arguments[argument] != kind) continue;
+            if (!first) printf("|");
+            printf(format, commands[i].name, first_position + argument);
+            first = false;
+        }
+    }
+}
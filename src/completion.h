@@ -0,0 +1,13 @@
+#ifndef COMPLETION_H
+
+#define COMPLETION_H
+
+/*
+ * Prints the completion script for "bash", "zsh" or "fish" to stdout.
+ * The scripts are generated from one table of commands and their arguments,
+ * and complete bookmark names through 'bm complete', so they stay current.
+ * Returns 0 on success, 1 if the shell isn't supported.
+ */
+int print_completion_script(const char *shell);
+
+#endif
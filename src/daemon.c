@@ -0,0 +1,438 @@
+#include "daemon.h"
+#include "fuzzy.h"
+#include "store.h"
+#include "usage.h"
+#include "watch.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define REQUEST_MAX (MAX_PATH + 32)
+
+static volatile sig_atomic_t stop_requested = 0;
+
+// Helper functions
+static void handle_stop(int signal_number);
+static int open_socket(const char *socket_path, struct sockaddr_un *address, int *fd);
+static bool watched_file_changed(int inotify_fd);
+static bool reload_store(BookmarkStore *store, FuzzyTable *fuzzy, Watcher *watcher);
+static void serve_client(int client, BookmarkStore *store, const FuzzyTable *fuzzy);
+static long best_fuzzy_match(const BookmarkStore *store, const FuzzyTable *fuzzy, const char *query);
+static void set_timeout(int fd, int timeout_ms);
+static int send_request(const char *op, const char *argument);
+
+int run_daemon(bool watch) {
+    char *socket_path = get_bookmark_socket_path();
+    char *dir_path = get_bookmark_dir_path();
+    if (!socket_path || !dir_path) {
+        free(socket_path);
+        free(dir_path);
+        return 1;
+    }
+
+    struct sockaddr_un address;
+    int listener;
+    if (open_socket(socket_path, &address, &listener) != 0) {
+        free(socket_path);
+        free(dir_path);
+        return 1;
+    }
+
+    // Writers touch the journal on every mutation and replace the snapshot on compaction
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1 ||
+        inotify_add_watch(inotify_fd, dir_path, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1) {
+        fprintf(stderr, "Failed to watch %s: %s\n", dir_path, strerror(errno));
+        if (inotify_fd != -1) close(inotify_fd);
+        close(listener);
+        unlink(socket_path);
+        free(socket_path);
+        free(dir_path);
+        return 1;
+    }
+    free(dir_path);
+
+    struct sigaction action = {0};
+    action.sa_handler = handle_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    BookmarkStore store;
+    if (store_load(&store, NULL) != 0) {
+        fprintf(stderr, "Failed to load bookmarks. Run 'bm init' first to initialize the bookmark system!\n");
+        store_free(&store);
+        close(inotify_fd);
+        close(listener);
+        unlink(socket_path);
+        free(socket_path);
+        return 1;
+    }
+
+    // Packed once per load, so fuzzy lookups only pay for the scan
+    FuzzyTable fuzzy;
+    if (fuzzy_build(&fuzzy, &store) != 0) fuzzy_free(&fuzzy);
+
+    Watcher watcher;
+    watcher_init(&watcher);
+    if (watch && watcher_track(&watcher, &store) != 0) {
+        fuzzy_free(&fuzzy);
+        store_free(&store);
+        close(inotify_fd);
+        close(listener);
+        unlink(socket_path);
+        free(socket_path);
+        return 1;
+    }
+
+    printf("bm daemon listening on %s\n", socket_path);
+    if (watch) printf("Watching %s bookmarked directories for renames and deletions\n", watcher.full ? "some" : "all");
+    fflush(stdout);
+
+    bool stale = false;
+    struct pollfd fds[3] = {
+        { .fd = listener, .events = POLLIN },
+        { .fd = inotify_fd, .events = POLLIN },
+        { .fd = watcher.fd, .events = POLLIN },     // Ignored by poll while it is -1
+    };
+
+    while (!stop_requested) {
+        if (poll(fds, 3, -1) == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Failed to poll: %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            stale |= watched_file_changed(inotify_fd);
+
+            // The watches follow the bookmarked paths, so they are renewed as soon as those change
+            if (stale && watch) {
+                stale = !reload_store(&store, &fuzzy, &watcher);
+                fds[2].fd = watcher.fd;
+            }
+        }
+
+        if (fds[2].revents & POLLIN) {
+            watcher_handle(&watcher, &store);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int client = accept(listener, NULL, NULL);
+            if (client == -1) continue;
+
+            // Pick up changes made right before the client connected
+            stale |= watched_file_changed(inotify_fd);
+
+            // Reload lazily, so a burst of journal appends costs a single reload
+            if (stale) {
+                stale = !reload_store(&store, &fuzzy, watch ? &watcher : NULL);
+                fds[2].fd = watcher.fd;
+            }
+
+            serve_client(client, &store, &fuzzy);
+            close(client);
+        }
+    }
+
+    watcher_free(&watcher);
+    fuzzy_free(&fuzzy);
+    store_free(&store);
+    close(inotify_fd);
+    close(listener);
+    unlink(socket_path);
+    free(socket_path);
+    return 0;
+}
+
+int daemon_request(const char *op, const char *argument, char **response, size_t *size) {
+    int fd = send_request(op, argument);
+    if (fd == -1) return 1;
+
+    size_t capacity = 4096, total = 0;
+    char *buffer = malloc(capacity);
+    while (buffer) {
+        if (total + 1 == capacity) {
+            char *grown = realloc(buffer, capacity * 2);
+            if (!grown) {
+                free(buffer);
+                buffer = NULL;
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+
+        ssize_t bytes = read(fd, buffer + total, capacity - total - 1);
+        if (bytes == 0) break;
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            free(buffer);   // Timed out or reset: the answer is incomplete
+            buffer = NULL;
+            break;
+        }
+        total += bytes;
+    }
+    close(fd);
+
+    if (!buffer || total == 0) {
+        free(buffer);
+        return 1;
+    }
+
+    buffer[total] = '\0';
+    *response = buffer;
+    *size = total;
+    return 0;
+}
+
+int daemon_request_buffer(const char *op, const char *argument, char *buffer, size_t capacity, size_t *size) {
+    int fd = send_request(op, argument);
+    if (fd == -1) return 1;
+
+    size_t total = 0;
+    int status = 0;
+    for (;;) {
+        if (total + 1 == capacity) {
+            status = 1;     // Bigger than the caller expected
+            break;
+        }
+        ssize_t bytes = read(fd, buffer + total, capacity - total - 1);
+        if (bytes == 0) break;
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            status = 1;
+            break;
+        }
+        total += bytes;
+    }
+    close(fd);
+
+    if (status != 0 || total == 0) return 1;
+    buffer[total] = '\0';
+    *size = total;
+    return 0;
+}
+
+// Helper functions
+
+/*
+ * Asks the main loop to shut down and remove the socket.
+ */
+static void handle_stop(int signal_number) {
+    (void) signal_number;
+    stop_requested = 1;
+}
+
+/*
+ * Binds the daemon's socket, replacing a stale one left by a daemon that didn't shut down cleanly.
+ * Returns 0 on success, 1 on error or if another daemon is already running.
+ */
+static int open_socket(const char *socket_path, struct sockaddr_un *address, int *fd) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "The socket path %s is too long.\n", socket_path);
+        return 1;
+    }
+    strcpy(address->sun_path, socket_path);
+
+    *fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (*fd == -1) {
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (connect(*fd, (struct sockaddr *) address, sizeof(*address)) == 0) {
+        fprintf(stderr, "A bm daemon is already running on %s\n", socket_path);
+        close(*fd);
+        return 1;
+    }
+    close(*fd);
+    unlink(socket_path);
+
+    *fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (*fd == -1 ||
+        bind(*fd, (struct sockaddr *) address, sizeof(*address)) == -1 ||
+        listen(*fd, SOMAXCONN) == -1) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", socket_path, strerror(errno));
+        if (*fd != -1) close(*fd);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Drains pending inotify events.
+ * Returns true if the snapshot or the journal changed.
+ */
+static bool watched_file_changed(int inotify_fd) {
+    char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+
+    ssize_t len;
+    while ((len = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *cursor = buffer; cursor < buffer + len;) {
+            const struct inotify_event *event = (const struct inotify_event *) cursor;
+            if (event->len > 0 &&
+                (strcmp(event->name, BOOKMARK_FILE) == 0 || strcmp(event->name, JOURNAL_FILE) == 0)) {
+                changed = true;
+            }
+            cursor += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+/*
+ * Replaces the store with a fresh load and rebuilds what is derived from it: the fuzzy
+ * table, and the watches if watcher is not NULL.
+ * Returns true on success; on error the old store is kept.
+ */
+static bool reload_store(BookmarkStore *store, FuzzyTable *fuzzy, Watcher *watcher) {
+    BookmarkStore fresh;
+    if (store_load(&fresh, NULL) != 0) {
+        store_free(&fresh);
+        return false;
+    }
+
+    store_free(store);
+    *store = fresh;
+    fuzzy_free(fuzzy);
+    if (fuzzy_build(fuzzy, store) != 0) fuzzy_free(fuzzy);
+    if (watcher) watcher_track(watcher, store);
+    return true;
+}
+
+/*
+ * Reads one request from a client and writes the answer.
+ */
+static void serve_client(int client, BookmarkStore *store, const FuzzyTable *fuzzy) {
+    set_timeout(client, DAEMON_TIMEOUT_MS);
+
+    char request[REQUEST_MAX];
+    size_t total = 0;
+    while (total < sizeof(request) - 1) {
+        ssize_t bytes = read(client, request + total, sizeof(request) - 1 - total);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) break;
+        total += bytes;
+        if (memchr(request, '\n', total)) break;
+    }
+    request[total] = '\0';
+
+    char *newline = strchr(request, '\n');
+    char *tab = strchr(request, '\t');
+    if (!newline || !tab || tab > newline) return;
+    *newline = '\0';
+    *tab = '\0';
+    const char *op = request;
+    const char *argument = tab + 1;
+
+    FILE *out = fdopen(dup(client), "w");
+    if (!out) return;
+    setvbuf(out, NULL, _IOFBF, 64 * 1024);
+
+    if (strcmp(op, DAEMON_GO) == 0) {
+        Bookmark *target = store_find(store, argument);
+        long best;
+        if (store->count == 0) {
+            fprintf(out, "EMPTY\n");
+        }
+        else if (target) {
+            fprintf(out, "OK\t%s\n", bookmark_path(store, target));
+            usage_record_visit(target->id);
+        }
+        else if ((best = best_fuzzy_match(store, fuzzy, argument)) >= 0) {
+            const Bookmark *match = &store->records[best];
+            fprintf(out, "FUZZY\t%s\t%s\n", bookmark_name(store, match), bookmark_path(store, match));
+            usage_record_visit(match->id);
+        }
+        else {
+            fprintf(out, "MISSING\n");
+        }
+    }
+    else if (strcmp(op, DAEMON_LIST) == 0) {
+        fprintf(out, "OK\nBookmark Name\tDirectory Path\n");
+        for (size_t i = 0; i < store->count; i++) {
+            const Bookmark *bookmark = &store->records[i];
+            fprintf(out, "%s\t%s\t%u%s%s\n", bookmark_name(store, bookmark), bookmark_path(store, bookmark), bookmark->id,
+                    bookmark->tags_len ? "\t#" : "", bookmark_tags(store, bookmark));
+        }
+    }
+    else if (strcmp(op, DAEMON_COMPLETE) == 0) {
+        size_t len = strlen(argument);
+        fprintf(out, "OK\n");
+        for (size_t i = 0; i < store->count; i++) {
+            const char *name = bookmark_name(store, &store->records[i]);
+            if (strncasecmp(name, argument, len) == 0) fprintf(out, "%s\n", name);
+        }
+    }
+
+    fclose(out);
+}
+
+/*
+ * Finds the best fuzzy match, breaking ties by frecency. The usage file is read
+ * per request, since every 'bm go' updates it without telling the daemon.
+ * Returns the index of the matching record, or -1 if nothing matches.
+ */
+static long best_fuzzy_match(const BookmarkStore *store, const FuzzyTable *fuzzy, const char *query) {
+    UsageMap usage;
+    double *frecency = usage_open(&usage) == 0 ? usage_frecency_table(&usage, store, time(NULL)) : NULL;
+    usage_close(&usage);
+
+    long best = fuzzy_best(fuzzy, query, frecency);
+    free(frecency);
+    return best;
+}
+
+/*
+ * Bounds how long reads and writes on a socket may block.
+ */
+static void set_timeout(int fd, int timeout_ms) {
+    struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/*
+ * Connects to the daemon and sends one request, building the socket path on the stack.
+ * Returns the connected socket (write side shut down), or -1 if no daemon is listening.
+ */
+static int send_request(const char *op, const char *argument) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (store_entry_path(address.sun_path, sizeof(address.sun_path), SOCKET_FILE) != 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    set_timeout(fd, DAEMON_TIMEOUT_MS);
+
+    // No socket or a stale one left by a crashed daemon: the caller falls back to the files
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    char request[REQUEST_MAX];
+    int len = snprintf(request, sizeof(request), "%s\t%s\n", op, argument ? argument : "");
+    if (len < 0 || (size_t) len >= sizeof(request) || write_all(fd, request, len) != 0) {
+        close(fd);
+        return -1;
+    }
+    shutdown(fd, SHUT_WR);
+    return fd;
+}
@@ -0,0 +1,43 @@
+#ifndef DAEMON_H
+
+#define DAEMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DAEMON_TIMEOUT_MS 500   // How long a client waits for the daemon before falling back to the files
+
+/*
+ * Requests understood by the daemon. Each request is one line, "<OP>\t<argument>\n",
+ * and the daemon answers with a status line followed by the payload, then closes the connection:
+ *   GO <name>          "OK\t<path>\n", "FUZZY\t<matched_name>\t<path>\n", "MISSING\n" or "EMPTY\n"
+ *   LIST               "OK\n" followed by the bookmarks in the bookmarks.tsv format
+ *   COMPLETE <prefix>  "OK\n" followed by the matching names, one per line
+ */
+#define DAEMON_GO "GO"
+#define DAEMON_LIST "LIST"
+#define DAEMON_COMPLETE "COMPLETE"
+
+/*
+ * Runs the daemon in the foreground: keeps the parsed store in memory, reloads it
+ * when the snapshot or the journal change, and serves requests on ~/.bm/bm.sock.
+ * With watch, it also follows renamed and deleted bookmarked directories (see watch.h).
+ * Returns 0 when stopped by SIGINT or SIGTERM, 1 on error.
+ */
+int run_daemon(bool watch);
+
+/*
+ * Sends a request to a running daemon and reads the whole response into a
+ * malloc'd, null-terminated buffer.
+ * Returns 0 on success, 1 if no daemon is running or it didn't answer in time.
+ * On success the caller must free the response.
+ */
+int daemon_request(const char *op, const char *argument, char **response, size_t *size);
+
+/*
+ * Like daemon_request, but reads the response into the caller's buffer without allocating.
+ * Returns 0 on success, 1 if no daemon answered in time or the response doesn't fit.
+ */
+int daemon_request_buffer(const char *op, const char *argument, char *buffer, size_t capacity, size_t *size);
+
+#endif
@@ -0,0 +1,156 @@
+#include "fuzzy.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCORE_MATCH 16              // Per matched character
+#define BONUS_PREFIX 32             // The first character matches the start of the name
+#define BONUS_CONSECUTIVE 16        // The character directly follows the previous match
+#define BONUS_BOUNDARY 8            // The character starts a word
+#define PENALTY_GAP 2               // Per skipped character between two matches
+#define PENALTY_UNMATCHED 1         // Per character of the name outside the match
+
+// GCC vector extensions compile to SSE2 on x86-64 and NEON on AArch64, with no intrinsics needed
+typedef uint8_t Vector __attribute__((vector_size(FUZZY_WIDTH)));
+
+// Helper functions
+static size_t prepare_query(const char *query, Vector *needles);
+static inline int score_row(const FuzzyTable *table, size_t row, const Vector *needles, size_t query_len);
+static inline uint32_t match_mask(Vector row, Vector needle);
+static inline uint32_t gather_high_bits(uint64_t bytes);
+
+int fuzzy_build(FuzzyTable *table, const BookmarkStore *store) {
+    table->count = store->count;
+    table->rows = aligned_alloc(FUZZY_WIDTH, (store->count ? store->count : 1) * FUZZY_WIDTH);
+    table->boundaries = malloc((store->count ? store->count : 1) * sizeof(uint16_t));
+    if (!table->rows || !table->boundaries) {
+        store_error("Failed to allocate memory for fuzzy matching: %s\n", strerror(errno));
+        return 1;
+    }
+
+    for (size_t i = 0; i < store->count; i++) {
+        const Bookmark *bookmark = &store->records[i];
+        const char *name = bookmark_name(store, bookmark);
+        uint8_t *row = table->rows[i];
+        uint16_t boundaries = 0;
+
+        memset(row, 0, FUZZY_WIDTH);
+        for (size_t j = 0; j < bookmark->name_len && j < FUZZY_WIDTH; j++) {
+            unsigned char c = name[j];
+            row[j] = tolower(c);
+            if (j == 0 || (isalnum(c) && !isalnum((unsigned char) name[j - 1])) ||
+                (isupper(c) && islower((unsigned char) name[j - 1]))) {
+                boundaries |= 1u << j;
+            }
+        }
+        table->boundaries[i] = boundaries;
+    }
+    return 0;
+}
+
+void fuzzy_free(FuzzyTable *table) {
+    free(table->rows);
+    free(table->boundaries);
+    table->rows = NULL;
+    table->boundaries = NULL;
+    table->count = 0;
+}
+
+int fuzzy_score(const FuzzyTable *table, size_t row, const char *query) {
+    Vector needles[FUZZY_WIDTH];
+    size_t query_len = prepare_query(query, needles);
+    if (query_len == 0) return FUZZY_NO_MATCH;
+    return score_row(table, row, needles, query_len);
+}
+
+long fuzzy_best(const FuzzyTable *table, const char *query, const double *frecency) {
+    Vector needles[FUZZY_WIDTH];
+    size_t query_len = prepare_query(query, needles);
+    if (query_len == 0) return -1;
+
+    long best = -1;
+    int best_score = FUZZY_NO_MATCH;
+    int best_length = 0;
+    for (size_t i = 0; i < table->count; i++) {
+        int score = score_row(table, i, needles, query_len);
+        if (score == FUZZY_NO_MATCH || (best != -1 && score < best_score)) continue;
+
+        int length = strnlen((const char *) table->rows[i], FUZZY_WIDTH);
+        if (best != -1 && score == best_score) {
+            double difference = frecency ? frecency[i] - frecency[best] : 0;
+            if (difference < 0 || (difference == 0 && length >= best_length)) continue;
+        }
+        best = i;
+        best_score = score;
+        best_length = length;
+    }
+    return best;
+}
+
+// Helper functions
+
+/*
+ * Lowercases the query and broadcasts each of its characters to a full vector, once per query.
+ * Returns the length of the query, or 0 if it is empty or longer than any name can be.
+ */
+static size_t prepare_query(const char *query, Vector *needles) {
+    size_t len = strlen(query);
+    if (len == 0 || len > FUZZY_WIDTH) return 0;
+    for (size_t i = 0; i < len; i++) {
+        needles[i] = (Vector) {0} + (uint8_t) tolower((unsigned char) query[i]);
+    }
+    return len;
+}
+
+/*
+ * Scores one row against a prepared query (see fuzzy_score).
+ */
+static inline int score_row(const FuzzyTable *table, size_t row, const Vector *needles, size_t query_len) {
+    Vector name;
+    memcpy(&name, table->rows[row], FUZZY_WIDTH);
+    uint32_t boundaries = table->boundaries[row];
+
+    int score = 0;
+    int previous = -1;
+    for (size_t i = 0; i < query_len; i++) {
+        // Greedy leftmost match: the first occurrence after the previous one
+        uint32_t candidates = match_mask(name, needles[i]) & (~0u << (previous + 1));
+        if (!candidates) return FUZZY_NO_MATCH;
+
+        int position = __builtin_ctz(candidates);
+        score += SCORE_MATCH;
+        if (position == 0 && previous == -1) score += BONUS_PREFIX;
+        if (boundaries & (1u << position)) score += BONUS_BOUNDARY;
+        if (previous >= 0) {
+            if (position == previous + 1) score += BONUS_CONSECUTIVE;
+            else score -= PENALTY_GAP * (position - previous - 1);
+        }
+        previous = position;
+    }
+
+    // Unused name bytes are zero, so the name's length is the number of nonzero bytes
+    int length = FUZZY_WIDTH - __builtin_popcount(match_mask(name, (Vector) {0}));
+    return score - PENALTY_UNMATCHED * (length - (int) query_len);
+}
+
+/*
+ * Compares all 16 bytes of a row with a broadcast character at once.
+ * Returns a bitmask with bit i set if byte i is equal to the character.
+ */
+static inline uint32_t match_mask(Vector row, Vector needle) {
+    Vector equal = (Vector) (row == needle);
+    uint64_t low, high;
+    memcpy(&low, &equal, sizeof(low));
+    memcpy(&high, (const uint8_t *) &equal + sizeof(low), sizeof(high));
+    return gather_high_bits(low) | gather_high_bits(high) << 8;
+}
+
+/*
+ * Collects the high bit of each of the 8 bytes into an 8-bit mask (like SSE2's movemask).
+ */
+static inline uint32_t gather_high_bits(uint64_t bytes) {
+    return ((bytes & 0x8080808080808080ull) * 0x0002040810204081ull) >> 56;
+}
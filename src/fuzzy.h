@@ -0,0 +1,52 @@
+#ifndef FUZZY_H
+
+#define FUZZY_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "store.h"
+
+#define FUZZY_WIDTH 16              // Bytes per packed name. MAX_NAME keeps every name within one vector
+#define FUZZY_NO_MATCH INT_MIN      // Scores themselves can be negative
+
+/*
+ * Bookmark names packed for scoring: each name is lowercased and zero-padded
+ * to a 16-byte row, so comparing it against one query character is a single
+ * vector compare. Rows are in the same order as the store's records.
+ */
+typedef struct {
+    uint8_t (*rows)[FUZZY_WIDTH];
+    uint16_t *boundaries;           // Bit i is set if position i starts a word (e.g. the 'b' in "a-b")
+    size_t count;
+} FuzzyTable;
+
+/*
+ * Packs the names of every bookmark in the store.
+ * Returns 0 on success, 1 on error.
+ * Caller must release the table using fuzzy_free, even on error.
+ */
+int fuzzy_build(FuzzyTable *table, const BookmarkStore *store);
+
+/*
+ * Frees the rows of the table.
+ */
+void fuzzy_free(FuzzyTable *table);
+
+/*
+ * Scores a query against one name as a case-insensitive subsequence match.
+ * Matches at the start of the name, at word boundaries and in consecutive runs
+ * score higher; gaps and unmatched characters score lower.
+ * Returns the score, or FUZZY_NO_MATCH if the query isn't a subsequence of the name.
+ */
+int fuzzy_score(const FuzzyTable *table, size_t row, const char *query);
+
+/*
+ * Finds the best match for a query. Ties are broken by frecency (higher first,
+ * ignored if NULL), then by the shorter name, then by file order.
+ * Returns the index of the matching record, or -1 if nothing matches.
+ */
+long fuzzy_best(const FuzzyTable *table, const char *query, const double *frecency);
+
+#endif
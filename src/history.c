@@ -0,0 +1,566 @@
+#include "history.h"
+
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define HISTORY_LINE_MAX (MAX_LINE + 128)  // Longest line of bookmarks.history: a generation and a journal record
+
+// Numbers the journal records passed by store_scan_journal with the generations they make up
+typedef struct {
+    History *history;
+    size_t *capacity;
+    unsigned long group_left;   // Records of the current MARK group still to come
+    int status;
+} Numbering;
+
+// Helper functions
+static int load(History *history, const char *base_entry, uint64_t last_snapshot, size_t *from_file);
+static void number_record(void *context, BookmarkStore *store, char **fields, int field_count);
+static int append_record(History *history, size_t *capacity, HistoryRecord *record);
+static int start_history(void);
+static int write_history(const History *history, uint64_t after);
+static int write_base(const History *history, uint64_t generation);
+static int read_generation(const char *entry, uint64_t *generation);
+static int read_entry(const char *entry, bool optional, char **contents, size_t *size);
+static FILE *create_temp(const char *entry, char *temp_path);
+static int commit_temp(FILE *file, const char *temp_path, const char *entry);
+static int rename_recorded(BookmarkStore *store, size_t index, const char *new_name);
+static int undelete(BookmarkStore *store, const BookmarkStore *target, const Bookmark *bookmark);
+
+void history_begin(void) {
+    char base_path[MAX_PATH], snapshot_path[MAX_PATH], history_path[MAX_PATH];
+    if (store_entry_path(base_path, sizeof(base_path), HISTORY_BASE_FILE) != 0 ||
+        store_entry_path(snapshot_path, sizeof(snapshot_path), BOOKMARK_FILE) != 0 ||
+        store_entry_path(history_path, sizeof(history_path), HISTORY_FILE) != 0) {
+        return;
+    }
+    if (access(base_path, F_OK) == 0 || access(snapshot_path, F_OK) == -1) return;
+
+    // The snapshot is about to be replaced by rename(), so the link keeps it as it is. If linking
+    // fails, history_archive starts the history from the new snapshot instead
+    unlink(history_path);
+    link(snapshot_path, base_path);
+}
+
+int history_archive(uint64_t generation) {
+    char base_path[MAX_PATH];
+    if (store_entry_path(base_path, sizeof(base_path), HISTORY_BASE_FILE) != 0) return 1;
+
+    // Records from before the history started have nowhere to go: the new snapshot has them anyway
+    if (access(base_path, F_OK) == -1) {
+        if (errno != ENOENT) return 1;
+        start_history();
+        return 0;
+    }
+
+    History history;
+    size_t from_file;
+    int status = load(&history, HISTORY_BASE_FILE, generation - 1, &from_file);
+
+    // Once there are twice as many generations as kept, the oldest are folded into the base,
+    // so it is rewritten once every HISTORY_GENERATIONS changes rather than on every compaction
+    uint64_t cut = history.base;
+    if (status == 0 && history.current - history.base > 2 * HISTORY_GENERATIONS) cut = history.current - HISTORY_GENERATIONS;
+
+    // The history gets the new records before the base moves past them: loads skip what the base already has
+    if (status == 0 && from_file < history.count) status = write_history(&history, history.base);
+    if (status == 0 && cut > history.base) {
+        status = write_base(&history, cut);
+        if (status == 0) status = write_history(&history, cut);
+    }
+
+    history_free(&history);
+    return status;
+}
+
+int history_load(History *history, const BookmarkStore *store) {
+    memset(history, 0, sizeof(*history));
+
+    char base_path[MAX_PATH];
+    if (store_entry_path(base_path, sizeof(base_path), HISTORY_BASE_FILE) != 0) return 1;
+
+    // Until a compaction links bookmarks.base, the history starts at the current snapshot
+    const char *base_entry = access(base_path, F_OK) == 0 ? HISTORY_BASE_FILE : BOOKMARK_FILE;
+    size_t from_file;
+    return load(history, base_entry, store->generation, &from_file);
+}
+
+void history_free(History *history) {
+    free(history->contents);
+    free(history->journal);
+    free(history->records);
+    memset(history, 0, sizeof(*history));
+}
+
+int history_checkout(const History *history, uint64_t generation, BookmarkStore *target) {
+    char *contents;
+    size_t size;
+    if (read_entry(history->base_entry, false, &contents, &size) != 0) {
+        memset(target, 0, sizeof(*target));
+        target->lock_fd = -1;
+        return 1;
+    }
+    if (store_load_buffer(target, contents, size) != 0) return 1;
+
+    bool removed = false;
+    for (size_t i = 0; i < history->count && history->records[i].generation <= generation; i++) {
+        const HistoryRecord *record = &history->records[i];
+        removed |= store_apply_record(target, (char **) record->fields, record->field_count);
+    }
+    if (removed) store_purge_removed(target);
+    return 0;
+}
+
+int history_restore(BookmarkStore *store, const History *history, uint64_t generation, const char *change) {
+    BookmarkStore target;
+    if (history_checkout(history, generation, &target) != 0) {
+        store_free(&target);
+        return 1;
+    }
+
+    // Ids are never reused, so a bookmark is the one with the same id in both stores
+    size_t id_count = (store->next_id > target.next_id ? store->next_id : target.next_id) + 1;
+    uint32_t *in_target = calloc(id_count, sizeof(uint32_t));  // Record index + 1, 0 if absent
+    uint32_t *in_store = calloc(id_count, sizeof(uint32_t));
+    if (!in_target || !in_store) {
+        store_error("Failed to allocate memory for the restore: %s\n", strerror(errno));
+        free(in_target);
+        free(in_store);
+        store_free(&target);
+        return 1;
+    }
+    for (size_t i = 0; i < target.count; i++) {
+        if (target.records[i].id < id_count) in_target[target.records[i].id] = i + 1;
+    }
+    for (size_t i = 0; i < store->count; i++) {
+        if (store->records[i].id < id_count) in_store[store->records[i].id] = i + 1;
+    }
+
+    // Every change is recorded, then applied as a load would replay it, so the store ends up
+    // exactly as replaying the history will rebuild it. Deletions come first and renames go
+    // through temporary names, so no name is ever taken twice along the way.
+    size_t count = store->count;
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; i++) {
+        Bookmark *bookmark = &store->records[i];
+        if (in_target[bookmark->id]) continue;
+        status = store_record(store, JOURNAL_DEL, bookmark_name(store, bookmark), NULL);
+        store_mark_removed(store, bookmark);
+    }
+
+    for (size_t i = 0; i < count && status == 0; i++) {
+        uint32_t match = in_target[store->records[i].id];
+        if (!match || strcmp(bookmark_name(store, &store->records[i]), bookmark_name(&target, &target.records[match - 1])) == 0) continue;
+
+        // A name neither store has, so the rename back is never blocked by it
+        char temporary[MAX_NAME];
+        for (unsigned attempt = 0; ; attempt++) {
+            snprintf(temporary, sizeof(temporary), "~%u.%u", store->records[i].id, attempt);
+            if (!store_find(store, temporary) && !store_find(&target, temporary)) break;
+        }
+        status = rename_recorded(store, i, temporary);
+    }
+
+    for (size_t i = 0; i < count && status == 0; i++) {
+        uint32_t match = in_target[store->records[i].id];
+        const char *name = match ? bookmark_name(&target, &target.records[match - 1]) : NULL;
+        if (name && strcmp(bookmark_name(store, &store->records[i]), name) != 0) status = rename_recorded(store, i, name);
+    }
+
+    for (size_t i = 0; i < target.count && status == 0; i++) {
+        const Bookmark *bookmark = &target.records[i];
+        if (!in_store[bookmark->id]) status = undelete(store, &target, bookmark);
+    }
+
+    for (size_t i = 0; i < count && status == 0; i++) {
+        uint32_t match = in_target[store->records[i].id];
+        if (!match) continue;
+
+        const Bookmark *old = &target.records[match - 1];
+        const char *name = bookmark_name(&target, old);
+        const char *path = bookmark_path(&target, old);
+        const char *tags = bookmark_tags(&target, old);
+        if (strcmp(bookmark_path(store, &store->records[i]), path) != 0 &&
+            (store_record(store, JOURNAL_EDIT, name, path) != 0 || store_set_path(store, &store->records[i], path) != 0)) {
+            status = 1;
+        }
+        if (status == 0 && strcmp(bookmark_tags(store, &store->records[i]), tags) != 0 &&
+            (store_record(store, JOURNAL_TAGS, name, tags) != 0 || store_set_tags(store, &store->records[i], tags) != 0)) {
+            status = 1;
+        }
+    }
+
+    store_purge_removed(store);
+    snprintf(store->change, sizeof(store->change), "%s", change);
+
+    free(in_target);
+    free(in_store);
+    store_free(&target);
+    return status;
+}
+
+size_t history_find(const History *history, uint64_t generation, size_t *count) {
+    // Records are in generation order: find the first one of the generation
+    size_t low = 0, high = history->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (history->records[middle].generation < generation) low = middle + 1;
+        else high = middle;
+    }
+
+    size_t end = low;
+    while (end < history->count && history->records[end].generation == generation) end++;
+    *count = end - low;
+    return end > low ? low : history->count;
+}
+
+bool history_undo_target(const History *history, uint64_t *generation) {
+    if (history->current <= history->base) return false;
+    *generation = history->current - 1;
+
+    // An undo's MARK record names the generation it went back to
+    size_t count;
+    size_t first = history_find(history, history->current, &count);
+    if (first < history->count && history->records[first].op == JOURNAL_MARK && history->records[first].field_count == 4 &&
+        strncmp(history->records[first].fields[3], "undo ", 5) == 0) {
+        uint64_t restored = strtoull(history->records[first].fields[3] + 5, NULL, 10);
+        if (restored <= history->base) return false;
+        *generation = restored - 1;
+    }
+    return true;
+}
+
+// Helper functions
+
+/*
+ * Reads the generation of the base, the records of bookmarks.history after it (unless the
+ * base is still the snapshot itself), then numbers the records of bookmarks.journal that follow,
+ * up to those of the snapshot of generation last_snapshot.
+ * from_file receives how many of the records came from bookmarks.history.
+ * Returns 0 on success, 1 on error.
+ */
+static int load(History *history, const char *base_entry, uint64_t last_snapshot, size_t *from_file) {
+    memset(history, 0, sizeof(*history));
+    history->base_entry = base_entry;
+    *from_file = 0;
+    if (read_generation(base_entry, &history->base) != 0) return 1;
+
+    // A new history holds nothing yet, and starts with the records of the snapshot it was linked from
+    uint64_t first = history->base;
+    size_t capacity = 0, size;
+    if (strcmp(base_entry, HISTORY_BASE_FILE) == 0) {
+        if (read_entry(HISTORY_FILE, true, &history->contents, &size) != 0) return 1;
+
+        char *line = history->contents;
+        char *end = line + size;
+        while (line < end) {
+            char *newline = memchr(line, '\n', end - line);
+            if (!newline) break;
+            *newline = '\0';
+
+            char *journal_record;
+            HistoryRecord record = { .generation = strtoull(line, &journal_record, 10) };
+            if (*journal_record == '\t' && (record.field_count = store_split_record(journal_record + 1, record.fields)) > 0) {
+                // The history has every record of the snapshots up to this one
+                first = strtoull(record.fields[0], NULL, 10) + 1;
+                if (record.generation > history->base && append_record(history, &capacity, &record) != 0) return 1;
+            }
+            line = newline + 1;
+        }
+    }
+    *from_file = history->count;
+    history->current = history->count ? history->records[history->count - 1].generation : history->base;
+
+    if (first <= last_snapshot) {
+        if (read_entry(JOURNAL_FILE, true, &history->journal, &size) != 0) return 1;
+        Numbering numbering = { history, &capacity, 0, 0 };
+        store_scan_journal(history->journal, size, first, last_snapshot, number_record, NULL, &numbering);
+        if (numbering.status != 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Adds a journal record to the history as the next generation, or as part of the current one
+ * if it belongs to a MARK group.
+ */
+static void number_record(void *context, BookmarkStore *store, char **fields, int field_count) {
+    (void) store;
+    Numbering *numbering = context;
+    History *history = numbering->history;
+
+    HistoryRecord record = { .field_count = field_count };
+    memcpy(record.fields, fields, field_count * sizeof(char *));
+    if (numbering->group_left > 0) {
+        numbering->group_left--;
+    }
+    else {
+        history->current++;
+        if (store_record_op(fields) == JOURNAL_MARK && field_count == 4) numbering->group_left = strtoul(fields[2], NULL, 10);
+    }
+    record.generation = history->current;
+
+    if (numbering->status == 0 && append_record(history, numbering->capacity, &record) != 0) numbering->status = 1;
+}
+
+/*
+ * Appends a record to the history, filling in its op and time from its fields.
+ * Returns 0 on success, 1 on error.
+ */
+static int append_record(History *history, size_t *capacity, HistoryRecord *record) {
+    if (history->count == *capacity) {
+        size_t grown_capacity = *capacity ? *capacity * 2 : 256;
+        HistoryRecord *grown = realloc(history->records, grown_capacity * sizeof(HistoryRecord));
+        if (!grown) {
+            store_error("Failed to allocate memory for the history: %s\n", strerror(errno));
+            return 1;
+        }
+        history->records = grown;
+        *capacity = grown_capacity;
+    }
+
+    const char *at = strchr(record->fields[0], '@');
+    record->time = at ? strtoll(at + 1, NULL, 10) : 0;
+    record->op = store_record_op(record->fields);
+    history->records[history->count++] = *record;
+    return 0;
+}
+
+/*
+ * Starts a new history at the current snapshot: links (or, failing that, copies) it as
+ * bookmarks.base, and drops whatever bookmarks.history is left from an older base.
+ * Returns 0 on success, 1 on error.
+ */
+static int start_history(void) {
+    char base_path[MAX_PATH], snapshot_path[MAX_PATH], history_path[MAX_PATH];
+    if (store_entry_path(base_path, sizeof(base_path), HISTORY_BASE_FILE) != 0 ||
+        store_entry_path(snapshot_path, sizeof(snapshot_path), BOOKMARK_FILE) != 0 ||
+        store_entry_path(history_path, sizeof(history_path), HISTORY_FILE) != 0) {
+        return 1;
+    }
+
+    if (unlink(history_path) == -1 && errno != ENOENT) {
+        store_error("Failed to remove %s: %s\n", history_path, strerror(errno));
+        return 1;
+    }
+    if (link(snapshot_path, base_path) == 0) return 0;
+
+    // Some file systems have no hard links
+    char *contents;
+    size_t size;
+    char temp_path[MAX_PATH];
+    if (read_entry(BOOKMARK_FILE, false, &contents, &size) != 0) return 1;
+    FILE *file = create_temp(HISTORY_BASE_FILE, temp_path);
+    if (!file) {
+        free(contents);
+        return 1;
+    }
+    fwrite(contents, 1, size, file);
+    free(contents);
+    return commit_temp(file, temp_path, HISTORY_BASE_FILE);
+}
+
+/*
+ * Replaces bookmarks.history with the records of the generations after the given one.
+ * Returns 0 on success, 1 on error.
+ */
+static int write_history(const History *history, uint64_t after) {
+    char temp_path[MAX_PATH];
+    FILE *file = create_temp(HISTORY_FILE, temp_path);
+    if (!file) return 1;
+
+    char line[HISTORY_LINE_MAX];
+    for (size_t i = 0; i < history->count; i++) {
+        const HistoryRecord *record = &history->records[i];
+        if (record->generation <= after) continue;
+
+        int prefix = snprintf(line, sizeof(line), "%llu\t", (unsigned long long) record->generation);
+        int len = store_join_record((char **) record->fields, record->field_count, line + prefix, sizeof(line) - prefix);
+        if (len >= 0) fwrite(line, 1, prefix + len, file);
+    }
+    return commit_temp(file, temp_path, HISTORY_FILE);
+}
+
+/*
+ * Replaces bookmarks.base with a snapshot of the bookmarks as of the given generation.
+ * Returns 0 on success, 1 on error.
+ */
+static int write_base(const History *history, uint64_t generation) {
+    BookmarkStore target;
+    if (history_checkout(history, generation, &target) != 0) {
+        store_free(&target);
+        return 1;
+    }
+
+    char temp_path[MAX_PATH];
+    FILE *file = create_temp(HISTORY_BASE_FILE, temp_path);
+    int status = 1;
+    if (file) {
+        status = snapshot_write(file, &target, generation);
+        status |= commit_temp(file, temp_path, HISTORY_BASE_FILE);
+    }
+    store_free(&target);
+    return status;
+}
+
+/*
+ * Reads the generation from the header of a snapshot inside ~/.bm/.
+ * Returns 0 on success, 1 on error.
+ */
+static int read_generation(const char *entry, uint64_t *generation) {
+    char path[MAX_PATH];
+    if (store_entry_path(path, sizeof(path), entry) != 0) return 1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        store_error("Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    SnapshotHeader header;
+    ssize_t bytes = read(fd, &header, sizeof(header));
+    close(fd);
+    if (bytes != (ssize_t) sizeof(header) || !snapshot_header_valid(&header)) {
+        store_error("Failed to read %s: not a valid snapshot.\n", path);
+        return 1;
+    }
+
+    *generation = header.generation;
+    return 0;
+}
+
+/*
+ * Reads a whole file inside ~/.bm/ into a malloc'd buffer, null-terminated at contents[size].
+ * An optional file that doesn't exist reads as empty.
+ * Returns 0 on success, 1 on error.
+ */
+static int read_entry(const char *entry, bool optional, char **contents, size_t *size) {
+    *contents = NULL;
+    *size = 0;
+    char path[MAX_PATH];
+    if (store_entry_path(path, sizeof(path), entry) != 0) return 1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 && optional && errno == ENOENT) return 0;
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        store_error("Failed to open %s: %s\n", path, strerror(errno));
+        if (fd != -1) close(fd);
+        return 1;
+    }
+
+    char *buffer = malloc(st.st_size + 1);
+    if (!buffer) {
+        store_error("Failed to allocate memory for %s: %s\n", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    size_t total = 0;
+    while (total < (size_t) st.st_size) {
+        ssize_t bytes = read(fd, buffer + total, st.st_size - total);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes == -1) {
+            store_error("Failed to read %s: %s\n", path, strerror(errno));
+            free(buffer);
+            close(fd);
+            return 1;
+        }
+        if (bytes == 0) break;
+        total += bytes;
+    }
+    close(fd);
+    buffer[total] = '\0';
+
+    *contents = buffer;
+    *size = total;
+    return 0;
+}
+
+/*
+ * Opens <entry>.tmp inside ~/.bm/ for writing, to replace entry with commit_temp.
+ * temp_path receives its path (MAX_PATH bytes).
+ * Returns the file, or NULL on error.
+ */
+static FILE *create_temp(const char *entry, char *temp_path) {
+    char path[MAX_PATH];
+    if (store_entry_path(path, sizeof(path), entry) != 0) return NULL;
+    if (snprintf(temp_path, MAX_PATH, "%s.tmp", path) >= MAX_PATH) return NULL;
+
+    FILE *file = fopen(temp_path, "w");
+    if (!file) store_error("Failed to open %s: %s\n", temp_path, strerror(errno));
+    return file;
+}
+
+/*
+ * Closes a file opened by create_temp once it is on disk, and replaces entry with it.
+ * Returns 0 on success, 1 on error (the temporary file is removed).
+ */
+static int commit_temp(FILE *file, const char *temp_path, const char *entry) {
+    int status = 0;
+    if (ferror(file) || fflush(file) == EOF || fsync(fileno(file)) == -1) {
+        store_error("Failed to write %s: %s\n", temp_path, strerror(errno));
+        status = 1;
+    }
+    if (fclose(file) == EOF && status == 0) {
+        store_error("Failed to close %s: %s\n", temp_path, strerror(errno));
+        status = 1;
+    }
+
+    char path[MAX_PATH];
+    if (status == 0 && store_entry_path(path, sizeof(path), entry) != 0) status = 1;
+    if (status == 0 && rename(temp_path, path) == -1) {
+        store_error("Failed to replace %s: %s\n", path, strerror(errno));
+        status = 1;
+    }
+    if (status != 0) {
+        unlink(temp_path);
+        return 1;
+    }
+
+    // The journal is emptied next, so the rename must be durable first
+    char directory[MAX_PATH];
+    if (store_entry_path(directory, sizeof(directory), "") == 0) {
+        int dir_fd = open(directory, O_RDONLY);
+        if (dir_fd != -1) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Renames the bookmark at index in the store, and records it.
+ * Returns 0 on success, 1 on error.
+ */
+static int rename_recorded(BookmarkStore *store, size_t index, const char *new_name) {
+    if (store_record(store, JOURNAL_REN, bookmark_name(store, &store->records[index]), new_name) != 0) return 1;
+    return store_rename(store, &store->records[index], new_name);
+}
+
+/*
+ * Adds a bookmark of target back to the store under its old id, with its tags, and records it.
+ * Returns 0 on success, 1 on error.
+ */
+static int undelete(BookmarkStore *store, const BookmarkStore *target, const Bookmark *bookmark) {
+    const char *name = bookmark_name(target, bookmark);
+    const char *path = bookmark_path(target, bookmark);
+    const char *tags = bookmark_tags(target, bookmark);
+
+    char id_path[MAX_PATH + 16];
+    snprintf(id_path, sizeof(id_path), "%u\t%s", bookmark->id, path);
+    uint32_t next_id = store->next_id;
+    if (store_record(store, JOURNAL_UNDEL, name, id_path) != 0 || store_add(store, name, path) != 0) return 1;
+    store->records[store->count - 1].id = bookmark->id;
+    store->next_id = next_id;
+
+    if (tags[0] == '\0') return 0;
+    if (store_record(store, JOURNAL_TAGS, name, tags) != 0) return 1;
+    return store_set_tags(store, &store->records[store->count - 1], tags);
+}
@@ -0,0 +1,103 @@
+#ifndef HISTORY_H
+
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "store.h"
+
+#define HISTORY_FILE "bookmarks.history"
+#define HISTORY_BASE_FILE "bookmarks.base"
+#define HISTORY_GENERATIONS 1000    // Generations kept; once there are twice as many, the oldest are folded into the base
+
+/*
+ * Every change to a store is a generation: one journal record, or a MARK group of them
+ * (see store.h). The history keeps them on top of an immutable snapshot:
+ *   bookmarks.base      The store as of the oldest generation kept, in the bookmarks.snap
+ *                       format, with that generation in its header
+ *   bookmarks.history   The journal records of every later generation, in order, one per line:
+ *                       <generation><TAB><journal record>
+ * followed by the records still in bookmarks.journal. A generation is rebuilt by replaying
+ * records onto the base, so generations share everything but their own records. Recording one
+ * costs no more than the journal append every mutation makes anyway: records only move to
+ * bookmarks.history when a compaction empties the journal, off the path of the command.
+ * The base starts out as a hard link to the snapshot it copies, so starting the history copies nothing.
+ */
+typedef struct {
+    uint64_t generation;
+    int64_t time;               // Unix time of the change, 0 for records written before times were
+    int op;                     // JournalOp, or -1 for an op this version doesn't know
+    char *fields[4];            // The record, split by store_split_record
+    int field_count;
+} HistoryRecord;
+
+typedef struct {
+    char *contents;             // bookmarks.history, split in place
+    char *journal;              // bookmarks.journal, split in place
+    HistoryRecord *records;     // Generations after the base, oldest first
+    size_t count;
+    const char *base_entry;     // bookmarks.base, or bookmarks.snap until the first compaction links it
+    uint64_t base;              // Generation of the base
+    uint64_t current;           // Newest generation: the store as it is
+} History;
+
+/*
+ * Starts the history of a store that has none from its current snapshot, by linking it as
+ * bookmarks.base. Called by store_save under the writer lock, before the snapshot is replaced.
+ */
+void history_begin(void);
+
+/*
+ * Moves the journal records that the snapshot of the given generation just folded in to
+ * bookmarks.history, and folds the oldest generations into the base once there are too many.
+ * Starts the history from that snapshot if history_begin couldn't.
+ * Called by store_save under the writer lock, after the new snapshot has replaced the old one.
+ * Returns 0 on success (the journal can be emptied), 1 on error.
+ */
+int history_archive(uint64_t generation);
+
+/*
+ * Reads the history of a store loaded with store_load_for_update.
+ * Returns 0 on success, 1 if there is no history yet (which is reported) or on error.
+ * Caller must release the history using history_free, even on error.
+ */
+int history_load(History *history, const BookmarkStore *store);
+
+/*
+ * Frees a history.
+ */
+void history_free(History *history);
+
+/*
+ * Rebuilds the bookmarks as of a generation (from history->base to history->current) in a new store.
+ * Returns 0 on success, 1 on error.
+ * Caller must release the store using store_free, even on error.
+ */
+int history_checkout(const History *history, uint64_t generation, BookmarkStore *target);
+
+/*
+ * Turns the store (loaded with store_load_for_update) into the bookmarks of an earlier generation,
+ * recording the differences with store_record as one change named change, so that the restore is
+ * a new generation that can be undone in turn. Ids come back with the bookmarks, and with them
+ * their visit counts. The caller saves the store with store_save.
+ * Returns 0 on success, 1 on error.
+ */
+int history_restore(BookmarkStore *store, const History *history, uint64_t generation, const char *change);
+
+/*
+ * Finds the records of a generation.
+ * Returns the index of its first record (count receives how many there are), or history->count if it has none.
+ */
+size_t history_find(const History *history, uint64_t generation, size_t *count);
+
+/*
+ * Picks the generation 'bm undo' goes back to: the one before the current generation, or, if
+ * the current generation is itself an undo, the one before the generation it went back to,
+ * so that repeated undos keep walking back.
+ * Returns true if there is one, false if the history doesn't go back that far.
+ */
+bool history_undo_target(const History *history, uint64_t *generation);
+
+#endif
@@ -0,0 +1,374 @@
+#include "index.h"
+#include "tags.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// A bookmark and the slot it landed in, while sorting by name and by path
+typedef struct {
+    const char *name;
+    const char *path;
+    uint32_t slot;
+} SortedName;
+
+// Helper functions
+static int compare_names(const void *a, const void *b);
+static int compare_paths(const void *a, const void *b);
+static const IndexSlot *find_path(const BookmarkIndex *index, const char *path, size_t len);
+static size_t tags_start(const IndexHeader *header);
+static const IndexSlot *slot_at(const BookmarkIndex *index, uint32_t position);
+
+int index_open(BookmarkIndex *index, const char *index_path, const StoreVersion *source, uint64_t layers) {
+    memset(index, 0, sizeof(*index));
+
+    int fd = open(index_path, O_RDONLY);
+    if (fd == -1) return 1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+
+    // Only what costs O(1) is checked here: fewer entries than slots, sizes that add up, and a string
+    // area that ends with '\0'. Offsets are checked as they are followed (see slot_at), and probes are bounded
+    const IndexHeader *header = map;
+    size_t tags_size = (size_t) header->tag_count * sizeof(IndexTag) + (size_t) header->tag_words * sizeof(uint64_t);
+    size_t strings_start = sizeof(IndexHeader) + (size_t) header->slot_count * sizeof(IndexSlot) +
+                           (size_t) header->entry_count * sizeof(uint32_t) * 2;
+    if (header->magic != INDEX_MAGIC ||
+        header->version != INDEX_VERSION ||
+        header->slot_count == 0 ||
+        (header->slot_count & (header->slot_count - 1)) != 0 ||
+        header->entry_count >= header->slot_count ||
+        header->strings_size > (uint64_t) st.st_size ||
+        tags_start(header) + tags_size != (size_t) st.st_size ||
+        (header->strings_size == 0 ? header->entry_count + header->tag_count != 0 :
+                                     ((const char *) map)[strings_start + header->strings_size - 1] != '\0') ||
+        !store_version_equal(&header->source, source) ||
+        header->layers != layers) {
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    index->map = map;
+    index->map_size = st.st_size;
+    index->header = header;
+    index->slots = (const IndexSlot *) (header + 1);
+    index->sorted = (const uint32_t *) (index->slots + header->slot_count);
+    index->by_path = index->sorted + header->entry_count;
+    index->strings = (const char *) (index->by_path + header->entry_count);
+    index->tags = (const IndexTag *) ((const char *) map + tags_start(header));
+    index->tag_words = (const uint64_t *) (index->tags + header->tag_count);
+    return 0;
+}
+
+const char *index_find(const BookmarkIndex *index, const char *name, uint32_t *id) {
+    size_t len;
+    uint32_t hash = bookmark_hash(name, &len);
+    uint32_t mask = index->header->slot_count - 1;
+
+    // A corrupt index may have no empty slot, so probe each slot at most once. A slot that points
+    // outside the string area reads as a miss, which falls back to loading the store
+    uint32_t i = hash & mask;
+    for (uint32_t probes = 0; probes <= mask; probes++, i = (i + 1) & mask) {
+        const IndexSlot *slot = &index->slots[i];
+        if (slot->hash == 0) return NULL;
+        if (slot->hash == hash && slot->name_len == len && slot_at(index, i) &&
+            strncasecmp(index->strings + slot->name_offset, name, len) == 0) {
+            if (id) *id = slot->id;
+            return index->strings + slot->path_offset;
+        }
+    }
+    return NULL;
+}
+
+size_t index_prefix_range(const BookmarkIndex *index, const char *prefix, size_t *first) {
+    // Lower bound: the first name that doesn't sort before the prefix
+    size_t low = 0, high = index->header->entry_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (strcasecmp(index_sorted_name(index, middle), prefix) < 0) low = middle + 1;
+        else high = middle;
+    }
+    *first = low;
+
+    size_t len = strlen(prefix);
+    size_t end = low;
+    while (end < index->header->entry_count && strncasecmp(index_sorted_name(index, end), prefix, len) == 0) end++;
+    return end - low;
+}
+
+const char *index_sorted_name(const BookmarkIndex *index, size_t position) {
+    const IndexSlot *slot = slot_at(index, index->sorted[position]);
+    return slot ? index->strings + slot->name_offset : "";
+}
+
+const char *index_find_by_path(const BookmarkIndex *index, const char *path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') len--;
+    if (len == 0 || path[0] != '/') return NULL;
+
+    for (;;) {
+        const IndexSlot *slot = find_path(index, path, len);
+        if (slot) return index->strings + slot->name_offset;
+        if (len == 1) return NULL;
+
+        // Drop the last component, and the slash before it unless that's the root
+        while (path[len - 1] != '/') len--;
+        if (len > 1) len--;
+    }
+}
+
+bool index_tag_lookup(const void *source, const char *tag, uint64_t *words, size_t word_count) {
+    const BookmarkIndex *index = source;
+    size_t low = 0, high = index->header->tag_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const IndexTag *entry = &index->tags[middle];
+        if (entry->name_offset >= index->header->strings_size) return false;
+        int order = strcmp(index->strings + entry->name_offset, tag);
+        if (order == 0) {
+            if (entry->words_offset + (size_t) entry->words_size > index->header->tag_words) return false;
+            return bitmap_expand(index->tag_words + entry->words_offset, entry->words_size, words, word_count);
+        }
+        if (order < 0) low = middle + 1;
+        else high = middle;
+    }
+    return false;
+}
+
+void index_close(BookmarkIndex *index) {
+    if (index->map) munmap(index->map, index->map_size);
+    memset(index, 0, sizeof(*index));
+}
+
+int index_build(const char *index_path, const StoreVersion *source, uint64_t layers, const BookmarkStore *store) {
+    TagTable table;
+    if (tag_table_build(&table, store) != 0) {
+        tag_table_free(&table);
+        return 1;
+    }
+
+    uint32_t entry_count = store->count;
+    uint64_t strings_size = 0;
+    for (size_t i = 0; i < store->count; i++) {
+        strings_size += store->records[i].name_len + store->records[i].path_len + 2;
+    }
+    uint64_t bookmark_strings = strings_size;
+    for (size_t i = 0; i < table.count; i++) {
+        strings_size += strlen(table.tags[i].name) + 1;
+    }
+
+    // Keep the load factor at or below 0.5 so misses terminate after a probe or two
+    uint32_t slot_count = 16;
+    while (slot_count < entry_count * 2) slot_count <<= 1;
+
+    IndexSlot *slots = calloc(slot_count, sizeof(IndexSlot));
+    char *strings = malloc(strings_size ? strings_size : 1);
+    SortedName *names = malloc((entry_count ? entry_count : 1) * sizeof(SortedName));
+    uint32_t *sorted = malloc((entry_count ? entry_count : 1) * sizeof(uint32_t) * 2);
+    IndexTag *tags = malloc((table.count ? table.count : 1) * sizeof(IndexTag));
+    if (!slots || !strings || !names || !sorted || !tags) {
+        store_error("Failed to allocate memory for the index: %s\n", strerror(errno));
+        free(slots);
+        free(strings);
+        free(names);
+        free(sorted);
+        free(tags);
+        tag_table_free(&table);
+        return 1;
+    }
+
+    uint32_t mask = slot_count - 1;
+    uint64_t offset = 0;
+    for (size_t n = 0; n < store->count; n++) {
+        const Bookmark *bookmark = &store->records[n];
+        size_t name_len, path_len = bookmark->path_len;
+        uint32_t hash = bookmark_hash(bookmark_name(store, bookmark), &name_len);
+
+        uint32_t i = hash & mask;
+        while (slots[i].hash != 0) i = (i + 1) & mask;
+
+        slots[i].hash = hash;
+        slots[i].id = bookmark->id;
+        slots[i].name_offset = offset;
+        slots[i].name_len = name_len;
+        memcpy(strings + offset, bookmark_name(store, bookmark), name_len + 1);
+        offset += name_len + 1;
+
+        slots[i].path_offset = offset;
+        slots[i].path_len = path_len;
+        memcpy(strings + offset, bookmark_path(store, bookmark), path_len + 1);
+        offset += path_len + 1;
+
+        names[n].name = bookmark_name(store, bookmark);
+        names[n].path = bookmark_path(store, bookmark);
+        names[n].slot = i;
+    }
+
+    qsort(names, entry_count, sizeof(SortedName), compare_names);
+    for (size_t n = 0; n < entry_count; n++) {
+        sorted[n] = names[n].slot;
+    }
+
+    uint32_t *by_path = sorted + entry_count;
+    qsort(names, entry_count, sizeof(SortedName), compare_paths);
+    for (size_t n = 0; n < entry_count; n++) {
+        by_path[n] = names[n].slot;
+    }
+    free(names);
+
+    // The table is sorted by name already, the order index_tag_lookup searches in, and its bitmaps
+    // are compressed already, in the layout of the file
+    offset = bookmark_strings;
+    for (size_t i = 0; i < table.count; i++) {
+        size_t name_len = strlen(table.tags[i].name);
+        tags[i].name_offset = offset;
+        tags[i].name_len = name_len;
+        memcpy(strings + offset, table.tags[i].name, name_len + 1);
+        offset += name_len + 1;
+
+        tags[i].words_offset = table.tags[i].words_offset;
+        tags[i].words_size = table.tags[i].words_size;
+    }
+    uint32_t tag_count = table.count;
+    uint32_t words_size = table.words_size;
+
+    IndexHeader header = {
+        .magic = INDEX_MAGIC,
+        .version = INDEX_VERSION,
+        .source = *source,
+        .layers = layers,
+        .slot_count = slot_count,
+        .entry_count = entry_count,
+        .strings_size = strings_size,
+        .tag_count = tag_count,
+        .tag_words = words_size,
+    };
+    static const char padding[8];
+    size_t padding_size = tags_start(&header) - (sizeof(IndexHeader) + (size_t) slot_count * sizeof(IndexSlot) +
+                                                 (size_t) entry_count * sizeof(uint32_t) * 2 + strings_size);
+
+    // Concurrent 'bm go' calls may rebuild the index at the same time, so each writes its own temp file
+    char *temp_path = malloc(strlen(index_path) + 32);
+    if (!temp_path) {
+        store_error("Failed to allocate memory for temp_path: %s\n", strerror(errno));
+        free(slots);
+        free(sorted);
+        free(strings);
+        free(tags);
+        tag_table_free(&table);
+        return 1;
+    }
+    sprintf(temp_path, "%s.%ld.tmp", index_path, (long) getpid());
+
+    int status = 1;
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        store_error("Failed to open %s: %s\n", temp_path, strerror(errno));
+    }
+    else if (write_all(fd, &header, sizeof(header)) != 0 ||
+             write_all(fd, slots, (size_t) slot_count * sizeof(IndexSlot)) != 0 ||
+             write_all(fd, sorted, (size_t) entry_count * sizeof(uint32_t) * 2) != 0 ||
+             write_all(fd, strings, strings_size) != 0 ||
+             write_all(fd, padding, padding_size) != 0 ||
+             write_all(fd, tags, (size_t) tag_count * sizeof(IndexTag)) != 0 ||
+             write_all(fd, table.words, (size_t) words_size * sizeof(uint64_t)) != 0) {
+        store_error("Failed to write %s: %s\n", temp_path, strerror(errno));
+        close(fd);
+        unlink(temp_path);
+    }
+    else if (close(fd) == -1 || rename(temp_path, index_path) == -1) {
+        store_error("Failed to replace %s: %s\n", index_path, strerror(errno));
+        unlink(temp_path);
+    }
+    else {
+        status = 0;
+    }
+
+    free(temp_path);
+    free(slots);
+    free(sorted);
+    free(strings);
+    free(tags);
+    tag_table_free(&table);
+    return status;
+}
+
+// Helper functions
+
+/*
+ * Orders names case-insensitively, the order index_prefix_range searches in.
+ */
+static int compare_names(const void *a, const void *b) {
+    return strcasecmp(((const SortedName *) a)->name, ((const SortedName *) b)->name);
+}
+
+/*
+ * Orders bookmarks by path in byte order, the order find_path searches in.
+ * Equal paths are ordered by name, so the result doesn't depend on qsort's stability.
+ */
+static int compare_paths(const void *a, const void *b) {
+    const SortedName *first = a, *second = b;
+    int order = strcmp(first->path, second->path);
+    return order != 0 ? order : strcasecmp(first->name, second->name);
+}
+
+/*
+ * Binary search over by_path for the first bookmark whose path is exactly path[0, len).
+ * Returns its slot, or NULL if no bookmark has that path.
+ */
+static const IndexSlot *find_path(const BookmarkIndex *index, const char *path, size_t len) {
+    size_t low = 0, high = index->header->entry_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const IndexSlot *slot = slot_at(index, index->by_path[middle]);
+        if (!slot) return NULL;
+        size_t shorter = slot->path_len < len ? slot->path_len : len;
+        int order = memcmp(index->strings + slot->path_offset, path, shorter);
+        if (order < 0 || (order == 0 && slot->path_len < len)) low = middle + 1;
+        else high = middle;
+    }
+    if (low == index->header->entry_count) return NULL;
+
+    const IndexSlot *slot = slot_at(index, index->by_path[low]);
+    if (!slot || slot->path_len != len || memcmp(index->strings + slot->path_offset, path, len) != 0) return NULL;
+    return slot;
+}
+
+/*
+ * Returns the file offset of the tag section: after the string area, aligned for the bitmap words.
+ */
+/*
+ * Returns the slot at a position if the position and the slot's name and path lie inside the index.
+ * Since the string area ends with '\0' (checked by index_open), both strings are then terminated.
+ * Returns NULL for a corrupt slot.
+ */
+static const IndexSlot *slot_at(const BookmarkIndex *index, uint32_t position) {
+    if (position >= index->header->slot_count) return NULL;
+    const IndexSlot *slot = &index->slots[position];
+    uint64_t strings_size = index->header->strings_size;
+    if ((uint64_t) slot->name_offset + slot->name_len >= strings_size ||
+        (uint64_t) slot->path_offset + slot->path_len >= strings_size) {
+        return NULL;
+    }
+    return slot;
+}
+
+static size_t tags_start(const IndexHeader *header) {
+    size_t end = sizeof(IndexHeader) + (size_t) header->slot_count * sizeof(IndexSlot) +
+                 (size_t) header->entry_count * sizeof(uint32_t) * 2 + header->strings_size;
+    return (end + 7) & ~(size_t) 7;
+}
@@ -0,0 +1,130 @@
+#ifndef INDEX_H
+
+#define INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "store.h"
+
+#define INDEX_FILE "bookmarks.idx"
+
+#define INDEX_MAGIC 0x31584449u  // "IDX1" in little-endian byte order
+#define INDEX_VERSION 7
+
+/*
+ * On-disk layout of bookmarks.idx:
+ *   IndexHeader | IndexSlot[slot_count] | uint32_t sorted[entry_count] |
+ *   uint32_t by_path[entry_count] | string area | padding to 8 bytes |
+ *   IndexTag[tag_count] | uint64_t tag_words[tag_words]
+ *
+ * The slots form an open-addressing hash table (linear probing) keyed on the
+ * case-folded bookmark name. The sorted array lists the used slots in case-folded
+ * name order, so names with a common prefix are found with a binary search.
+ * The by_path array lists them in byte order of their paths, so the bookmark of a
+ * directory (or of its nearest bookmarked ancestor) is found with one binary search
+ * per path component.
+ * The string area holds "name\0path\0" pairs that the slots point into, then the tag names.
+ * Each tag has a compressed bitmap (see tags.h) with one bit per bookmark, by position in the
+ * store the index was built from, so tag queries never touch the bookmarks' tag lists.
+ * The header records the version of the snapshot and bookmarks.journal the
+ * index was built from, so a stale index can be detected with a couple of stat() calls.
+ * A merged index of several layers (see layers.h) also records a digest of every layer's version.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    StoreVersion source;
+    uint64_t layers;            // Digest of the merged layers' versions, 0 for the user store alone
+    uint32_t slot_count;        // Always a power of two
+    uint32_t entry_count;
+    uint64_t strings_size;
+    uint32_t tag_count;
+    uint32_t tag_words;         // Compressed bitmap words of all the tags together
+} IndexHeader;
+
+typedef struct {
+    uint32_t hash;              // 0 marks an empty slot
+    uint32_t name_offset;       // Offset into the string area
+    uint32_t path_offset;
+    uint32_t id;                // Stable bookmark id
+    uint16_t name_len;
+    uint16_t path_len;
+} IndexSlot;
+
+typedef struct {
+    uint32_t name_offset;       // Offset into the string area; tags are sorted by name
+    uint32_t name_len;
+    uint32_t words_offset;      // Offset into tag_words
+    uint32_t words_size;
+} IndexTag;
+
+typedef struct {
+    void *map;
+    size_t map_size;
+    const IndexHeader *header;
+    const IndexSlot *slots;
+    const uint32_t *sorted;
+    const uint32_t *by_path;
+    const char *strings;
+    const IndexTag *tags;
+    const uint64_t *tag_words;
+} BookmarkIndex;
+
+/*
+ * Maps the index at index_path and checks it against the current version of the store
+ * and, for a merged index, of the other layers.
+ * Returns 0 on success, 1 if the index is missing, corrupt or stale.
+ * On success the caller must release the mapping with index_close.
+ */
+int index_open(BookmarkIndex *index, const char *index_path, const StoreVersion *source, uint64_t layers);
+
+/*
+ * Looks up a bookmark by name (case-insensitive) without allocating.
+ * If id is not NULL, it receives the bookmark's id.
+ * Returns a pointer to the null-terminated path inside the mapping, or NULL if not found.
+ */
+const char *index_find(const BookmarkIndex *index, const char *name, uint32_t *id);
+
+/*
+ * Finds the names starting with prefix (case-insensitive) with a binary search.
+ * Matches are contiguous in sorted order: first receives the position of the first one.
+ * Returns the number of matches.
+ */
+size_t index_prefix_range(const BookmarkIndex *index, const char *prefix, size_t *first);
+
+/*
+ * Returns the name at a position in case-folded sorted order.
+ */
+const char *index_sorted_name(const BookmarkIndex *index, size_t position);
+
+/*
+ * Finds the bookmark whose path is the longest prefix of path, on a component boundary:
+ * path itself, else its parent, and so on up to "/". path must be absolute; trailing
+ * slashes are ignored. When several bookmarks share that path, the first name in
+ * case-folded order wins. Doesn't allocate.
+ * Returns a pointer to the null-terminated name inside the mapping, or NULL if no bookmark contains path.
+ */
+const char *index_find_by_path(const BookmarkIndex *index, const char *path);
+
+/*
+ * A TagLookup (see tags.h) over the index: expands the bitmap of a tag, whose bits are
+ * the positions of the bookmarks in the store the index was built from.
+ */
+bool index_tag_lookup(const void *index, const char *tag, uint64_t *words, size_t word_count);
+
+/*
+ * Unmaps an index opened with index_open.
+ */
+void index_close(BookmarkIndex *index);
+
+/*
+ * Writes a fresh index for the bookmarks in the store, tagged with the version
+ * of the files it was loaded from and the digest of the layers merged into it (or 0).
+ * The file is written to a temporary path and renamed into place so readers never see a partial index.
+ * Returns 0 on success, 1 on error.
+ */
+int index_build(const char *index_path, const StoreVersion *source, uint64_t layers, const BookmarkStore *store);
+
+#endif
@@ -0,0 +1,575 @@
+#include "interop.h"
+#include "output.h"
+#include "store.h"
+#include "tags.h"
+#include "usage.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *format_names[] = {
+    [INTEROP_TSV] = "tsv",
+    [INTEROP_AUTOJUMP] = "autojump",
+    [INTEROP_Z] = "z",
+    [INTEROP_FASD] = "fasd",
+    [INTEROP_ZOXIDE] = "zoxide",
+    [INTEROP_CDPATH] = "cdpath",
+};
+
+// Reads an import one line at a time through a fixed-size buffer
+typedef struct {
+    int fd;
+    size_t start;               // Unparsed bytes are buffer[start, end)
+    size_t end;
+    bool eof;
+    bool discarding;            // Skipping the rest of a line too long for the buffer
+    char buffer[INTEROP_BUFFER + 1];    // One spare byte to terminate a last line without a newline
+} LineReader;
+
+// One directory read from an import. The strings point into the reader's buffer
+typedef struct {
+    char *name;                 // NULL to name the bookmark after the directory
+    char *path;
+    char *tags;                 // Comma-separated, NULL if none
+    double visits;              // 0 if the source has no weight
+    int64_t last_visit;         // 0 if the source has no time
+} ImportEntry;
+
+// Record index + 1 of every bookmark by path, to find the directories that are already bookmarked
+typedef struct {
+    uint32_t *slots;
+    size_t slot_count;
+    size_t used;
+} PathSet;
+
+// Helper functions
+static int read_line(LineReader *reader, char **line);
+static bool parse_entry(InteropFormat format, char *line, ImportEntry *entry);
+static bool parse_tsv_entry(char *line, ImportEntry *entry);
+static int import_entry(BookmarkStore *store, PathSet *paths, UsageMap *usage, const ImportEntry *entry);
+static bool normalize_path(const char *path, char *normalized);
+static void make_name(const BookmarkStore *store, const char *source, uint32_t id, char *name);
+static size_t copy_name(char *name, const char *source, size_t limit);
+static int normalize_tags(const char *source, char *tags);
+static int path_set_insert(PathSet *paths, const BookmarkStore *store, size_t record);
+static bool path_set_contains(const PathSet *paths, const BookmarkStore *store, const char *path);
+static uint32_t path_hash(const char *path);
+static void export_entry(OutputBuffer *out, InteropFormat format, const StreamedBookmark *row, const UsageMap *usage, time_t now);
+
+int interop_parse_format(const char *name, InteropFormat *format) {
+    for (size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+        if (strcmp(name, format_names[i]) == 0) {
+            *format = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int interop_import(InteropFormat format, int fd) {
+    BookmarkStore store;
+    if (store_load_for_update(&store, NULL) != 0) {
+        store_free(&store);
+        return 1;
+    }
+
+    PathSet paths = { NULL, 0, 0 };
+    for (size_t i = 0; i < store.count; i++) {
+        if (path_set_insert(&paths, &store, i) != 0) {
+            free(paths.slots);
+            store_free(&store);
+            return 1;
+        }
+    }
+
+    LineReader *reader = malloc(sizeof(LineReader));
+    if (!reader) {
+        fprintf(stderr, "Failed to allocate memory for the import: %s\n", strerror(errno));
+        free(paths.slots);
+        store_free(&store);
+        return 1;
+    }
+    reader->fd = fd;
+    reader->start = reader->end = 0;
+    reader->eof = reader->discarding = false;
+
+    UsageMap usage = { 0 };
+    uint32_t first_id = store.next_id;
+    size_t imported = 0, duplicates = 0, invalid = 0, line_number = 0;
+    int status = 0;
+    char *line;
+    int read_status;
+    while ((read_status = read_line(reader, &line)) == 1) {
+        line_number++;
+        if (format == INTEROP_TSV && line_number == 1 && strncmp(line, "Bookmark Name\t", 14) == 0) continue;
+        if (line[0] == '\0') continue;
+
+        // A CDPATH line holds several directories; every other format has one per line
+        char *rest = line;
+        do {
+            char *entry_text = rest;
+            if (format == INTEROP_CDPATH) {
+                rest = strchr(rest, ':');
+                if (rest) *rest++ = '\0';
+                if (entry_text[0] == '\0' || strcmp(entry_text, ".") == 0) continue;
+            }
+            else {
+                rest = NULL;
+            }
+
+            ImportEntry entry;
+            if (!parse_entry(format, entry_text, &entry)) {
+                invalid++;
+                continue;
+            }
+
+            int result = import_entry(&store, &paths, &usage, &entry);
+            if (result < 0) status = 1;
+            else if (result == 0) imported++;
+            else if (result == 1) duplicates++;
+            else invalid++;
+        } while (rest && status == 0);
+
+        if (status != 0) break;
+    }
+    if (read_status < 0) {
+        fprintf(stderr, "Failed to read the import: %s\n", strerror(errno));
+        status = 1;
+    }
+    free(reader);
+    free(paths.slots);
+
+    // Everything lands together in one snapshot, behind a single journal append of one change
+    snprintf(store.change, sizeof(store.change), "import");
+    if (status == 0 && imported > 0 && store_save(&store) != 0) status = 1;
+
+    // The ids of the bookmarks that weren't saved will be handed out again: drop their visits
+    if (status != 0 && usage.map) {
+        for (uint32_t id = first_id; id < store.next_id && id < usage.count; id++) usage_reset(&usage, id);
+    }
+    usage_close(&usage);
+    store_free(&store);
+
+    if (status != 0) {
+        printf("Error: Failed to import the bookmarks. No changes were applied.\n");
+        return 1;
+    }
+    printf("Imported %zu bookmark%s: %zu already bookmarked, %zu invalid entr%s skipped.\n",
+           imported, imported == 1 ? "" : "s", duplicates, invalid, invalid == 1 ? "y" : "ies");
+    return 0;
+}
+
+int interop_export(InteropFormat format, int fd) {
+    UsageMap usage;
+    if (usage_open(&usage) != 0) usage_close(&usage);   // Export without the visit counts
+    time_t now = time(NULL);
+
+    OutputBuffer *out = malloc(sizeof(OutputBuffer));
+    StoreStream *stream = malloc(sizeof(StoreStream));
+    if (!out || !stream) {
+        fprintf(stderr, "Failed to allocate memory for the export: %s\n", strerror(errno));
+        free(out);
+        free(stream);
+        usage_close(&usage);
+        return 1;
+    }
+    output_init(out, fd);
+
+    // Generation 0 keeps the journal of the current store from being replayed onto a restored copy
+    char header[64];
+    int status = 0;
+    if (store_stream_open(stream) == 0) {
+        if (format == INTEROP_TSV) {
+            snprintf(header, sizeof(header), "Bookmark Name\tDirectory Path\t0\t%u\n", stream->next_id);
+            output_string(out, header);
+        }
+
+        StreamedBookmark row;
+        int read_status;
+        while ((read_status = store_stream_next(stream, &row)) == 1) export_entry(out, format, &row, &usage, now);
+        if (read_status < 0) {
+            fprintf(stderr, "Failed to read the bookmarks: %s\n", strerror(errno));
+            status = 1;
+        }
+        store_stream_close(stream);
+    }
+    else {
+        BookmarkStore store;
+        if (store_load(&store, NULL) != 0) {
+            status = 1;
+        }
+        else {
+            if (format == INTEROP_TSV) {
+                snprintf(header, sizeof(header), "Bookmark Name\tDirectory Path\t0\t%u\n", store.next_id);
+                output_string(out, header);
+            }
+
+            for (size_t i = 0; i < store.count; i++) {
+                const Bookmark *bookmark = &store.records[i];
+                StreamedBookmark row = {
+                    bookmark_name(&store, bookmark), bookmark_path(&store, bookmark), bookmark_tags(&store, bookmark),
+                    bookmark->id, bookmark->name_len, bookmark->path_len, bookmark->tags_len,
+                };
+                export_entry(out, format, &row, &usage, now);
+            }
+        }
+        store_free(&store);
+    }
+
+    if (output_flush(out) != 0) status = 1;
+    free(out);
+    free(stream);
+    usage_close(&usage);
+    return status;
+}
+
+// Helper functions
+
+/*
+ * Reads the next line, null-terminated in place without its "\n" or "\r\n".
+ * Lines that don't fit in the buffer are skipped.
+ * Returns 1 if a line was read, 0 at the end of the input, -1 on a read error.
+ */
+static int read_line(LineReader *reader, char **line) {
+    for (;;) {
+        char *start = reader->buffer + reader->start;
+        char *newline = memchr(start, '\n', reader->end - reader->start);
+        if (newline && reader->discarding) {
+            reader->discarding = false;
+            reader->start = newline + 1 - reader->buffer;
+            continue;
+        }
+        if (newline || (reader->eof && reader->start < reader->end && !reader->discarding)) {
+            char *line_end = newline ? newline : reader->buffer + reader->end;
+            reader->start = newline ? (size_t) (newline + 1 - reader->buffer) : reader->end;
+            if (line_end > start && line_end[-1] == '\r') line_end--;
+            *line_end = '\0';
+            *line = start;
+            return 1;
+        }
+        if (reader->eof) return 0;
+
+        // Keep the partial line, then read behind it
+        if (reader->start == 0 && reader->end == INTEROP_BUFFER) {
+            reader->end = 0;    // A line longer than the buffer can't hold a valid path: drop it
+            reader->discarding = true;
+        }
+        memmove(reader->buffer, start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+
+        ssize_t bytes = read(reader->fd, reader->buffer + reader->end, INTEROP_BUFFER - reader->end);
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (bytes == 0) reader->eof = true;
+        reader->end += bytes;
+    }
+}
+
+/*
+ * Splits one line of an import in place.
+ * Returns true if it holds a directory, false if it is malformed.
+ */
+static bool parse_entry(InteropFormat format, char *line, ImportEntry *entry) {
+    entry->name = NULL;
+    entry->tags = NULL;
+    entry->visits = 0;
+    entry->last_visit = 0;
+
+    char *end;
+    switch (format) {
+        case INTEROP_TSV:
+            return parse_tsv_entry(line, entry);
+
+        case INTEROP_AUTOJUMP: {
+            char *tab = strchr(line, '\t');
+            if (!tab) return false;
+            *tab = '\0';
+            entry->visits = strtod(line, &end);
+            entry->path = tab + 1;
+            return end != line && *end == '\0';
+        }
+
+        case INTEROP_Z:
+        case INTEROP_FASD: {
+            // Paths may contain '|', so the rank and the time are taken from the right
+            char *time_bar = strrchr(line, '|');
+            if (!time_bar) return false;
+            *time_bar = '\0';
+            char *rank_bar = strrchr(line, '|');
+            if (!rank_bar) return false;
+            *rank_bar = '\0';
+            entry->visits = strtod(rank_bar + 1, &end);
+            if (end == rank_bar + 1 || *end != '\0') return false;
+            entry->last_visit = strtoll(time_bar + 1, &end, 10);
+            if (end == time_bar + 1 || *end != '\0') return false;
+            entry->path = line;
+            return true;
+        }
+
+        case INTEROP_ZOXIDE: {
+            char *start = line;
+            while (*start == ' ') start++;
+            entry->visits = strtod(start, &end);
+            if (end == start || *end != ' ') return false;
+            entry->path = end + 1;
+            return true;
+        }
+
+        case INTEROP_CDPATH:
+            entry->path = line;
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Splits a line of bm's text format ("name<spaces>\tpath[\tid[\t#tags]]") in place.
+ * The id is dropped: imported bookmarks get new ones.
+ * Returns true if it holds a bookmark, false if it is malformed.
+ */
+static bool parse_tsv_entry(char *line, ImportEntry *entry) {
+    char *tab = strchr(line, '\t');
+    if (!tab) return false;
+    char *name_end = line;
+    while (name_end < tab && !isspace((unsigned char) *name_end)) name_end++;
+    *name_end = '\0';
+    entry->name = line;
+    entry->path = tab + 1;
+
+    char *last = strrchr(entry->path, '\t');
+    if (last && last[1] == '#') {
+        *last = '\0';
+        entry->tags = last + 2;
+        last = strrchr(entry->path, '\t');
+    }
+    if (last && last[1] != '\0' && strspn(last + 1, "0123456789") == strlen(last + 1)) *last = '\0';
+    return line[0] != '\0';
+}
+
+/*
+ * Adds one imported directory to the store, its path to paths, and its visits to usage.
+ * Returns 0 if it was added, 1 if its directory is already bookmarked, 2 if it is invalid,
+ * -1 on error.
+ */
+static int import_entry(BookmarkStore *store, PathSet *paths, UsageMap *usage, const ImportEntry *entry) {
+    char path[MAX_PATH];
+    char tags[MAX_TAG_LIST] = "";
+    if (!normalize_path(entry->path, path) || (entry->tags && normalize_tags(entry->tags, tags) != 0)) return 2;
+    if (path_set_contains(paths, store, path)) return 1;
+
+    uint32_t id = store->next_id;
+    char name[MAX_NAME];
+    make_name(store, entry->name ? entry->name : strrchr(path, '/') + 1, id, name);
+
+    if (store_add(store, name, path) != 0 || store_record(store, JOURNAL_ADD, name, path) != 0) return -1;
+    Bookmark *added = &store->records[store->count - 1];
+    if (tags[0] != '\0' && (store_set_tags(store, added, tags) != 0 || store_record(store, JOURNAL_TAGS, name, tags) != 0)) return -1;
+    if (path_set_insert(paths, store, store->count - 1) != 0) return -1;
+
+    // Fractional weights are rounded, but never down to no visits at all
+    uint64_t visits = entry->visits > 0 ? (uint64_t) (entry->visits + 0.5) : 0;
+    if (visits == 0 && entry->visits > 0) visits = 1;
+    if (visits > 0 || entry->last_visit > 0) {
+        // The map grows geometrically, so a large import remaps it a few times rather than per id
+        if (id >= usage->count) {
+            usage_close(usage);
+            if (usage_open_for_update(usage, id * 2) != 0) return -1;
+        }
+        usage_add(usage, id, visits, entry->last_visit);
+    }
+    return 0;
+}
+
+/*
+ * Expands a leading ~ and drops trailing slashes. Only absolute paths that fit in
+ * MAX_PATH are accepted; other tools never store relative ones.
+ * Returns true if normalized holds the path, false if it is invalid.
+ */
+static bool normalize_path(const char *path, char *normalized) {
+    int len;
+    if (path[0] == '~' && (path[1] == '/' || path[1] == '\0')) {
+        const char *home = getenv("HOME");
+        if (!home) return false;
+        len = snprintf(normalized, MAX_PATH, "%s%s", home, path + 1);
+    }
+    else {
+        len = snprintf(normalized, MAX_PATH, "%s", path);
+    }
+    if (len <= 0 || len >= MAX_PATH || normalized[0] != '/') return false;
+
+    while (len > 1 && normalized[len - 1] == '/') normalized[--len] = '\0';
+    return true;
+}
+
+/*
+ * Picks the name of an imported bookmark: source with every blank, control character and
+ * '/' replaced by '-', cut to fit. If another bookmark has that name, "-<id>" is appended
+ * (counting up from the new bookmark's id in the rare case that is taken too), so names never
+ * depend on anything but the input and the store, and a collision costs a single extra lookup.
+ */
+static void make_name(const BookmarkStore *store, const char *source, uint32_t id, char *name) {
+    size_t len = copy_name(name, source[0] ? source : "root", MAX_NAME - 1);
+    if (!store_find((BookmarkStore *) store, name)) return;
+
+    char base[MAX_NAME];
+    memcpy(base, name, len + 1);
+    for (uint32_t suffix = id;; suffix++) {
+        char number[16];
+        int number_len = snprintf(number, sizeof(number), "-%u", suffix);
+        size_t base_len = copy_name(name, base, MAX_NAME - 1 - number_len);
+        memcpy(name + base_len, number, number_len + 1);
+        if (!store_find((BookmarkStore *) store, name)) return;
+    }
+}
+
+/*
+ * Copies at most limit bytes of source into name, replacing characters that can't be
+ * part of a name, without cutting a UTF-8 sequence in two.
+ * Returns the length of the name.
+ */
+static size_t copy_name(char *name, const char *source, size_t limit) {
+    size_t len = strlen(source);
+    if (len > limit) {
+        len = limit;
+        while (len > 0 && ((unsigned char) source[len] & 0xC0) == 0x80) len--;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = source[i];
+        name[i] = isspace(c) || iscntrl(c) || c == '/' ? '-' : c;
+    }
+    name[len] = '\0';
+    return len;
+}
+
+/*
+ * Normalizes a comma-separated list of tags into a sorted list (MAX_TAG_LIST long).
+ * Returns 0 on success, 1 if a tag is invalid or there are too many.
+ */
+static int normalize_tags(const char *source, char *tags) {
+    char list[MAX_TAG_LIST];
+    if (snprintf(list, sizeof(list), "%s", source) >= (int) sizeof(list)) return 1;
+
+    tags[0] = '\0';
+    for (char *tag = strtok(list, ","); tag; tag = strtok(NULL, ",")) {
+        char merged[MAX_TAG_LIST];
+        if (!tag_normalize(tag) || tags_insert(merged, tags, tag) != 0) return 1;
+        strcpy(tags, merged);
+    }
+    return 0;
+}
+
+/*
+ * Adds a record to the path set, growing it when it gets half full.
+ * Returns 0 on success, 1 on error.
+ */
+static int path_set_insert(PathSet *paths, const BookmarkStore *store, size_t record) {
+    if ((paths->used + 1) * 2 > paths->slot_count) {
+        size_t count = paths->slot_count ? paths->slot_count * 2 : 1024;
+        uint32_t *slots = calloc(count, sizeof(uint32_t));
+        if (!slots) {
+            fprintf(stderr, "Failed to allocate memory for the import: %s\n", strerror(errno));
+            return 1;
+        }
+        for (size_t i = 0; i < paths->slot_count; i++) {
+            if (paths->slots[i] == 0) continue;
+            size_t slot = path_hash(bookmark_path(store, &store->records[paths->slots[i] - 1])) & (count - 1);
+            while (slots[slot] != 0) slot = (slot + 1) & (count - 1);
+            slots[slot] = paths->slots[i];
+        }
+        free(paths->slots);
+        paths->slots = slots;
+        paths->slot_count = count;
+    }
+
+    size_t mask = paths->slot_count - 1;
+    size_t slot = path_hash(bookmark_path(store, &store->records[record])) & mask;
+    while (paths->slots[slot] != 0) slot = (slot + 1) & mask;
+    paths->slots[slot] = record + 1;
+    paths->used++;
+    return 0;
+}
+
+/*
+ * Checks if a bookmark of the store has exactly this path.
+ */
+static bool path_set_contains(const PathSet *paths, const BookmarkStore *store, const char *path) {
+    if (paths->slot_count == 0) return false;
+
+    size_t mask = paths->slot_count - 1;
+    for (size_t slot = path_hash(path) & mask; paths->slots[slot] != 0; slot = (slot + 1) & mask) {
+        if (strcmp(bookmark_path(store, &store->records[paths->slots[slot] - 1]), path) == 0) return true;
+    }
+    return false;
+}
+
+/*
+ * FNV-1a over a path. Paths are case-sensitive, unlike names.
+ */
+static uint32_t path_hash(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (const char *c = path; *c; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Writes one bookmark in an export format. Bookmarks that were never visited count as one visit,
+ * since the other tools drop entries with no weight, and are stamped with the time of the export.
+ */
+static void export_entry(OutputBuffer *out, InteropFormat format, const StreamedBookmark *row, const UsageMap *usage, time_t now) {
+    const UsageRecord *record = row->id ? usage_get(usage, row->id) : NULL;
+    unsigned long long visits = record ? record->visits : 1;   // usage_get has no record without visits
+    long long last_visit = record && record->last_visit ? record->last_visit : (long long) now;
+
+    char number[64];
+    switch (format) {
+        case INTEROP_TSV:
+            output_padded(out, row->name, row->name_len, MAX_NAME - 1);
+            output_string(out, "\t");
+            output_write(out, row->path, row->path_len);
+            snprintf(number, sizeof(number), "\t%u", row->id);
+            output_string(out, number);
+            if (row->tags_len) {
+                output_string(out, "\t#");
+                output_write(out, row->tags, row->tags_len);
+            }
+            output_string(out, "\n");
+            break;
+
+        case INTEROP_AUTOJUMP:
+            snprintf(number, sizeof(number), "%llu.0\t", visits);
+            output_string(out, number);
+            output_write(out, row->path, row->path_len);
+            output_string(out, "\n");
+            break;
+
+        case INTEROP_Z:
+        case INTEROP_FASD:
+            output_write(out, row->path, row->path_len);
+            snprintf(number, sizeof(number), "|%llu|%lld\n", visits, last_visit);
+            output_string(out, number);
+            break;
+
+        case INTEROP_ZOXIDE:
+            snprintf(number, sizeof(number), "%4llu.0 ", visits);
+            output_string(out, number);
+            output_write(out, row->path, row->path_len);
+            output_string(out, "\n");
+            break;
+
+        case INTEROP_CDPATH:
+            output_write(out, row->path, row->path_len);
+            output_string(out, "\n");
+            break;
+    }
+}
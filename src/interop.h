@@ -0,0 +1,49 @@
+#ifndef INTEROP_H
+
+#define INTEROP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define INTEROP_BUFFER 65536    // Read size of an import; longer lines are skipped
+
+/*
+ * Databases of other directory jumpers that 'bm import' reads and 'bm export' writes.
+ * Each is read and written one line at a time through fixed-size buffers, so memory
+ * doesn't grow with the input: only the store itself grows by the bookmarks added.
+ */
+typedef enum {
+    INTEROP_TSV,                // bm's own text format, as in bookmarks.tsv
+    INTEROP_AUTOJUMP,           // weight<TAB>path (~/.local/share/autojump/autojump.txt)
+    INTEROP_Z,                  // path|rank|time (~/.z)
+    INTEROP_FASD,               // path|rank|time (~/.fasd)
+    INTEROP_ZOXIDE,             // "score path", as printed by 'zoxide query --list --score'
+    INTEROP_CDPATH,             // Directories, one per line or separated by ':' as in $CDPATH
+} InteropFormat;
+
+/*
+ * Parses the name of a format ("tsv", "autojump", "z", "fasd", "zoxide" or "cdpath").
+ * Returns 0 on success, 1 if the format is unknown.
+ */
+int interop_parse_format(const char *name, InteropFormat *format);
+
+/*
+ * Adds the directories read from fd to the user store, under one lock and with one save.
+ * Names are the directories' base names (or the names of a TSV), made unique by appending
+ * '-' and the new bookmark's id, so the outcome only depends on the input and the store.
+ * Directories that are already bookmarked and malformed lines are skipped. Weights and ranks
+ * become visit counts, and times the last visit, in bookmarks.usage.
+ * Paths are taken as they are, without realpath() or checking that they exist: 'bm doctor'
+ * finds the stale ones.
+ * Returns 0 on success, 1 on error (then nothing is added).
+ */
+int interop_import(InteropFormat format, int fd);
+
+/*
+ * Writes the user store to fd, with visit counts as weights and ranks. Streams the snapshot
+ * when the journal is empty, and loads the store otherwise.
+ * Returns 0 on success, 1 on error.
+ */
+int interop_export(InteropFormat format, int fd);
+
+#endif
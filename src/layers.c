@@ -0,0 +1,325 @@
+#include "layers.h"
+#include "trace.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Helper functions
+static int add_layer(LayerStack *stack, LayerKind kind, const char *directory);
+static bool is_trusted(const struct stat *st);
+static bool same_directory(const char *a, const char *b);
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size);
+static uint64_t layers_digest(const LayerStack *stack, bool with_versions);
+static int index_path(const LayerStack *stack, char *buffer, size_t size);
+static int build_index(BookmarkView *view, const BookmarkStore *store);
+static void prune_merged_indexes(const char *keep);
+
+int layers_find(LayerStack *stack) {
+    stack->count = 0;
+
+    char user[MAX_PATH];
+    StoreVersion user_version;
+    if (store_entry_path(user, sizeof(user), "") != 0 || store_version(&user_version) != 0) return 1;
+
+    // Walk up from the current directory, up to HOME when inside it: directories above HOME are shared
+    // with other users. Under HOME, the walk also finds ~/.bm/, which is the user layer
+    const char *home = getenv("HOME");
+    size_t home_len = home ? strlen(home) : 0;
+    while (home_len > 1 && home[home_len - 1] == '/') home_len--;
+    char directory[MAX_PATH], candidate[MAX_PATH];
+    if (getcwd(directory, sizeof(directory))) {
+        size_t len = strlen(directory);
+        bool under_home = home_len > 1 && strncmp(directory, home, home_len) == 0 &&
+                          (directory[home_len] == '/' || directory[home_len] == '\0');
+        while (stack->count < MAX_LAYERS - 2) {
+            int written = snprintf(candidate, sizeof(candidate), "%.*s%s", len > 1 ? (int) len : 0, directory, BOOKMARK_DIRECTORY);
+            if (written > 0 && (size_t) written < sizeof(candidate) && add_layer(stack, LAYER_PROJECT, candidate) == 0 &&
+                stack->layers[stack->count - 1].version.snapshot_ino == user_version.snapshot_ino &&
+                same_directory(candidate, user)) {
+                stack->count--;
+            }
+
+            if (len <= 1 || (under_home && len == home_len)) break;
+            while (directory[len - 1] != '/') len--;
+            if (len > 1) len--;
+        }
+    }
+
+    stack->user = stack->count;
+    Layer *layer = &stack->layers[stack->count++];
+    layer->kind = LAYER_USER;
+    strcpy(layer->directory, user);
+    layer->version = user_version;
+
+    const char *system = getenv(SYSTEM_DIRECTORY_ENV);
+    if (!system || !system[0]) system = SYSTEM_BOOKMARK_DIRECTORY;
+    int written = snprintf(directory, sizeof(directory), "%s%s", system, system[strlen(system) - 1] == '/' ? "" : "/");
+    if (written > 0 && (size_t) written < sizeof(directory)) add_layer(stack, LAYER_SYSTEM, directory);
+    return 0;
+}
+
+bool layers_equal(const LayerStack *a, const LayerStack *b) {
+    if (a->count != b->count) return false;
+    for (size_t i = 0; i < a->count; i++) {
+        if (strcmp(a->layers[i].directory, b->layers[i].directory) != 0 ||
+            !store_version_equal(&a->layers[i].version, &b->layers[i].version)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int layers_load(const LayerStack *stack, BookmarkStore *store) {
+    if (stack->count == 1) return store_load(store, NULL);
+
+    memset(store, 0, sizeof(*store));
+    store->lock_fd = -1;
+    for (size_t i = 0; i < stack->count; i++) {
+        const Layer *layer = &stack->layers[i];
+        bool user = layer->kind == LAYER_USER;
+
+        // A project or system store that can't be read is skipped without a word, as if it weren't there
+        BookmarkStore loaded;
+        if (!user) store_set_thread_context(layer->directory, true);
+        int status = store_load(&loaded, NULL);
+        if (!user) store_set_thread_context(NULL, false);
+        if (status != 0) {
+            store_free(&loaded);
+            if (user) return 1;
+            continue;
+        }
+
+        for (size_t n = 0; n < loaded.count; n++) {
+            const Bookmark *bookmark = &loaded.records[n];
+            const char *name = bookmark_name(&loaded, bookmark);
+            if (bookmark->name_len == 0 || store_find(store, name)) continue;
+            if (store_add(store, name, bookmark_path(&loaded, bookmark)) != 0) {
+                store_free(&loaded);
+                return 1;
+            }
+            Bookmark *added = &store->records[store->count - 1];
+            added->id = user ? bookmark->id : 0;
+            if (store_set_tags(store, added, bookmark_tags(&loaded, bookmark)) != 0) {
+                store_free(&loaded);
+                return 1;
+            }
+        }
+        store_free(&loaded);
+    }
+    return 0;
+}
+
+int view_open_index(BookmarkView *view) {
+    view->from_store = false;
+
+    char path[MAX_PATH];
+    if (index_path(&view->stack, path, sizeof(path)) != 0) return 1;
+
+    // The user store's version plus, when other layers are merged in, a digest of every layer's version
+    const StoreVersion *source = &view->stack.layers[view->stack.user].version;
+    uint64_t layers = view->stack.count > 1 ? layers_digest(&view->stack, true) : 0;
+    return index_open(&view->index, path, source, layers);
+}
+
+int view_open(BookmarkView *view) {
+    if (view_open_index(view) == 0) return 0;
+
+    TRACE_PHASE("load");
+    if (layers_load(&view->stack, &view->store) != 0) {
+        store_free(&view->store);
+        return 1;
+    }
+
+    // The index is only a cache, so fall back to the loaded store if it can't be rebuilt
+    TRACE_PHASE("index_build");
+    if (build_index(view, &view->store) == 0) {
+        store_free(&view->store);
+        return 0;
+    }
+    view->from_store = true;
+    return 0;
+}
+
+int view_open_loaded(BookmarkView *view, const BookmarkStore *store) {
+    if (view_open_index(view) == 0) return 0;
+
+    TRACE_PHASE("index_build");
+    return build_index(view, store);
+}
+
+const char *view_find(const BookmarkView *view, const char *name, uint32_t *id) {
+    if (!view->from_store) return index_find(&view->index, name, id);
+
+    const Bookmark *bookmark = store_find((BookmarkStore *) &view->store, name);
+    if (!bookmark) return NULL;
+    if (id) *id = bookmark->id;
+    return bookmark_path(&view->store, bookmark);
+}
+
+size_t view_count(const BookmarkView *view) {
+    return view->from_store ? view->store.count : view->index.header->entry_count;
+}
+
+void view_close(BookmarkView *view) {
+    if (view->from_store) store_free(&view->store);
+    else index_close(&view->index);
+}
+
+// Helper functions
+
+/*
+ * Appends a project or system layer if its bookmarks.snap or bookmarks.tsv exists, and it and
+ * the directory are trusted (see is_trusted). An untrusted store is skipped without a word.
+ * Directories without a store cost a single stat().
+ * Returns 0 if it was added, 1 otherwise.
+ */
+static int add_layer(LayerStack *stack, LayerKind kind, const char *directory) {
+    struct stat st;
+    if (stat(directory, &st) == -1 || !S_ISDIR(st.st_mode) || !is_trusted(&st)) return 1;
+
+    Layer *layer = &stack->layers[stack->count];
+    layer->kind = kind;
+    snprintf(layer->directory, sizeof(layer->directory), "%s", directory);
+
+    store_set_thread_context(layer->directory, true);
+    int status = store_version(&layer->version);
+    char path[MAX_PATH];
+    const char *files[] = { BOOKMARK_FILE, TSV_BOOKMARK_FILE, JOURNAL_FILE };
+    for (size_t i = 0; status == 0 && i < sizeof(files) / sizeof(files[0]); i++) {
+        if (store_entry_path(path, sizeof(path), files[i]) != 0) status = 1;
+        else if (stat(path, &st) == 0 && !is_trusted(&st)) status = 1;
+    }
+    store_set_thread_context(NULL, false);
+    if (status != 0) return 1;
+
+    stack->count++;
+    return 0;
+}
+
+/*
+ * Checks if two paths are the same directory, by device and inode. Inode numbers alone repeat
+ * across filesystems, so a matching snapshot inode isn't enough to tell a project store from ~/.bm/.
+ */
+static bool same_directory(const char *a, const char *b) {
+    struct stat first, second;
+    return stat(a, &first) == 0 && stat(b, &second) == 0 && first.st_dev == second.st_dev && first.st_ino == second.st_ino;
+}
+
+/*
+ * Checks that only the current user (or root) can change a layer directory or file: it must be
+ * owned by one of them and not writable by the group or others. Layers shadow the user store, so
+ * otherwise anyone who can write to a shared parent (e.g. /tmp/.bm/) could redirect 'bm go'.
+ */
+static bool is_trusted(const struct stat *st) {
+    return (st->st_uid == getuid() || st->st_uid == 0) && !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+/*
+ * FNV-1a, 64-bit.
+ */
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/*
+ * Digests the directories of the layers, and with with_versions also the identity of their files.
+ * Never returns 0, which marks an index of the user store alone.
+ */
+static uint64_t layers_digest(const LayerStack *stack, bool with_versions) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < stack->count; i++) {
+        const Layer *layer = &stack->layers[i];
+        hash = hash_bytes(hash, layer->directory, strlen(layer->directory) + 1);
+        if (with_versions) hash = hash_bytes(hash, &layer->version, sizeof(layer->version));
+    }
+    return hash ? hash : 1;
+}
+
+/*
+ * Writes the index of the view's layers from store, then opens it.
+ * Returns 0 on success, 1 on error.
+ */
+static int build_index(BookmarkView *view, const BookmarkStore *store) {
+    char path[MAX_PATH];
+    if (index_path(&view->stack, path, sizeof(path)) != 0) return 1;
+
+    const StoreVersion *source = &view->stack.layers[view->stack.user].version;
+    uint64_t layers = view->stack.count > 1 ? layers_digest(&view->stack, true) : 0;
+    if (index_build(path, source, layers, store) != 0) return 1;
+    if (view->stack.count > 1) prune_merged_indexes(path);
+    return index_open(&view->index, path, source, layers);
+}
+
+/*
+ * Keeps the merged indexes in ~/.bm/ to MERGED_INDEX_LIMIT by removing the ones built longest ago,
+ * so projects that were moved, deleted or visited once don't leave their index behind forever.
+ * An index still in use is simply rebuilt on its next lookup. keep is the one just built.
+ */
+static void prune_merged_indexes(const char *keep) {
+    char directory[MAX_PATH];
+    if (store_entry_path(directory, sizeof(directory), "") != 0) return;
+    DIR *dir = opendir(directory);
+    if (!dir) return;
+
+    struct {
+        char name[64];
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+    } oldest[MERGED_INDEX_LIMIT + 1];
+    size_t count = 0, found = 0;
+    const char *kept = strrchr(keep, '/') + 1;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        unsigned long long digest;
+        char name[64], path[MAX_PATH];
+        struct stat st;
+        if (sscanf(entry->d_name, MERGED_INDEX_FORMAT, &digest) != 1) continue;
+        snprintf(name, sizeof(name), MERGED_INDEX_FORMAT, digest);
+        if (strcmp(name, entry->d_name) != 0 || strcmp(name, kept) == 0) continue;
+        if (snprintf(path, sizeof(path), "%s%s", directory, name) >= (int) sizeof(path) || stat(path, &st) == -1) continue;
+        found++;
+
+        // Insertion into the oldest MERGED_INDEX_LIMIT + 1 seen so far
+        size_t i = count < MERGED_INDEX_LIMIT + 1 ? count++ : MERGED_INDEX_LIMIT + 1;
+        while (i > 0 && (oldest[i - 1].mtime_sec > st.st_mtim.tv_sec ||
+                         (oldest[i - 1].mtime_sec == st.st_mtim.tv_sec && oldest[i - 1].mtime_nsec > st.st_mtim.tv_nsec))) {
+            if (i < MERGED_INDEX_LIMIT + 1) oldest[i] = oldest[i - 1];
+            i--;
+        }
+        if (i < MERGED_INDEX_LIMIT + 1) {
+            strcpy(oldest[i].name, name);
+            oldest[i].mtime_sec = st.st_mtim.tv_sec;
+            oldest[i].mtime_nsec = st.st_mtim.tv_nsec;
+        }
+    }
+    closedir(dir);
+
+    // The one just built counts towards the limit too
+    for (size_t i = 0; found + 1 > MERGED_INDEX_LIMIT && i < count; i++, found--) {
+        char path[MAX_PATH];
+        if (snprintf(path, sizeof(path), "%s%s", directory, oldest[i].name) < (int) sizeof(path)) unlink(path);
+    }
+}
+
+/*
+ * Writes the path of the view's index: bookmarks.idx for the user store alone, else a merged
+ * index in ~/.bm/ named after the layer directories, so each project keeps its own.
+ * Returns 0 on success, 1 if the path doesn't fit.
+ */
+static int index_path(const LayerStack *stack, char *buffer, size_t size) {
+    if (stack->count == 1) return store_entry_path(buffer, size, INDEX_FILE);
+
+    char name[64];
+    snprintf(name, sizeof(name), MERGED_INDEX_FORMAT, (unsigned long long) layers_digest(stack, false));
+    return store_entry_path(buffer, size, name);
+}
@@ -0,0 +1,121 @@
+#ifndef LAYERS_H
+
+#define LAYERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "index.h"
+#include "store.h"
+
+#define MAX_LAYERS 8
+
+#define SYSTEM_BOOKMARK_DIRECTORY "/etc/bm/"    // Read-only store shared by every user
+#define SYSTEM_DIRECTORY_ENV "BM_SYSTEM_DIR"    // Overrides SYSTEM_BOOKMARK_DIRECTORY
+#define MERGED_INDEX_FORMAT "merged.%016llx.idx" // Cached merged view, one per set of layer directories
+#define MERGED_INDEX_LIMIT 16                   // Merged indexes kept; building one removes the least recently built
+
+/*
+ * Bookmarks are read from a stack of stores, each a directory holding a bookmarks.snap or bookmarks.tsv:
+ *   - project stores: .bm/ in the current directory or any of its parents up to HOME (when inside it),
+ *     nearest first (e.g. checked in at the root of a repository). Only stores that no one but the
+ *     user (or root) can change are used
+ *   - the user store: ~/.bm/, the only one that commands like add and delete change
+ *   - the system store: /etc/bm/ (or $BM_SYSTEM_DIR), if it exists
+ * A name in a higher layer shadows the same name further down.
+ */
+typedef enum {
+    LAYER_PROJECT,
+    LAYER_USER,
+    LAYER_SYSTEM,
+} LayerKind;
+
+typedef struct {
+    LayerKind kind;
+    char directory[MAX_PATH];   // Ends with '/'
+    StoreVersion version;
+} Layer;
+
+typedef struct {
+    Layer layers[MAX_LAYERS];   // Highest precedence first
+    size_t count;
+    size_t user;                // Position of the user layer
+} LayerStack;
+
+/*
+ * The bookmarks visible from the current directory, ready for lookups: bookmarks.idx when the
+ * user store is the only layer, else the cached merged index of every layer. If the index can't
+ * be (re)built, the merged bookmarks are kept in store instead and from_store is set.
+ */
+typedef struct {
+    LayerStack stack;
+    BookmarkIndex index;
+    BookmarkStore store;
+    bool from_store;
+} BookmarkView;
+
+/*
+ * Finds the layers visible from the current directory and stats their files. Costs one stat()
+ * of .bm/ per parent directory, plus a few for each .bm/ found (its snapshot and journal), and
+ * reads nothing.
+ * Returns 0 on success, 1 if the user store doesn't exist.
+ */
+int layers_find(LayerStack *stack);
+
+/*
+ * Checks if two stacks have the same layers with the same contents.
+ */
+bool layers_equal(const LayerStack *a, const LayerStack *b);
+
+/*
+ * Loads the bookmarks of every layer into one store, in precedence order and without the
+ * shadowed names. Bookmarks of the user store keep their ids; the others get id 0, which has
+ * no usage record. With the user store as the only layer, this is store_load.
+ * Returns 0 on success, 1 if the user store can't be read. Unreadable project or system stores are skipped.
+ * Caller must release the store using store_free, even on error.
+ */
+int layers_load(const LayerStack *stack, BookmarkStore *store);
+
+/*
+ * Opens the index of the layers in view->stack (found with layers_find) if it is up to date,
+ * without loading or rebuilding anything.
+ * Returns 0 on success, 1 if the index is missing or stale.
+ * On success the caller must release the view with view_close.
+ */
+int view_open_index(BookmarkView *view);
+
+/*
+ * Opens the view of the layers in view->stack (found with layers_find), rebuilding its index
+ * if any layer changed since it was written.
+ * Returns 0 on success, 1 if the user store can't be read.
+ * On success the caller must release the view with view_close.
+ */
+int view_open(BookmarkView *view);
+
+/*
+ * Like view_open, but builds a stale index from store, which the caller just loaded with
+ * layers_load from the same layers, so the index's positions match the store's records.
+ * Returns 0 on success, 1 if the index can't be written (the view is then not open).
+ * On success the caller must release the view with view_close.
+ */
+int view_open_loaded(BookmarkView *view, const BookmarkStore *store);
+
+/*
+ * Looks up a bookmark by name (case-insensitive) without allocating.
+ * If id is not NULL, it receives the bookmark's id (0 outside the user store).
+ * Returns the null-terminated path, or NULL if not found.
+ */
+const char *view_find(const BookmarkView *view, const char *name, uint32_t *id);
+
+/*
+ * Returns the number of bookmarks in the view.
+ */
+size_t view_count(const BookmarkView *view);
+
+/*
+ * Releases the index or the store of the view.
+ */
+void view_close(BookmarkView *view);
+
+#endif
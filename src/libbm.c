@@ -0,0 +1,250 @@
+#include "libbm.h"
+#include "fuzzy.h"
+#include "store.h"
+#include "usage.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct BmStore {
+    char directory[MAX_PATH];       // Ends with '/'
+    pthread_mutex_t mutex;          // Guards current
+    BmSnapshot *current;
+};
+
+struct BmSnapshot {
+    BookmarkStore store;            // Never written after loading, so lookups need no lock
+    StoreVersion version;
+    uint32_t references;            // One for the BmStore while current, one per bm_snapshot caller
+    pthread_mutex_t fuzzy_mutex;    // Guards the fuzzy table, built on the first bm_match
+    bool fuzzy_built;
+    FuzzyTable fuzzy;
+};
+
+// Helper functions
+static void enter(const BmStore *store);
+static BmError leave(BmError error);
+static BmError error_from_errno(void);
+static BmError load_snapshot(BmSnapshot **snapshot);
+static void fill_bookmark(const BmSnapshot *snapshot, const Bookmark *record, BmBookmark *bookmark);
+
+BmError bm_open(const char *directory, BmStore **store) {
+    *store = NULL;
+    BmStore *opened = calloc(1, sizeof(BmStore));
+    if (!opened) return BM_ERR_NO_MEMORY;
+
+    int len;
+    if (directory) {
+        len = snprintf(opened->directory, sizeof(opened->directory), "%s/", directory);
+    }
+    else {
+        const char *home = getenv("HOME");
+        len = home ? snprintf(opened->directory, sizeof(opened->directory), "%s%s", home, BOOKMARK_DIRECTORY) : -1;
+    }
+    if (len < 0 || (size_t) len >= sizeof(opened->directory)) {
+        free(opened);
+        return directory ? BM_ERR_INVALID_ARGUMENT : BM_ERR_NOT_INITIALIZED;
+    }
+    pthread_mutex_init(&opened->mutex, NULL);
+
+    BmError error = bm_refresh(opened);
+    if (error != BM_OK) {
+        bm_close(opened);
+        return error;
+    }
+    *store = opened;
+    return BM_OK;
+}
+
+void bm_close(BmStore *store) {
+    if (!store) return;
+    if (store->current) bm_release(store->current);
+    pthread_mutex_destroy(&store->mutex);
+    free(store);
+}
+
+BmError bm_refresh(BmStore *store) {
+    BmSnapshot *snapshot;
+    BmError error = bm_snapshot(store, &snapshot);
+    if (error == BM_OK) bm_release(snapshot);
+    return error;
+}
+
+BmError bm_snapshot(BmStore *store, BmSnapshot **snapshot) {
+    *snapshot = NULL;
+    enter(store);
+
+    StoreVersion version;
+    if (store_version(&version) != 0) {
+        return leave(errno == ENOENT || errno == ENOTDIR ? BM_ERR_NOT_INITIALIZED : BM_ERR_IO);
+    }
+
+    pthread_mutex_lock(&store->mutex);
+    BmSnapshot *current = store->current;
+    if (current && store_version_equal(&current->version, &version)) {
+        __atomic_add_fetch(&current->references, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&store->mutex);
+        *snapshot = current;
+        return leave(BM_OK);
+    }
+    pthread_mutex_unlock(&store->mutex);
+
+    // Load without holding the mutex, so other threads keep using the current snapshot meanwhile
+    BmSnapshot *loaded;
+    BmError error = load_snapshot(&loaded);
+    if (error != BM_OK) return leave(error);
+
+    pthread_mutex_lock(&store->mutex);
+    BmSnapshot *replaced = store->current;
+    store->current = loaded;
+    loaded->references = 2;
+    pthread_mutex_unlock(&store->mutex);
+
+    if (replaced) bm_release(replaced);
+    *snapshot = loaded;
+    return leave(BM_OK);
+}
+
+void bm_release(BmSnapshot *snapshot) {
+    if (!snapshot || __atomic_sub_fetch(&snapshot->references, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    store_free(&snapshot->store);
+    fuzzy_free(&snapshot->fuzzy);
+    pthread_mutex_destroy(&snapshot->fuzzy_mutex);
+    free(snapshot);
+}
+
+size_t bm_count(const BmSnapshot *snapshot) {
+    return snapshot->store.count;
+}
+
+BmError bm_at(const BmSnapshot *snapshot, size_t position, BmBookmark *bookmark) {
+    if (position >= snapshot->store.count) return BM_ERR_INVALID_ARGUMENT;
+    fill_bookmark(snapshot, &snapshot->store.records[position], bookmark);
+    return BM_OK;
+}
+
+BmError bm_find(const BmSnapshot *snapshot, const char *name, BmBookmark *bookmark) {
+    // The hash table was built when the snapshot was loaded, so this only reads
+    const Bookmark *record = store_find((BookmarkStore *) &snapshot->store, name);
+    if (!record) return BM_ERR_NOT_FOUND;
+    fill_bookmark(snapshot, record, bookmark);
+    return BM_OK;
+}
+
+BmError bm_find_by_path(const BmSnapshot *snapshot, const char *path, BmBookmark *bookmark) {
+    if (path[0] != '/') return BM_ERR_INVALID_ARGUMENT;
+    const Bookmark *record = store_find_by_path(&snapshot->store, path);
+    if (!record) return BM_ERR_NOT_FOUND;
+    fill_bookmark(snapshot, record, bookmark);
+    return BM_OK;
+}
+
+BmError bm_match(BmStore *store, const BmSnapshot *snapshot, const char *query, BmBookmark *bookmark) {
+    enter(store);
+    BmSnapshot *shared = (BmSnapshot *) snapshot;
+    pthread_mutex_lock(&shared->fuzzy_mutex);
+    if (!shared->fuzzy_built) {
+        if (fuzzy_build(&shared->fuzzy, &shared->store) != 0) {
+            fuzzy_free(&shared->fuzzy);
+            pthread_mutex_unlock(&shared->fuzzy_mutex);
+            return leave(BM_ERR_NO_MEMORY);
+        }
+        shared->fuzzy_built = true;
+    }
+    pthread_mutex_unlock(&shared->fuzzy_mutex);
+
+    // Visits keep changing, so frecency is read at the time of the match
+    UsageMap usage;
+    double *frecency = usage_open(&usage) == 0 ? usage_frecency_table(&usage, &snapshot->store, time(NULL)) : NULL;
+    usage_close(&usage);
+
+    long best = fuzzy_best(&snapshot->fuzzy, query, frecency);
+    free(frecency);
+    if (best < 0) return leave(BM_ERR_NOT_FOUND);
+
+    fill_bookmark(snapshot, &snapshot->store.records[best], bookmark);
+    return leave(BM_OK);
+}
+
+BmError bm_record_visit(BmStore *store, uint32_t id) {
+    if (id == 0) return BM_ERR_INVALID_ARGUMENT;
+    enter(store);
+    return leave(usage_record_visit(id) == 0 ? BM_OK : error_from_errno());
+}
+
+const char *bm_strerror(BmError error) {
+    switch (error) {
+        case BM_OK: return "Success";
+        case BM_ERR_NOT_INITIALIZED: return "The bookmark system isn't initialized";
+        case BM_ERR_NOT_FOUND: return "No such bookmark";
+        case BM_ERR_INVALID_ARGUMENT: return "Invalid argument";
+        case BM_ERR_NO_MEMORY: return "Out of memory";
+        case BM_ERR_IO: return "Failed to access the bookmark files";
+    }
+    return "Unknown error";
+}
+
+// Helper functions
+
+/*
+ * Points the calling thread's store operations at the store's directory and silences their
+ * error messages, which the API reports as a BmError instead.
+ */
+static void enter(const BmStore *store) {
+    store_set_thread_context(store->directory, true);
+}
+
+/*
+ * Restores the thread's default store context.
+ * Returns error, so API functions can end with 'return leave(error)'.
+ */
+static BmError leave(BmError error) {
+    store_set_thread_context(NULL, false);
+    return error;
+}
+
+/*
+ * Classifies the failure of a store operation by the errno it left behind.
+ */
+static BmError error_from_errno(void) {
+    if (errno == ENOMEM) return BM_ERR_NO_MEMORY;
+    if (errno == ENOENT || errno == ENOTDIR) return BM_ERR_NOT_INITIALIZED;
+    return BM_ERR_IO;
+}
+
+/*
+ * Loads the store into a new snapshot, its hash table built up front.
+ * Returns BM_OK on success.
+ */
+static BmError load_snapshot(BmSnapshot **snapshot) {
+    BmSnapshot *loaded = calloc(1, sizeof(BmSnapshot));
+    if (!loaded) return BM_ERR_NO_MEMORY;
+
+    if (store_load(&loaded->store, &loaded->version) != 0 || store_prepare_lookups(&loaded->store) != 0) {
+        BmError error = error_from_errno();
+        store_free(&loaded->store);
+        free(loaded);
+        return error;
+    }
+
+    pthread_mutex_init(&loaded->fuzzy_mutex, NULL);
+    *snapshot = loaded;
+    return BM_OK;
+}
+
+/*
+ * Fills a view of a record in the snapshot.
+ */
+static void fill_bookmark(const BmSnapshot *snapshot, const Bookmark *record, BmBookmark *bookmark) {
+    bookmark->name = bookmark_name(&snapshot->store, record);
+    bookmark->path = bookmark_path(&snapshot->store, record);
+    bookmark->name_len = record->name_len;
+    bookmark->path_len = record->path_len;
+    bookmark->id = record->id;
+}
@@ -0,0 +1,111 @@
+#ifndef LIBBM_H
+
+#define LIBBM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * libbm: the bookmark store as a library, for long-running tools (editor plugins,
+ * prompt daemons) that want lookups without running the bm binary each time.
+ * Build it with 'make libbm.a' or 'make libbm.so' and link with -lbm -pthread.
+ *
+ * A BmStore is opened once. Each bm_snapshot call checks whether the snapshot or the
+ * journal changed (a few stat() calls) and reloads only if they did. Lookups run against
+ * the returned snapshot, which stays valid until it is released, even if another thread
+ * refreshes the store in the meantime. Every function is safe to call from any thread.
+ *
+ * Bookmarks are returned as views into the snapshot: the name and path point at its
+ * memory and must not be freed. Nothing is ever printed; failures are reported as a BmError.
+ */
+
+#define BM_API __attribute__((visibility("default")))
+
+typedef enum {
+    BM_OK = 0,
+    BM_ERR_NOT_INITIALIZED,     // No bookmarks.snap or bookmarks.tsv in the directory (run 'bm init')
+    BM_ERR_NOT_FOUND,           // No bookmark matches
+    BM_ERR_INVALID_ARGUMENT,
+    BM_ERR_NO_MEMORY,
+    BM_ERR_IO,                  // A bookmark file couldn't be read or written
+} BmError;
+
+typedef struct BmStore BmStore;
+typedef struct BmSnapshot BmSnapshot;
+
+/*
+ * A bookmark inside a snapshot. name and path are null-terminated.
+ */
+typedef struct {
+    const char *name;
+    const char *path;
+    size_t name_len;
+    size_t path_len;
+    uint32_t id;                // Stable across renames and edits, never reused
+} BmBookmark;
+
+/*
+ * Opens the store in directory, or in ~/.bm/ if directory is NULL, and loads it.
+ * Returns BM_OK and sets *store, which must be closed with bm_close.
+ */
+BM_API BmError bm_open(const char *directory, BmStore **store);
+
+/*
+ * Closes the store. Snapshots still held stay valid until they are released.
+ */
+BM_API void bm_close(BmStore *store);
+
+/*
+ * Reloads the store if the snapshot or the journal changed since the last load.
+ * bm_snapshot does this too, so calling it is only needed to load ahead of time.
+ */
+BM_API BmError bm_refresh(BmStore *store);
+
+/*
+ * Refreshes the store if needed and returns its current contents in *snapshot,
+ * which must be released with bm_release.
+ */
+BM_API BmError bm_snapshot(BmStore *store, BmSnapshot **snapshot);
+
+/*
+ * Releases a snapshot. Views into it must not be used afterwards.
+ */
+BM_API void bm_release(BmSnapshot *snapshot);
+
+/*
+ * Returns the number of bookmarks in the snapshot.
+ */
+BM_API size_t bm_count(const BmSnapshot *snapshot);
+
+/*
+ * Returns the bookmark at position (0 to bm_count - 1), in the order they were added.
+ */
+BM_API BmError bm_at(const BmSnapshot *snapshot, size_t position, BmBookmark *bookmark);
+
+/*
+ * Finds a bookmark by name (case-insensitive), like 'bm go' does.
+ */
+BM_API BmError bm_find(const BmSnapshot *snapshot, const char *name, BmBookmark *bookmark);
+
+/*
+ * Finds the bookmark of an absolute path or of its nearest bookmarked parent, like 'bm which' does.
+ */
+BM_API BmError bm_find_by_path(const BmSnapshot *snapshot, const char *path, BmBookmark *bookmark);
+
+/*
+ * Finds the best fuzzy match for query, the fallback of 'bm go': names that contain the
+ * query's characters in order, ranked by where they match and then by frecency.
+ */
+BM_API BmError bm_match(BmStore *store, const BmSnapshot *snapshot, const char *query, BmBookmark *bookmark);
+
+/*
+ * Counts a visit to a bookmark for frecency ranking, like 'bm go' does.
+ */
+BM_API BmError bm_record_visit(BmStore *store, uint32_t id);
+
+/*
+ * Returns a short description of an error.
+ */
+BM_API const char *bm_strerror(BmError error);
+
+#endif
@@ -1,19 +1,50 @@
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "bookmarks.h"
+#include "stats.h"
+#include "trace.h"
+#include "validate.h"
+
+// Helper functions
+static int run_command(int argc, char *argv[]);
+static int parse_list_sort(const char *value, ListSort *sort);
+static int parse_list_format(const char *value, ListFormat *format);
 
 int main(int argc, char *argv[]) {
+    bool trace = false;
+    if (argc >= 2 && strcmp(argv[1], "--trace") == 0) {
+        trace = true;
+        argc--;
+        argv++;
+    }
 
     if (argc < 2) {
         print_helper();
         return 1;
     }
 
+    trace_start(trace, argv[1]);
+    stats_start(argv[1]);
+    int status = run_command(argc, argv);
+    trace_finish(status);
+    stats_finish(status);
+    return status;
+}
+
+// Helper functions
+
+/*
+ * Dispatches argv[1] to its command.
+ * Returns the exit status.
+ */
+static int run_command(int argc, char *argv[]) {
     char *command = argv[1];
 
     if (strcmp(command, "init") == 0) {
         if (argc == 2) {
-            init_bookmark();
+            return init_bookmark();
         }
         else {
             printf("'init' usage: bm init\n");
@@ -22,7 +53,7 @@ int main(int argc, char *argv[]) {
     }
     else if (strcmp(command, "add") == 0) {
         if (argc == 4) {
-           add_bookmark(argv[2], argv[3]);
+            return add_bookmark(argv[2], argv[3]);
         }
         else {
             printf("'add' usage: bm add <name> <path>\n");
@@ -30,17 +61,44 @@ int main(int argc, char *argv[]) {
         }
     }
     else if (strcmp(command, "list") == 0) {
-        if (argc == 2) {
-            list_bookmarks();
-        }
-        else {
-            printf("'list' usage: bm list\n");
-            return 1;
+        ListOptions options = { LIST_SORT_NONE, LIST_FORMAT_TABLE, NULL, true, NULL, NULL, NULL };
+        for (int i = 2; i < argc; i++) {
+            if (strncmp(argv[i], "--sort=", 7) == 0 && parse_list_sort(argv[i] + 7, &options.sort) == 0) {
+                continue;
+            }
+            else if (strncmp(argv[i], "--format=", 9) == 0 && parse_list_format(argv[i] + 9, &options.format) == 0) {
+                continue;
+            }
+            else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+                options.filter = argv[++i];
+            }
+            else if (strncmp(argv[i], "--filter=", 9) == 0) {
+                options.filter = argv[i] + 9;
+            }
+            else if (strcmp(argv[i], "--no-pager") == 0) {
+                options.paginate = false;
+            }
+            else if (strcmp(argv[i], "--tag") == 0 && i + 1 < argc) {
+                options.all_tags = argv[++i];
+            }
+            else if (strcmp(argv[i], "--any-tag") == 0 && i + 1 < argc) {
+                options.any_tags = argv[++i];
+            }
+            else if (strcmp(argv[i], "--not-tag") == 0 && i + 1 < argc) {
+                options.no_tags = argv[++i];
+            }
+            else {
+                printf("'list' usage: bm list [--sort=name|path|frecency] [--filter <glob|substring>]\n");
+                printf("                      [--format=table|tsv|json|null] [--no-pager]\n");
+                printf("                      [--tag <a,b>] [--any-tag <a,b>] [--not-tag <a,b>]\n");
+                return 1;
+            }
         }
+        return list_bookmarks(&options);
     }
     else if (strcmp(command, "delete") == 0) {
         if (argc == 3) {
-            delete_bookmark(argv[2]);
+            return delete_bookmark(argv[2]);
         }
         else {
             printf("'delete' usage: bm delete <name>\n");
@@ -49,7 +107,7 @@ int main(int argc, char *argv[]) {
     }
     else if (strcmp(command, "rename") == 0) {
         if (argc == 4) {
-            rename_bookmark(argv[2], argv[3]);
+            return rename_bookmark(argv[2], argv[3]);
         }
         else {
             printf("'rename' usage: bm rename <current_name> <new_name>\n");
@@ -58,22 +116,171 @@ int main(int argc, char *argv[]) {
     }
     else if (strcmp(command, "edit") == 0) {
         if (argc == 4) {
-            edit_path(argv[2], argv[3]);
+            return edit_path(argv[2], argv[3]);
         }
         else {
             printf("'edit' usage: bm edit <name> <new_path>\n");
             return 1;
         }
     }
+    else if (strcmp(command, "tag") == 0) {
+        if (argc >= 3) {
+            return tag_bookmark(argv[2], argv + 3, argc - 3);
+        }
+        else {
+            printf("'tag' usage: bm tag <name> [<tag>...]\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "untag") == 0) {
+        if (argc >= 4) {
+            return untag_bookmark(argv[2], argv + 3, argc - 3);
+        }
+        else {
+            printf("'untag' usage: bm untag <name> <tag>...\n");
+            return 1;
+        }
+    }
     else if (strcmp(command, "go") == 0) {
         if (argc == 3) {
-            go(argv[2]);
+            return go(argv[2]);
         }
         else {
             printf("'go' usage: bm go <name>\n");
             return 1;
         }
     }
+    else if (strcmp(command, "which") == 0) {
+        if (argc == 2 || argc == 3) {
+            return which_bookmark(argc == 3 ? argv[2] : NULL);
+        }
+        else {
+            printf("'which' usage: bm which [<path>]\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "resolve") == 0) {
+        if (argc == 2 || (argc == 3 && (strcmp(argv[2], "-0") == 0 || strcmp(argv[2], "--null") == 0))) {
+            return resolve_bookmarks(argc == 3);
+        }
+        else {
+            printf("'resolve' usage: bm resolve [-0|--null] < names\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "batch") == 0) {
+        if (argc == 2 || argc == 3) {
+            return batch_bookmarks(argc == 3 ? argv[2] : NULL);
+        }
+        else {
+            printf("'batch' usage: bm batch [<file>]\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "complete") == 0) {
+        if (argc == 2 || argc == 3) {
+            return complete_bookmarks(argc == 3 ? argv[2] : "");
+        }
+        else {
+            printf("'complete' usage: bm complete [<prefix>]\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "completion") == 0) {
+        if (argc == 3) {
+            return print_completion(argv[2]);
+        }
+        else {
+            printf("'completion' usage: bm completion <bash|zsh|fish>\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "daemon") == 0) {
+        if (argc == 2 || (argc == 3 && (strcmp(argv[2], "--watch") == 0 || strcmp(argv[2], "-w") == 0))) {
+            return start_daemon(argc == 3);
+        }
+        else {
+            printf("'daemon' usage: bm daemon [-w|--watch]\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "doctor") == 0) {
+        bool prune = false, relink = false;
+        int timeout_ms = VALIDATE_TIMEOUT_MS;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--prune") == 0) {
+                prune = true;
+            }
+            else if (strcmp(argv[i], "--relink") == 0) {
+                relink = true;
+            }
+            else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+                timeout_ms = atoi(argv[++i]);
+            }
+            else {
+                printf("'doctor' usage: bm doctor [--prune] [--relink] [--timeout <ms>]\n");
+                return 1;
+            }
+        }
+        return doctor_bookmarks(prune, relink, timeout_ms);
+    }
+    else if (strcmp(command, "import") == 0) {
+        if ((argc == 3 || argc == 4) && strncmp(argv[2], "--from=", 7) == 0) {
+            return import_bookmarks(argv[2] + 7, argc == 4 ? argv[3] : NULL);
+        }
+        else {
+            printf("'import' usage: bm import --from=<tsv|autojump|z|fasd|zoxide|cdpath> [<file>]\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "export") == 0) {
+        if (argc == 2 || (argc == 3 && strcmp(argv[2], "--tsv") == 0)) {
+            return export_bookmarks("tsv");
+        }
+        else if (argc == 3 && strncmp(argv[2], "--to=", 5) == 0) {
+            return export_bookmarks(argv[2] + 5);
+        }
+        else {
+            printf("'export' usage: bm export [--to=<tsv|autojump|z|fasd|zoxide|cdpath>]\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "history") == 0) {
+        if (argc == 2) {
+            return list_history();
+        }
+        else {
+            printf("'history' usage: bm history\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "undo") == 0) {
+        if (argc == 2) {
+            return undo_bookmarks();
+        }
+        else {
+            printf("'undo' usage: bm undo\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "restore") == 0) {
+        if (argc == 3) {
+            return restore_bookmarks(argv[2]);
+        }
+        else {
+            printf("'restore' usage: bm restore <generation>\n");
+            return 1;
+        }
+    }
+    else if (strcmp(command, "stats") == 0) {
+        if (argc == 2 || (argc == 3 && strcmp(argv[2], "--json") == 0)) {
+            return print_stats(argc == 3);
+        }
+        else {
+            printf("'stats' usage: bm stats [--json]\n");
+            return 1;
+        }
+    }
     else if (strcmp(command, "help") == 0) {
         print_helper();
     }
@@ -83,4 +290,29 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     return 0;
+}
+
+/*
+ * Parses the value of 'list --sort='.
+ * Returns 0 on success, 1 if the order is unknown.
+ */
+static int parse_list_sort(const char *value, ListSort *sort) {
+    if (strcmp(value, "name") == 0) *sort = LIST_SORT_NAME;
+    else if (strcmp(value, "path") == 0) *sort = LIST_SORT_PATH;
+    else if (strcmp(value, "frecency") == 0) *sort = LIST_SORT_FRECENCY;
+    else return 1;
+    return 0;
+}
+
+/*
+ * Parses the value of 'list --format='.
+ * Returns 0 on success, 1 if the format is unknown.
+ */
+static int parse_list_format(const char *value, ListFormat *format) {
+    if (strcmp(value, "table") == 0) *format = LIST_FORMAT_TABLE;
+    else if (strcmp(value, "tsv") == 0) *format = LIST_FORMAT_TSV;
+    else if (strcmp(value, "json") == 0) *format = LIST_FORMAT_JSON;
+    else if (strcmp(value, "null") == 0 || strcmp(value, "null-delimited") == 0) *format = LIST_FORMAT_NULL;
+    else return 1;
+    return 0;
 }
\ No newline at end of file
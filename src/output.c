@@ -0,0 +1,76 @@
+#include "output.h"
+#include "store.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void output_init(OutputBuffer *out, int fd) {
+    out->fd = fd;
+    out->len = 0;
+    out->failed = false;
+}
+
+void output_write(OutputBuffer *out, const char *data, size_t len) {
+    while (len > 0) {
+        if (out->len == OUTPUT_BUFFER_SIZE) output_flush(out);
+
+        size_t chunk = OUTPUT_BUFFER_SIZE - out->len;
+        if (chunk > len) chunk = len;
+        memcpy(out->data + out->len, data, chunk);
+        out->len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+void output_string(OutputBuffer *out, const char *text) {
+    output_write(out, text, strlen(text));
+}
+
+void output_repeat(OutputBuffer *out, char c, size_t count) {
+    while (count > 0) {
+        if (out->len == OUTPUT_BUFFER_SIZE) output_flush(out);
+
+        size_t chunk = OUTPUT_BUFFER_SIZE - out->len;
+        if (chunk > count) chunk = count;
+        memset(out->data + out->len, c, chunk);
+        out->len += chunk;
+        count -= chunk;
+    }
+}
+
+void output_padded(OutputBuffer *out, const char *text, size_t len, size_t width) {
+    output_write(out, text, len);
+    if (len < width) output_repeat(out, ' ', width - len);
+}
+
+void output_json_string(OutputBuffer *out, const char *text, size_t len) {
+    output_write(out, "\"", 1);
+
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        if (c != '"' && c != '\\' && c >= 0x20) continue;
+
+        // Copy the run of plain characters, then the escape
+        output_write(out, text + start, i - start);
+        start = i + 1;
+        char escape[8];
+        if (c == '"' || c == '\\') snprintf(escape, sizeof(escape), "\\%c", c);
+        else if (c == '\n') snprintf(escape, sizeof(escape), "\\n");
+        else if (c == '\t') snprintf(escape, sizeof(escape), "\\t");
+        else snprintf(escape, sizeof(escape), "\\u%04x", c);
+        output_string(out, escape);
+    }
+    output_write(out, text + start, len - start);
+
+    output_write(out, "\"", 1);
+}
+
+int output_flush(OutputBuffer *out) {
+    if (out->len > 0 && !out->failed && write_all(out->fd, out->data, out->len) != 0) {
+        out->failed = true;
+    }
+    out->len = 0;
+    return out->failed;
+}
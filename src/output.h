@@ -0,0 +1,59 @@
+#ifndef OUTPUT_H
+
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+/*
+ * A fixed-size output buffer in front of a file descriptor. Rows are appended with
+ * plain memcpy and the buffer is flushed with one write() per 64 KiB, so printing a
+ * million rows costs a few hundred system calls instead of millions of stdio calls.
+ * After a failed write (e.g. the pager was closed) further output is dropped.
+ */
+typedef struct {
+    int fd;
+    size_t len;
+    bool failed;
+    char data[OUTPUT_BUFFER_SIZE];
+} OutputBuffer;
+
+/*
+ * Starts an empty buffer that flushes to fd.
+ */
+void output_init(OutputBuffer *out, int fd);
+
+/*
+ * Appends len bytes.
+ */
+void output_write(OutputBuffer *out, const char *data, size_t len);
+
+/*
+ * Appends a null-terminated string.
+ */
+void output_string(OutputBuffer *out, const char *text);
+
+/*
+ * Appends count copies of c.
+ */
+void output_repeat(OutputBuffer *out, char c, size_t count);
+
+/*
+ * Appends text left-aligned in a field of width characters, padded with spaces.
+ */
+void output_padded(OutputBuffer *out, const char *text, size_t len, size_t width);
+
+/*
+ * Appends text as a quoted JSON string, escaping quotes, backslashes and control characters.
+ */
+void output_json_string(OutputBuffer *out, const char *text, size_t len);
+
+/*
+ * Writes out whatever is buffered.
+ * Returns 0 on success, 1 if any write failed.
+ */
+int output_flush(OutputBuffer *out);
+
+#endif
@@ -0,0 +1,329 @@
+#include "snapshot.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define VARINT_MAX 5    // Bytes of the longest 32-bit varint
+#define RECORD_MAX (VARINT_MAX + 1 + MAX_NAME + 2 * VARINT_MAX + MAX_PATH + VARINT_MAX + MAX_TAG_LIST)
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+// Helper functions
+static void build_crc_table(void);
+static uint32_t crc32c_software(uint32_t crc, const unsigned char *data, size_t size);
+static size_t put_varint(char *out, uint32_t value);
+static size_t get_varint(const char *data, size_t size, size_t *value);
+static size_t encode_record(char *out, const BookmarkStore *store, const Bookmark *bookmark, const char *previous, size_t previous_len);
+static int write_block(FILE *file, const char *records, size_t size, uint32_t entry_count);
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * CRC32C with the SSE4.2 crc32 instruction, 8 bytes at a time.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t size) {
+#if defined(__x86_64__)
+    uint64_t wide = crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = (uint32_t) wide;
+#endif
+    for (; size > 0; size--, data++) crc = _mm_crc32_u8(crc, *data);
+    return crc;
+}
+#endif
+
+uint32_t crc32c(const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse4.2")) return ~crc32c_sse42(crc, bytes, size);
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; size--, bytes++) crc = __crc32cb(crc, *bytes);
+    return ~crc;
+#endif
+    return ~crc32c_software(crc, bytes, size);
+}
+
+bool snapshot_is_binary(const char *contents, size_t size) {
+    uint32_t magic;
+    if (size < sizeof(magic)) return false;
+    memcpy(&magic, contents, sizeof(magic));
+    return magic == SNAPSHOT_MAGIC;
+}
+
+bool snapshot_header_valid(const SnapshotHeader *header) {
+    return header->magic == SNAPSHOT_MAGIC && header->version == SNAPSHOT_VERSION &&
+           header->checksum == crc32c(header, offsetof(SnapshotHeader, checksum));
+}
+
+int snapshot_decode(BookmarkStore *store, const char *contents, size_t size) {
+    SnapshotHeader header;
+    if (size < sizeof(header)) goto corrupt;
+    memcpy(&header, contents, sizeof(header));
+    if (!snapshot_header_valid(&header) || header.strings_size > UINT32_MAX) goto corrupt;
+
+    store->records = malloc((header.entry_count ? header.entry_count : 1) * sizeof(Bookmark));
+    store->arena = malloc(header.strings_size + 1);
+    if (!store->records || !store->arena) {
+        store_error("Failed to load bookmarks due to insufficient memory.\n");
+        return 1;
+    }
+    store->capacity = header.entry_count ? header.entry_count : 1;
+    store->arena_capacity = header.strings_size + 1;
+    store->generation = header.generation;
+    store->next_id = header.next_id;
+
+    const char *cursor = contents + sizeof(header);
+    const char *end = contents + size;
+    for (uint32_t block = 0; block < header.block_count; block++) {
+        SnapshotBlock info;
+        if ((size_t) (end - cursor) < sizeof(info)) goto corrupt;
+        memcpy(&info, cursor, sizeof(info));
+        cursor += sizeof(info);
+        if ((size_t) (end - cursor) < info.size || crc32c(cursor, info.size) != info.checksum) goto corrupt;
+
+        const char *path = NULL;   // The previous path of the block, inside the arena
+        size_t path_len = 0;
+        const char *records = cursor;
+        for (uint32_t i = 0; i < info.entry_count; i++) {
+            SnapshotRecord record;
+            size_t used = snapshot_next_record(records, cursor + info.size - records, &record);
+            if (used == 0) goto corrupt;
+            records += used;
+
+            size_t new_path_len = record.shared + record.suffix_len;
+            size_t strings = record.name_len + 1 + new_path_len + 1 + (record.tags_len ? record.tags_len + 1 : 0);
+            if (record.shared > path_len || new_path_len == 0 || new_path_len >= MAX_PATH ||
+                store->count == store->capacity || store->arena_size + strings > store->arena_capacity) {
+                goto corrupt;
+            }
+
+            Bookmark *bookmark = &store->records[store->count++];
+            bookmark->id = record.id;
+            bookmark->name_offset = store->arena_size;
+            bookmark->name_len = record.name_len;
+            memcpy(store->arena + store->arena_size, record.name, record.name_len);
+            store->arena[store->arena_size + record.name_len] = '\0';
+            store->arena_size += record.name_len + 1;
+
+            char *new_path = store->arena + store->arena_size;
+            if (record.shared) memcpy(new_path, path, record.shared);
+            memcpy(new_path + record.shared, record.suffix, record.suffix_len);
+            new_path[new_path_len] = '\0';
+            bookmark->path_offset = store->arena_size;
+            bookmark->path_len = new_path_len;
+            store->arena_size += new_path_len + 1;
+            path = new_path;
+            path_len = new_path_len;
+
+            bookmark->tags_offset = 0;
+            bookmark->tags_len = record.tags_len;
+            if (record.tags_len) {
+                bookmark->tags_offset = store->arena_size;
+                memcpy(store->arena + store->arena_size, record.tags, record.tags_len);
+                store->arena[store->arena_size + record.tags_len] = '\0';
+                store->arena_size += record.tags_len + 1;
+            }
+        }
+        cursor += info.size;
+    }
+    if (store->count == header.entry_count) return 0;
+
+corrupt:
+    store_error("The bookmark snapshot is corrupt: its header or a block fails its checksum or is truncated.\n");
+    return 1;
+}
+
+size_t snapshot_next_record(const char *data, size_t size, SnapshotRecord *record) {
+    size_t used, value, offset = 0;
+
+    if ((used = get_varint(data, size, &value)) == 0) return 0;
+    record->id = value;
+    offset += used;
+
+    if (offset >= size) return 0;
+    record->name_len = (unsigned char) data[offset++];
+    if (record->name_len == 0 || record->name_len >= MAX_NAME || size - offset < record->name_len) return 0;
+    record->name = data + offset;
+    offset += record->name_len;
+
+    if ((used = get_varint(data + offset, size - offset, &record->shared)) == 0) return 0;
+    offset += used;
+    if ((used = get_varint(data + offset, size - offset, &record->suffix_len)) == 0) return 0;
+    offset += used;
+    if (size - offset < record->suffix_len) return 0;
+    record->suffix = data + offset;
+    offset += record->suffix_len;
+
+    if ((used = get_varint(data + offset, size - offset, &record->tags_len)) == 0) return 0;
+    offset += used;
+    if (record->tags_len >= MAX_TAG_LIST || size - offset < record->tags_len) return 0;
+    record->tags = data + offset;
+    offset += record->tags_len;
+    return offset;
+}
+
+int snapshot_write(FILE *file, const BookmarkStore *store, uint64_t generation) {
+    SnapshotHeader header = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, generation, 0, store->next_id, 0, 0, 0 };
+    for (size_t i = 0; i < store->count; i++) {
+        const Bookmark *bookmark = &store->records[i];
+        if (bookmark->name_len == 0) continue;     // Marked as removed
+        header.entry_count++;
+        header.strings_size += bookmark->name_len + 1 + bookmark->path_len + 1 + (bookmark->tags_len ? bookmark->tags_len + 1 : 0);
+    }
+
+    // The header goes first as a placeholder, then is rewritten with the block count and its checksum
+    if (fwrite(&header, sizeof(header), 1, file) != 1) return 1;
+
+    char *block = malloc(SNAPSHOT_BLOCK_SIZE + RECORD_MAX);
+    if (!block) {
+        store_error("Failed to allocate memory for the snapshot: %s\n", strerror(errno));
+        return 1;
+    }
+
+    size_t block_size = 0;
+    uint32_t block_entries = 0;
+    const char *previous = NULL;
+    size_t previous_len = 0;
+    for (size_t i = 0; i < store->count; i++) {
+        const Bookmark *bookmark = &store->records[i];
+        if (bookmark->name_len == 0) continue;
+
+        block_size += encode_record(block + block_size, store, bookmark, previous, previous_len);
+        block_entries++;
+        previous = bookmark_path(store, bookmark);
+        previous_len = bookmark->path_len;
+
+        if (block_size >= SNAPSHOT_BLOCK_SIZE) {
+            if (write_block(file, block, block_size, block_entries) != 0) {
+                free(block);
+                return 1;
+            }
+            header.block_count++;
+            block_size = 0;
+            block_entries = 0;
+            previous = NULL;
+            previous_len = 0;
+        }
+    }
+    if (block_entries > 0) {
+        if (write_block(file, block, block_size, block_entries) != 0) {
+            free(block);
+            return 1;
+        }
+        header.block_count++;
+    }
+    free(block);
+
+    header.checksum = crc32c(&header, offsetof(SnapshotHeader, checksum));
+    long end = ftell(file);
+    if (end == -1 || fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fseek(file, end, SEEK_SET) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// Helper functions
+
+/*
+ * Fills the table of the bytewise software CRC32C (reflected polynomial 0x82F63B78).
+ */
+static void build_crc_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+        crc_table[i] = crc;
+    }
+}
+
+/*
+ * CRC32C a byte at a time, for CPUs without a CRC instruction.
+ */
+static uint32_t crc32c_software(uint32_t crc, const unsigned char *data, size_t size) {
+    pthread_once(&crc_table_once, build_crc_table);
+    for (size_t i = 0; i < size; i++) crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+/*
+ * Writes value as a varint.
+ * Returns the number of bytes written.
+ */
+static size_t put_varint(char *out, uint32_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (char) (value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (char) value;
+    return len;
+}
+
+/*
+ * Reads a varint of at most 32 bits.
+ * Returns the number of bytes read, or 0 if it is truncated or too long.
+ */
+static size_t get_varint(const char *data, size_t size, size_t *value) {
+    uint32_t result = 0;
+    for (size_t i = 0; i < size && i < VARINT_MAX; i++) {
+        unsigned char byte = data[i];
+        result |= (uint32_t) (byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Encodes a bookmark, front-coding its path against the previous path of the block (NULL for none).
+ * Returns the size of the record, at most RECORD_MAX.
+ */
+static size_t encode_record(char *out, const BookmarkStore *store, const Bookmark *bookmark, const char *previous, size_t previous_len) {
+    const char *path = bookmark_path(store, bookmark);
+    size_t shared = 0;
+    size_t limit = previous_len < bookmark->path_len ? previous_len : bookmark->path_len;
+    while (shared < limit && previous[shared] == path[shared]) shared++;
+
+    size_t len = put_varint(out, bookmark->id);
+    out[len++] = (char) bookmark->name_len;
+    memcpy(out + len, bookmark_name(store, bookmark), bookmark->name_len);
+    len += bookmark->name_len;
+    len += put_varint(out + len, shared);
+    len += put_varint(out + len, bookmark->path_len - shared);
+    memcpy(out + len, path + shared, bookmark->path_len - shared);
+    len += bookmark->path_len - shared;
+    len += put_varint(out + len, bookmark->tags_len);
+    memcpy(out + len, bookmark_tags(store, bookmark), bookmark->tags_len);
+    len += bookmark->tags_len;
+    return len;
+}
+
+/*
+ * Writes one block: its header with the checksum, then its records.
+ * Returns 0 on success, 1 on error.
+ */
+static int write_block(FILE *file, const char *records, size_t size, uint32_t entry_count) {
+    SnapshotBlock info = { size, entry_count, crc32c(records, size) };
+    return fwrite(&info, sizeof(info), 1, file) != 1 || fwrite(records, 1, size, file) != size;
+}
@@ -0,0 +1,94 @@
+#ifndef SNAPSHOT_H
+
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "store.h"
+
+#define SNAPSHOT_MAGIC 0x31504E53u  // "SNP1" in little-endian byte order
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BLOCK_SIZE 16384   // A block is closed once its records reach this size
+
+/*
+ * On-disk layout of bookmarks.snap:
+ *   SnapshotHeader | (SnapshotBlock | records)[block_count]
+ *
+ * Each record is:
+ *   id (varint) | name length (1 byte) | name | shared (varint) | suffix length (varint) | suffix |
+ *   tags length (varint) | tags
+ * Paths are front-coded: a record keeps the first `shared` bytes of the previous record's
+ * path and appends its suffix. The first record of every block has shared = 0, so each
+ * block decodes on its own and a stream never holds more than one block.
+ * Every block carries the CRC32C of its records, and the header the CRC32C of the fields
+ * before it, so a torn or damaged snapshot is rejected instead of loading as partial data.
+ * Varints are little-endian base 128 (7 bits per byte, high bit set on all but the last byte).
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;        // Generation of the snapshot, matched by journal records
+    uint64_t strings_size;      // Names, paths and tags with their terminators, once decoded
+    uint32_t next_id;           // Id of the next bookmark to be added
+    uint32_t entry_count;
+    uint32_t block_count;
+    uint32_t checksum;          // CRC32C of the header up to this field
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t size;              // Bytes of records that follow
+    uint32_t entry_count;
+    uint32_t checksum;          // CRC32C of the records
+} SnapshotBlock;
+
+/*
+ * One record of a block, pointing into the block. The strings are not null-terminated.
+ */
+typedef struct {
+    uint32_t id;
+    const char *name;
+    const char *suffix;         // Bytes of the path after the shared prefix
+    const char *tags;
+    size_t name_len;
+    size_t shared;
+    size_t suffix_len;
+    size_t tags_len;
+} SnapshotRecord;
+
+/*
+ * CRC32C (Castagnoli), with the SSE4.2 or ARMv8 CRC instructions when the CPU has them.
+ */
+uint32_t crc32c(const void *data, size_t size);
+
+/*
+ * Checks if a buffer starts with the snapshot magic, i.e. isn't in the bookmarks.tsv format.
+ */
+bool snapshot_is_binary(const char *contents, size_t size);
+
+/*
+ * Checks the magic, version and checksum of a header.
+ */
+bool snapshot_header_valid(const SnapshotHeader *header);
+
+/*
+ * Decodes a whole snapshot into an empty store, verifying every checksum.
+ * Returns 0 on success, 1 if the snapshot is corrupt (which is reported) or memory runs out.
+ */
+int snapshot_decode(BookmarkStore *store, const char *contents, size_t size);
+
+/*
+ * Splits the record at the start of data (size bytes, the rest of a block).
+ * Returns the size of the record, or 0 if it is malformed.
+ */
+size_t snapshot_next_record(const char *data, size_t size, SnapshotRecord *record);
+
+/*
+ * Writes the live bookmarks of the store as a snapshot of the given generation.
+ * Returns 0 on success, 1 on error.
+ */
+int snapshot_write(FILE *file, const BookmarkStore *store, uint64_t generation);
+
+#endif
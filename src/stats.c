@@ -0,0 +1,311 @@
+#include "stats.h"
+
+#include "history.h"
+#include "store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STATS_SIZE (sizeof(StatsHeader) + STATS_COMMANDS * sizeof(StatsHistogram))
+
+// Commands with a histogram, in slot order. New commands go at the end; 'bm daemon' runs until stopped, so it has none
+static const char *commands[] = {
+    "init", "add", "delete", "list", "rename", "edit", "tag", "untag", "go", "which", "resolve", "batch",
+    "complete", "completion", "doctor", "import", "export", "history", "undo", "restore", "stats", "help",
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+// Percentiles printed by 'bm stats', and their JSON keys
+static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static const char *percentile_keys[] = { "p50_us", "p90_us", "p99_us", "p999_us" };
+
+#define PERCENTILE_COUNT (sizeof(percentiles) / sizeof(percentiles[0]))
+
+static const char *run_command;     // NULL unless the run is timed
+static int64_t run_start_ns;
+static bool looked_up;
+static StatsLookup lookup_result;
+
+// Helper functions
+static int64_t now_ns(void);
+static StatsHeader *map_stats(bool create);
+static size_t bucket_index(uint64_t us);
+static uint64_t bucket_highest(size_t index);
+static uint64_t histogram_percentile(const StatsHistogram *histogram, double percentile);
+static void format_duration(char *buffer, size_t size, uint64_t us);
+static void format_size(char *buffer, size_t size, uint64_t bytes);
+static uint64_t history_size(const StoreVersion *version);
+
+void stats_start(const char *command) {
+    const char *setting = getenv(STATS_ENV);
+    if (setting && strcmp(setting, "0") == 0) return;
+
+    run_command = command;
+    run_start_ns = now_ns();
+}
+
+void stats_lookup(StatsLookup result) {
+    looked_up = true;
+    lookup_result = result;
+}
+
+void stats_finish(int status) {
+    if (!run_command) return;
+    uint64_t elapsed_us = (now_ns() - run_start_ns) / 1000;
+
+    size_t slot = 0;
+    while (slot < COMMAND_COUNT && strcmp(commands[slot], run_command) != 0) slot++;
+    if (slot == COMMAND_COUNT) return;
+
+    // Not initialized yet (or not writable): nothing to record into
+    store_set_thread_context(NULL, true);
+    StatsHeader *header = map_stats(true);
+    store_set_thread_context(NULL, false);
+    if (!header) return;
+
+    // A file written by a version with other commands in this slot keeps its counts as they are
+    StatsHistogram *histogram = (StatsHistogram *) (header + 1) + slot;
+    if (strncmp(histogram->command, commands[slot], STATS_COMMAND_NAME) == 0) {
+        __atomic_fetch_add(&histogram->runs, 1, __ATOMIC_RELAXED);
+        if (status != 0) __atomic_fetch_add(&histogram->errors, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&histogram->total_us, elapsed_us, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&histogram->buckets[bucket_index(elapsed_us)], 1, __ATOMIC_RELAXED);
+
+        uint64_t max = __atomic_load_n(&histogram->max_us, __ATOMIC_RELAXED);
+        while (max < elapsed_us &&
+               !__atomic_compare_exchange_n(&histogram->max_us, &max, elapsed_us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    if (looked_up) {
+        uint64_t *counter = lookup_result == STATS_LOOKUP_HIT ? &header->lookup_hits :
+                            lookup_result == STATS_LOOKUP_FUZZY ? &header->lookup_fuzzy : &header->lookup_misses;
+        __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+    }
+    munmap(header, STATS_SIZE);
+}
+
+int stats_report(bool json) {
+    // The file is read through a private copy, so the percentiles of a command add up even while other runs record
+    StatsHeader *header = calloc(1, STATS_SIZE);
+    if (!header) {
+        fprintf(stderr, "Failed to allocate memory for the statistics: %s\n", strerror(errno));
+        return 1;
+    }
+    StatsHeader *mapped = map_stats(false);
+    if (mapped) {
+        memcpy(header, mapped, STATS_SIZE);
+        munmap(mapped, STATS_SIZE);
+    }
+
+    StoreVersion version;
+    BookmarkStore store;
+    if (store_load(&store, &version) != 0) {
+        store_free(&store);
+        free(header);
+        return 1;
+    }
+    size_t entries = store.count;
+    store_free(&store);
+    uint64_t history_bytes = history_size(&version);
+
+    uint64_t lookups = header->lookup_hits + header->lookup_fuzzy + header->lookup_misses;
+    double miss_rate = lookups ? (double) (header->lookup_fuzzy + header->lookup_misses) / lookups : 0;
+    const StatsHistogram *histograms = (const StatsHistogram *) (header + 1);
+
+    if (json) {
+        printf("{\"since\":%lld,\"store\":{\"bookmarks\":%zu,\"snapshot_bytes\":%llu,\"journal_bytes\":%llu,\"history_bytes\":%llu},",
+               (long long) header->since, entries, (unsigned long long) version.snapshot_size,
+               (unsigned long long) version.journal_size, (unsigned long long) history_bytes);
+        printf("\"lookups\":{\"hits\":%llu,\"fuzzy\":%llu,\"misses\":%llu,\"miss_rate\":%.4f},\"commands\":[",
+               (unsigned long long) header->lookup_hits, (unsigned long long) header->lookup_fuzzy,
+               (unsigned long long) header->lookup_misses, miss_rate);
+        bool first = true;
+        for (size_t i = 0; i < STATS_COMMANDS; i++) {
+            const StatsHistogram *histogram = &histograms[i];
+            if (histogram->runs == 0) continue;
+            printf("%s{\"command\":\"%.*s\",\"runs\":%llu,\"errors\":%llu,\"mean_us\":%llu", first ? "" : ",",
+                   STATS_COMMAND_NAME, histogram->command, (unsigned long long) histogram->runs,
+                   (unsigned long long) histogram->errors, (unsigned long long) (histogram->total_us / histogram->runs));
+            for (size_t p = 0; p < PERCENTILE_COUNT; p++) {
+                printf(",\"%s\":%llu", percentile_keys[p], (unsigned long long) histogram_percentile(histogram, percentiles[p]));
+            }
+            printf(",\"max_us\":%llu}", (unsigned long long) histogram->max_us);
+            first = false;
+        }
+        printf("]}\n");
+        free(header);
+        return 0;
+    }
+
+    char total[16], snapshot[16], journal[16], history[16];
+    format_size(total, sizeof(total), version.snapshot_size + version.journal_size);
+    format_size(snapshot, sizeof(snapshot), version.snapshot_size);
+    format_size(journal, sizeof(journal), version.journal_size);
+    format_size(history, sizeof(history), history_bytes);
+    printf("Store: %zu bookmark%s, %s (snapshot %s, journal %s), history %s\n", entries, entries == 1 ? "" : "s",
+           total, snapshot, journal, history);
+    printf("Lookups: %llu by 'bm go', %.1f%% missed the exact name (%llu found by fuzzy match, %llu not found)\n",
+           (unsigned long long) lookups, miss_rate * 100, (unsigned long long) header->lookup_fuzzy,
+           (unsigned long long) header->lookup_misses);
+    if (header->since > 0) {
+        char since[32];
+        time_t created = header->since;
+        struct tm local;
+        if (localtime_r(&created, &local)) {
+            strftime(since, sizeof(since), "%Y-%m-%d %H:%M", &local);
+            printf("Recorded since %s\n", since);
+        }
+    }
+
+    printf("\n%-12s %8s %7s %9s %9s %9s %9s %9s %9s\n", "Command", "Runs", "Errors", "Mean", "p50", "p90", "p99", "p99.9", "Max");
+    for (size_t i = 0; i < STATS_COMMANDS; i++) {
+        const StatsHistogram *histogram = &histograms[i];
+        if (histogram->runs == 0) continue;
+
+        char times[PERCENTILE_COUNT + 2][16];
+        format_duration(times[0], sizeof(times[0]), histogram->total_us / histogram->runs);
+        for (size_t p = 0; p < PERCENTILE_COUNT; p++) {
+            format_duration(times[p + 1], sizeof(times[p + 1]), histogram_percentile(histogram, percentiles[p]));
+        }
+        format_duration(times[PERCENTILE_COUNT + 1], sizeof(times[0]), histogram->max_us);
+        printf("%-12.*s %8llu %7llu %9s %9s %9s %9s %9s %9s\n", STATS_COMMAND_NAME, histogram->command,
+               (unsigned long long) histogram->runs, (unsigned long long) histogram->errors,
+               times[0], times[1], times[2], times[3], times[4], times[5]);
+    }
+
+    free(header);
+    return 0;
+}
+
+// Helper functions
+
+static int64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Maps bookmarks.stats shared, read-write if create is true (creating it as needed), read-only otherwise.
+ * Returns the mapping (STATS_SIZE bytes), or NULL if there is no usable file.
+ */
+static StatsHeader *map_stats(bool create) {
+    char path[MAX_PATH];
+    if (store_entry_path(path, sizeof(path), STATS_FILE) != 0) return NULL;
+
+    int fd = open(path, create ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0600);
+    if (fd == -1) return NULL;
+
+    // posix_fallocate never shrinks a file, so racing processes can only grow it
+    struct stat st;
+    if (fstat(fd, &st) == -1 || ((size_t) st.st_size < STATS_SIZE && (!create || posix_fallocate(fd, 0, STATS_SIZE) != 0))) {
+        close(fd);
+        return NULL;
+    }
+    StatsHeader *header = mmap(NULL, STATS_SIZE, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) return NULL;
+
+    // A fresh file is all zeros; every process that sees that stamps the same header and names
+    uint32_t magic = 0, version = 0;
+    if (create) {
+        __atomic_compare_exchange_n(&header->magic, &magic, STATS_MAGIC, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        __atomic_compare_exchange_n(&header->version, &version, STATS_VERSION, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    if (__atomic_load_n(&header->magic, __ATOMIC_RELAXED) != STATS_MAGIC ||
+        __atomic_load_n(&header->version, __ATOMIC_RELAXED) != STATS_VERSION) {
+        munmap(header, STATS_SIZE);
+        return NULL;
+    }
+    if (create && header->command_count == 0) {
+        int64_t since = 0;
+        __atomic_compare_exchange_n(&header->since, &since, (int64_t) time(NULL), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        StatsHistogram *histograms = (StatsHistogram *) (header + 1);
+        for (size_t i = 0; i < COMMAND_COUNT; i++) {
+            if (histograms[i].command[0] == '\0') strncpy(histograms[i].command, commands[i], STATS_COMMAND_NAME - 1);
+        }
+        header->bucket_count = STATS_BUCKETS;
+        __atomic_store_n(&header->command_count, STATS_COMMANDS, __ATOMIC_RELEASE);
+    }
+    return header;
+}
+
+/*
+ * Returns the bucket of a time: exact below STATS_SUB_BUCKETS us, then STATS_SUB_BUCKETS buckets per power of two.
+ */
+static size_t bucket_index(uint64_t us) {
+    if (us < STATS_SUB_BUCKETS) return us;
+
+    int octave = 63 - __builtin_clzll(us) - STATS_SUB_BUCKET_BITS;
+    if (octave >= STATS_OCTAVES) return STATS_BUCKETS - 1;
+    return (size_t) STATS_SUB_BUCKETS * (octave + 1) + ((us >> octave) - STATS_SUB_BUCKETS);
+}
+
+/*
+ * Returns the highest time that falls in a bucket.
+ */
+static uint64_t bucket_highest(size_t index) {
+    if (index < STATS_SUB_BUCKETS) return index;
+
+    int octave = index / STATS_SUB_BUCKETS - 1;
+    uint64_t lowest = (uint64_t) (STATS_SUB_BUCKETS + index % STATS_SUB_BUCKETS) << octave;
+    return lowest + ((uint64_t) 1 << octave) - 1;
+}
+
+/*
+ * Returns the time under which the given fraction of runs finished, as the highest time of
+ * its bucket (never more than the slowest run).
+ */
+static uint64_t histogram_percentile(const StatsHistogram *histogram, double percentile) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < STATS_BUCKETS; i++) total += histogram->buckets[i];
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t) (percentile * total + 0.999999);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < STATS_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t highest = bucket_highest(i);
+            return highest < histogram->max_us ? highest : histogram->max_us;
+        }
+    }
+    return histogram->max_us;
+}
+
+static void format_duration(char *buffer, size_t size, uint64_t us) {
+    if (us < 1000) snprintf(buffer, size, "%llu us", (unsigned long long) us);
+    else if (us < 1000000) snprintf(buffer, size, "%.1f ms", us / 1000.0);
+    else snprintf(buffer, size, "%.2f s", us / 1000000.0);
+}
+
+static void format_size(char *buffer, size_t size, uint64_t bytes) {
+    if (bytes < 1024) snprintf(buffer, size, "%llu B", (unsigned long long) bytes);
+    else if (bytes < 1024 * 1024) snprintf(buffer, size, "%.1f KB", bytes / 1024.0);
+    else snprintf(buffer, size, "%.1f MB", bytes / (1024.0 * 1024.0));
+}
+
+/*
+ * Returns the size of bookmarks.history and bookmarks.base, unless the base is still the snapshot itself.
+ */
+static uint64_t history_size(const StoreVersion *version) {
+    char path[MAX_PATH];
+    struct stat st;
+    uint64_t size = 0;
+    if (store_entry_path(path, sizeof(path), HISTORY_FILE) == 0 && stat(path, &st) == 0) size += st.st_size;
+    if (store_entry_path(path, sizeof(path), HISTORY_BASE_FILE) == 0 && stat(path, &st) == 0 &&
+        (uint64_t) st.st_ino != version->snapshot_ino) {
+        size += st.st_size;
+    }
+    return size;
+}
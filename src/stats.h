@@ -0,0 +1,89 @@
+#ifndef STATS_H
+
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATS_FILE "bookmarks.stats"
+#define STATS_ENV "BM_STATS"        // BM_STATS=0 turns recording off
+
+#define STATS_MAGIC 0x31545453u     // "STS1" in little-endian byte order
+#define STATS_VERSION 1
+#define STATS_COMMANDS 32           // Histogram slots in the file
+#define STATS_COMMAND_NAME 16
+#define STATS_SUB_BUCKET_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKET_BITS)  // Buckets per power of two: a recorded time is within 1/16 (6%)
+#define STATS_OCTAVES 24            // Powers of two above the first 16 us: times up to 2^28 us (4.5 minutes)
+#define STATS_BUCKETS (STATS_SUB_BUCKETS * (STATS_OCTAVES + 1))
+
+/*
+ * Fleet-level counters, kept across runs in ~/.bm/bookmarks.stats.
+ *
+ * On-disk layout of bookmarks.stats (fixed size, about 52 KB):
+ *   StatsHeader | StatsHistogram[STATS_COMMANDS]
+ *
+ * Each command has an HDR-style latency histogram of whole runs, in microseconds: times under
+ * 16 us have a bucket each, and every power of two above that is split into STATS_SUB_BUCKETS
+ * buckets, so percentiles keep the same relative precision from microseconds to minutes.
+ * Times past the last bucket are counted in it. The header counts how the name lookups of
+ * 'bm go' ended.
+ *
+ * The file is mapped shared and every update is an atomic add (or a compare-and-swap for the
+ * maximum), so concurrent runs never lose a count and never take a lock.
+ * A run records itself once, as it exits, with one open and one mapping of the file.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t command_count;
+    uint32_t bucket_count;
+    int64_t since;              // Seconds since the epoch when the file was created
+    uint64_t lookup_hits;       // 'bm go' lookups that found the exact name
+    uint64_t lookup_fuzzy;      // ... that didn't, but found a fuzzy match
+    uint64_t lookup_misses;     // ... that found nothing
+} StatsHeader;
+
+typedef struct {
+    char command[STATS_COMMAND_NAME];   // "" for an unused slot
+    uint64_t runs;
+    uint64_t errors;            // Runs that exited with a non-zero status
+    uint64_t total_us;
+    uint64_t max_us;
+    uint32_t buckets[STATS_BUCKETS];
+} StatsHistogram;
+
+/*
+ * How a name lookup of 'bm go' ended.
+ */
+typedef enum {
+    STATS_LOOKUP_HIT,
+    STATS_LOOKUP_FUZZY,
+    STATS_LOOKUP_MISS,
+} StatsLookup;
+
+/*
+ * Starts timing a run of a command, unless BM_STATS=0.
+ */
+void stats_start(const char *command);
+
+/*
+ * Notes how the lookup of the run ended. It is recorded with the run by stats_finish.
+ */
+void stats_lookup(StatsLookup result);
+
+/*
+ * Records the run in bookmarks.stats: its time in the histogram of its command, and its lookup.
+ * Runs of commands bm doesn't know, and of 'bm daemon', aren't recorded.
+ * Failures are silent: statistics never change the outcome of a command.
+ */
+void stats_finish(int status);
+
+/*
+ * Prints the recorded percentiles of each command, the lookup miss rate, and the size and
+ * entry count of the store, as text or as one JSON object.
+ * Returns 0 on success, 1 on error.
+ */
+int stats_report(bool json);
+
+#endif
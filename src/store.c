@@ -0,0 +1,1459 @@
+#include "store.h"
+#include "history.h"
+#include "index.h"
+#include "snapshot.h"
+#include "usage.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#define JOURNAL_RECORD_MAX (MAX_LINE + 96) // Longest journal record: generation, time, op, name, id, path and checksum
+
+static const char *journal_ops[] = {
+    [JOURNAL_ADD] = "ADD",
+    [JOURNAL_DEL] = "DEL",
+    [JOURNAL_REN] = "REN",
+    [JOURNAL_EDIT] = "EDIT",
+    [JOURNAL_TAGS] = "TAGS",
+    [JOURNAL_UNDEL] = "UNDEL",
+    [JOURNAL_MARK] = "MARK",
+};
+
+// Set by libbm for the duration of a call (see store_set_thread_context)
+static __thread const char *thread_directory;    // NULL for ~/.bm/
+static __thread bool thread_quiet;
+
+// Helper functions
+static int load(BookmarkStore *store, StoreVersion *version, bool locked);
+static int load_files(BookmarkStore *store, const char *file_path, const char *tsv_path, const char *journal_path,
+                      StoreVersion *version, bool *from_tsv);
+static void migrate_tsv(const char *file_path, const char *tsv_path, const char *journal_path);
+static int acquire_lock(int operation);
+static int open_snapshot(const char *file_path, const char *tsv_path, bool *from_tsv);
+static int stat_snapshot(const char *file_path, const char *tsv_path, struct stat *st);
+static int read_file(const char *file_path, char **contents, size_t *size, struct stat *source);
+static int read_fd(int fd, const char *file_path, char **contents, size_t *size, struct stat *source);
+static int read_exact(int fd, void *buffer, size_t size);
+static void parse_bookmarks(BookmarkStore *store);
+static void parse_header(const char *line, const char *line_end, uint64_t *generation, uint32_t *next_id);
+static bool parse_line(char *line, char *line_end, StreamedBookmark *bookmark, uint32_t *id);
+static char *find_last_tab(char *start, char *end);
+static bool is_number(const char *start, const char *end);
+static int next_line(StoreStream *stream, char **line, char **line_end);
+static int next_snapshot_record(StoreStream *stream, StreamedBookmark *bookmark);
+static int format_record(char *record, uint64_t generation, JournalOp op, const char *arg1, const char *arg2);
+static int append_journal(const char *data, size_t len);
+static int journal_pending(BookmarkStore *store);
+static void replay_journal(BookmarkStore *store, char *journal, size_t size);
+static void apply_scanned_record(void *context, BookmarkStore *store, char **fields, int field_count);
+static bool group_complete(const char *start, const char *end, uint64_t generation, unsigned long count, const char **next);
+static int reserve_records(BookmarkStore *store, size_t count);
+static int intern(BookmarkStore *store, const char *text, uint32_t *offset, uint16_t *len);
+static int rebuild_slots(BookmarkStore *store, size_t slot_count);
+static int insert_slot(BookmarkStore *store, size_t record);
+static uint32_t checksum(const char *data, size_t len);
+static void compact_in_background(BookmarkStore *store);
+static char *get_bookmark_dir_entry_path(const char *entry);
+
+int store_load(BookmarkStore *store, StoreVersion *version) {
+    return load(store, version, false);
+}
+
+int store_load_for_update(BookmarkStore *store, StoreVersion *version) {
+    int lock_fd = acquire_lock(LOCK_EX);
+    if (lock_fd == -1) {
+        memset(store, 0, sizeof(*store));
+        store->lock_fd = -1;
+        return 1;
+    }
+
+    int status = load(store, version, true);
+    store->lock_fd = lock_fd;
+    return status;
+}
+
+int store_load_buffer(BookmarkStore *store, char *contents, size_t size) {
+    memset(store, 0, sizeof(*store));
+    store->lock_fd = -1;
+    store->arena = contents;
+    store->arena_size = size + 1;
+    store->arena_capacity = size + 1;
+    store->snapshot_size = size;
+
+    if (snapshot_is_binary(contents, size)) {
+        // The strings are decoded into an arena of their own
+        store->arena = NULL;
+        store->arena_size = store->arena_capacity = 0;
+        int status = snapshot_decode(store, contents, size);
+        free(contents);
+        return status;
+    }
+
+    // Every bookmark takes at least one line, so the newline count bounds the record count
+    size_t lines = 1;
+    for (const char *c = contents; (c = memchr(c, '\n', contents + size - c)); c++) {
+        lines++;
+    }
+    if (reserve_records(store, lines) != 0) return 1;
+
+    parse_bookmarks(store);
+    return 0;
+}
+
+int store_commit(BookmarkStore *store, JournalOp op, const char *arg1, const char *arg2) {
+    char record[JOURNAL_RECORD_MAX];
+    int len = format_record(record, store->generation, op, arg1, arg2);
+    if (len < 0) return 1;
+
+    // A single append of a small record, instead of rewriting the whole snapshot
+    if (append_journal(record, len) != 0) return 1;
+    store->journal_size += len;
+
+    // Compact once the journal has grown to half the snapshot, so rewrites stay amortized O(1) per mutation
+    size_t threshold = store->snapshot_size / 2;
+    if (threshold < JOURNAL_COMPACT_SIZE) threshold = JOURNAL_COMPACT_SIZE;
+    if (store->journal_size >= threshold) compact_in_background(store);
+
+    return 0;
+}
+
+int store_record(BookmarkStore *store, JournalOp op, const char *arg1, const char *arg2) {
+    if (store->pending_capacity - store->pending_size < JOURNAL_RECORD_MAX) {
+        size_t capacity = store->pending_capacity ? store->pending_capacity * 2 : 4 * JOURNAL_RECORD_MAX;
+        char *pending = realloc(store->pending, capacity);
+        if (!pending) {
+            store_error("Failed to allocate memory for the journal: %s\n", strerror(errno));
+            return 1;
+        }
+        store->pending = pending;
+        store->pending_capacity = capacity;
+    }
+
+    int len = format_record(store->pending + store->pending_size, store->generation, op, arg1, arg2);
+    if (len < 0) return 1;
+    store->pending_size += len;
+    store->pending_count++;
+    return 0;
+}
+
+int store_save(BookmarkStore *store) {
+    // Journaled first, the pending records survive a crash before the rename, and reach the history like any other.
+    // From then on the change is committed: if the snapshot can't be written, loads replay it from the journal
+    bool journaled = store->pending_count > 0 || store->change[0];
+    if (journaled && journal_pending(store) != 0) return 1;
+    int failed = journaled ? 0 : 1;
+
+    char *path = get_bookmark_file_path();
+    char *journal_path = get_bookmark_journal_path();
+    char *dir_path = get_bookmark_dir_path();
+    char *temp_path = path ? malloc(strlen(path) + 5) : NULL;
+    if (!path || !journal_path || !dir_path || !temp_path) {
+        free(path);
+        free(journal_path);
+        free(dir_path);
+        free(temp_path);
+        return failed;
+    }
+    sprintf(temp_path, "%s.tmp", path);
+
+    FILE *file = fopen(temp_path, "w");
+    if (!file) {
+        store_error("Failed to open %s: %s\n", temp_path, strerror(errno));
+        free(path);
+        free(journal_path);
+        free(dir_path);
+        free(temp_path);
+        return failed;
+    }
+
+    uint64_t generation = store->generation + 1;
+
+    // The new snapshot must be on disk before it replaces the old one
+    int status = 0;
+    if (snapshot_write(file, store, generation) != 0 || fflush(file) == EOF || fsync(fileno(file)) == -1) {
+        store_error("Failed to write %s: %s\n", temp_path, strerror(errno));
+        status = 1;
+    }
+    long size = ftell(file);
+    if (fclose(file) == EOF) {
+        store_error("Failed to close %s: %s\n", temp_path, strerror(errno));
+        status = 1;
+    }
+
+    // A store without history yet starts it from the snapshot being replaced, when there is one
+    if (status == 0) history_begin();
+
+    if (status == 0 && rename(temp_path, path) == -1) {
+        store_error("Failed to replace %s: %s\n", path, strerror(errno));
+        status = 1;
+    }
+    if (status != 0) {
+        unlink(temp_path);
+        free(path);
+        free(journal_path);
+        free(dir_path);
+        free(temp_path);
+        return failed;
+    }
+
+    // Make the rename durable before dropping the journal records it supersedes
+    int dir_fd = open(dir_path, O_RDONLY);
+    if (dir_fd != -1) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    // Records of the old generation are ignored on load, so truncating is only about reclaiming space.
+    // They are kept until the history has them, though: the next save moves them otherwise
+    if (history_archive(generation) == 0 && truncate(journal_path, 0) == -1 && errno != ENOENT) {
+        store_error("Failed to truncate %s: %s\n", journal_path, strerror(errno));
+    }
+
+    // Readers prefer bookmarks.snap, so a bookmarks.tsv left behind by a migration is never read again
+    char *tsv_path = get_bookmark_tsv_path();
+    if (tsv_path && unlink(tsv_path) == -1 && errno != ENOENT) {
+        store_error("Failed to remove %s: %s\n", tsv_path, strerror(errno));
+    }
+    free(tsv_path);
+
+    store->generation = generation;
+    store->snapshot_size = size;
+    store->journal_size = 0;
+
+    free(path);
+    free(journal_path);
+    free(dir_path);
+    free(temp_path);
+    return 0;
+}
+
+int store_split_record(char *record, char **fields) {
+    // The last field is the checksum of everything before it
+    char *stored = strrchr(record, '\t');
+    if (!stored || strlen(stored + 1) != 8 || strtoul(stored + 1, NULL, 16) != checksum(record, stored - record)) return 0;
+    *stored = '\0';
+
+    // generation, op, name and the rest (a path or a new name, which may contain tabs)
+    int field_count = 0;
+    char *field = record;
+    while (field && field_count < 4) {
+        fields[field_count++] = field;
+        if (field_count == 4) break;
+        field = strchr(field, '\t');
+        if (field) *field++ = '\0';
+    }
+    return field_count >= 3 ? field_count : 0;
+}
+
+int store_record_op(char **fields) {
+    for (size_t op = 0; op < sizeof(journal_ops) / sizeof(journal_ops[0]); op++) {
+        if (strcmp(fields[1], journal_ops[op]) == 0) return op;
+    }
+    return -1;
+}
+
+int store_join_record(char **fields, int field_count, char *record, size_t size) {
+    size_t len = 0;
+    for (int i = 0; i < field_count; i++) {
+        size_t field_len = strlen(fields[i]);
+        if (len + field_len + 12 > size) return -1;    // Its tab, the checksum, the newline and the terminator
+        if (i > 0) record[len++] = '\t';
+        memcpy(record + len, fields[i], field_len);
+        len += field_len;
+    }
+    len += sprintf(record + len, "\t%08x\n", checksum(record, len));
+    return len;
+}
+
+bool store_apply_record(BookmarkStore *store, char **fields, int field_count) {
+    const char *op = fields[1];
+
+    if (strcmp(op, journal_ops[JOURNAL_ADD]) == 0 && field_count == 4) {
+        if (!store_find(store, fields[2])) store_add(store, fields[2], fields[3]);
+    }
+    else if (strcmp(op, journal_ops[JOURNAL_DEL]) == 0 && field_count == 3) {
+        Bookmark *target = store_find(store, fields[2]);
+        if (target) {
+            store_mark_removed(store, target);
+            return true;
+        }
+    }
+    else if (strcmp(op, journal_ops[JOURNAL_REN]) == 0 && field_count == 4) {
+        Bookmark *target = store_find(store, fields[2]);
+        if (target && !store_find(store, fields[3])) store_rename(store, target, fields[3]);
+    }
+    else if (strcmp(op, journal_ops[JOURNAL_EDIT]) == 0 && field_count == 4) {
+        Bookmark *target = store_find(store, fields[2]);
+        if (target) store_set_path(store, target, fields[3]);
+    }
+    else if (strcmp(op, journal_ops[JOURNAL_TAGS]) == 0 && field_count == 4) {
+        Bookmark *target = store_find(store, fields[2]);
+        if (target) store_set_tags(store, target, fields[3]);
+    }
+    else if (strcmp(op, journal_ops[JOURNAL_UNDEL]) == 0 && field_count == 4) {
+        // Ids are never reused, so the old one is still free; next_id stays where it is
+        char *path;
+        uint32_t id = strtoul(fields[3], &path, 10);
+        uint32_t next_id = store->next_id;
+        if (*path == '\t' && id > 0 && id < next_id && !store_find(store, fields[2]) && store_add(store, fields[2], path + 1) == 0) {
+            store->records[store->count - 1].id = id;
+            store->next_id = next_id;
+        }
+    }
+    return false;
+}
+
+void store_scan_journal(char *journal, size_t size, uint64_t first, uint64_t last, JournalVisitor visit,
+                        BookmarkStore *store, void *context) {
+    char *line = journal;
+    char *end = journal + size;
+    while (line < end) {
+        char *newline = memchr(line, '\n', end - line);
+        if (!newline) break;    // Torn record at the end of the journal
+        *newline = '\0';
+
+        char *fields[4];
+        int field_count = store_split_record(line, fields);
+        uint64_t generation = field_count > 0 ? strtoull(fields[0], NULL, 10) : 0;
+        if (field_count > 0 && generation >= first && generation <= last) {
+            // A group cut short by a crash is skipped whole, so its change is applied all or nothing
+            const char *next;
+            if (strcmp(fields[1], journal_ops[JOURNAL_MARK]) == 0 && field_count == 4 &&
+                !group_complete(newline + 1, end, generation, strtoul(fields[2], NULL, 10), &next)) {
+                line = (char *) next;
+                continue;
+            }
+            visit(context, store, fields, field_count);
+        }
+
+        line = newline + 1;
+    }
+}
+
+int store_create(void) {
+    BookmarkStore store;
+    memset(&store, 0, sizeof(store));
+    store.lock_fd = -1;
+    store.next_id = 1;
+    return store_save(&store);
+}
+
+void store_free(BookmarkStore *store) {
+    free(store->records);
+    free(store->arena);
+    free(store->slots);
+    free(store->pending);
+
+    // Closing (rather than unlocking) keeps the lock held by a compaction child that shares it
+    if (store->lock_fd >= 0) close(store->lock_fd);
+
+    memset(store, 0, sizeof(*store));
+    store->lock_fd = -1;
+}
+
+Bookmark *store_find(BookmarkStore *store, const char *name) {
+    if (!store->slots && rebuild_slots(store, 0) != 0) {
+        for (size_t i = 0; i < store->count; i++) {
+            if (strcasecmp(bookmark_name(store, &store->records[i]), name) == 0) {
+                return &store->records[i];
+            }
+        }
+        return NULL;
+    }
+
+    size_t len;
+    uint32_t hash = bookmark_hash(name, &len);
+    size_t mask = store->slot_count - 1;
+
+    // Slots left behind by renames point at records with a different name, so every hit is verified
+    for (size_t i = hash & mask; store->slots[i] != 0; i = (i + 1) & mask) {
+        Bookmark *bookmark = &store->records[store->slots[i] - 1];
+        if (bookmark->name_len == len && strncasecmp(bookmark_name(store, bookmark), name, len) == 0) {
+            return bookmark;
+        }
+    }
+    return NULL;
+}
+
+const Bookmark *store_find_by_path(const BookmarkStore *store, const char *path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') len--;
+
+    const Bookmark *best = NULL;
+    for (size_t i = 0; i < store->count; i++) {
+        const Bookmark *bookmark = &store->records[i];
+        size_t path_len = bookmark->path_len;
+        if (bookmark->name_len == 0 || path_len > len || memcmp(bookmark_path(store, bookmark), path, path_len) != 0) continue;
+        if (path_len < len && path[path_len] != '/' && path_len != 1) continue;
+        if (best && (path_len < best->path_len ||
+                     (path_len == best->path_len && strcasecmp(bookmark_name(store, bookmark), bookmark_name(store, best)) >= 0))) {
+            continue;
+        }
+        best = bookmark;
+    }
+    return best;
+}
+
+int store_prepare_lookups(BookmarkStore *store) {
+    return store->slots ? 0 : rebuild_slots(store, 0);
+}
+
+int store_add(BookmarkStore *store, const char *name, const char *path) {
+    if (reserve_records(store, store->count + 1) != 0) return 1;
+
+    Bookmark bookmark;
+    if (intern(store, name, &bookmark.name_offset, &bookmark.name_len) != 0 ||
+        intern(store, path, &bookmark.path_offset, &bookmark.path_len) != 0) {
+        return 1;
+    }
+    bookmark.tags_offset = 0;
+    bookmark.tags_len = 0;
+    bookmark.id = store->next_id++;
+
+    store->records[store->count++] = bookmark;
+    if (store->slots) insert_slot(store, store->count - 1);
+    return 0;
+}
+
+void store_remove(BookmarkStore *store, Bookmark *bookmark) {
+    size_t i = bookmark - store->records;
+    memmove(&store->records[i], &store->records[i + 1], (store->count - i - 1) * sizeof(Bookmark));
+    store->count--;
+
+    // Record indices have shifted, so the hash table is rebuilt on the next lookup
+    free(store->slots);
+    store->slots = NULL;
+}
+
+void store_mark_removed(BookmarkStore *store, Bookmark *bookmark) {
+    (void) store;
+    bookmark->name_len = 0;    // Names are never empty, so lookups can't match it anymore
+}
+
+void store_purge_removed(BookmarkStore *store) {
+    size_t kept = 0;
+    for (size_t i = 0; i < store->count; i++) {
+        if (store->records[i].name_len != 0) store->records[kept++] = store->records[i];
+    }
+    if (kept == store->count) return;
+    store->count = kept;
+
+    free(store->slots);
+    store->slots = NULL;
+}
+
+int store_rename(BookmarkStore *store, Bookmark *bookmark, const char *new_name) {
+    if (intern(store, new_name, &bookmark->name_offset, &bookmark->name_len) != 0) return 1;
+    if (store->slots) insert_slot(store, bookmark - store->records);
+    return 0;
+}
+
+int store_set_path(BookmarkStore *store, Bookmark *bookmark, const char *new_path) {
+    return intern(store, new_path, &bookmark->path_offset, &bookmark->path_len);
+}
+
+int store_set_tags(BookmarkStore *store, Bookmark *bookmark, const char *tags) {
+    if (tags[0] == '\0') {
+        bookmark->tags_offset = 0;
+        bookmark->tags_len = 0;
+        return 0;
+    }
+    return intern(store, tags, &bookmark->tags_offset, &bookmark->tags_len);
+}
+
+int store_version(StoreVersion *version) {
+    // On the path of every 'bm go', so build the paths on the stack
+    char file_path[MAX_PATH], tsv_path[MAX_PATH], journal_path[MAX_PATH];
+    if (store_entry_path(file_path, sizeof(file_path), BOOKMARK_FILE) != 0 ||
+        store_entry_path(tsv_path, sizeof(tsv_path), TSV_BOOKMARK_FILE) != 0 ||
+        store_entry_path(journal_path, sizeof(journal_path), JOURNAL_FILE) != 0) {
+        return 1;
+    }
+
+    // Seqlock-style: a compaction renames the snapshot before truncating the journal,
+    // so if the snapshot is unchanged after the journal was stat'ed, the pair is consistent
+    struct stat st;
+    int status = 1;
+    for (int attempt = 0; attempt < STORE_READ_RETRIES; attempt++) {
+        if (stat_snapshot(file_path, tsv_path, &st) == -1) break;
+        version->snapshot_ino = st.st_ino;
+        version->snapshot_size = st.st_size;
+        version->snapshot_mtime_sec = st.st_mtim.tv_sec;
+        version->snapshot_mtime_nsec = st.st_mtim.tv_nsec;
+
+        if (stat(journal_path, &st) == 0) {
+            version->journal_ino = st.st_ino;
+            version->journal_size = st.st_size;
+        }
+        else {
+            version->journal_ino = 0;
+            version->journal_size = 0;
+        }
+
+        if (stat_snapshot(file_path, tsv_path, &st) == -1) break;
+        status = 0;
+        if ((uint64_t) st.st_ino == version->snapshot_ino) break;
+    }
+
+    return status;
+}
+
+int store_stream_open(StoreStream *stream) {
+    char file_path[MAX_PATH], tsv_path[MAX_PATH];
+    if (store_entry_path(file_path, sizeof(file_path), BOOKMARK_FILE) != 0 ||
+        store_entry_path(tsv_path, sizeof(tsv_path), TSV_BOOKMARK_FILE) != 0) {
+        return 1;
+    }
+
+    // A compaction may replace the snapshot between the two checks: make sure the one opened is the one versioned
+    for (int attempt = 0; attempt < STORE_READ_RETRIES; attempt++) {
+        StoreVersion version;
+        if (store_version(&version) != 0 || version.journal_size != 0) return 1;
+
+        bool from_tsv;
+        int fd = open_snapshot(file_path, tsv_path, &from_tsv);
+        if (fd == -1) return 1;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (uint64_t) st.st_ino == version.snapshot_ino) {
+            stream->fd = fd;
+            stream->start = stream->end = 0;
+            stream->eof = false;
+            stream->discarding = false;
+            stream->binary = !from_tsv;
+            stream->entries_left = 0;
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+            if (stream->binary) {
+                SnapshotHeader header;
+                if (read_exact(fd, &header, sizeof(header)) != 0 || !snapshot_header_valid(&header)) {
+                    close(fd);
+                    return 1;
+                }
+                stream->blocks_left = header.block_count;
+                stream->next_id = header.next_id;
+                return 0;
+            }
+
+            // The header line only carries the generation and the next id
+            char *line, *line_end;
+            if (next_line(stream, &line, &line_end) < 0) {
+                close(fd);
+                return 1;
+            }
+            uint64_t generation;
+            *line_end = '\0';
+            stream->next_id = 0;
+            parse_header(line, line_end, &generation, &stream->next_id);
+            return 0;
+        }
+        close(fd);
+    }
+    return 1;
+}
+
+int store_stream_next(StoreStream *stream, StreamedBookmark *bookmark) {
+    if (stream->binary) return next_snapshot_record(stream, bookmark);
+
+    char *line, *line_end;
+    int status;
+    while ((status = next_line(stream, &line, &line_end)) == 1) {
+        if (parse_line(line, line_end, bookmark, &bookmark->id)) return 1;
+    }
+    return status;
+}
+
+void store_stream_close(StoreStream *stream) {
+    close(stream->fd);
+    stream->fd = -1;
+}
+
+bool store_version_equal(const StoreVersion *a, const StoreVersion *b) {
+    return a->snapshot_ino == b->snapshot_ino &&
+           a->snapshot_size == b->snapshot_size &&
+           a->snapshot_mtime_sec == b->snapshot_mtime_sec &&
+           a->snapshot_mtime_nsec == b->snapshot_mtime_nsec &&
+           a->journal_ino == b->journal_ino &&
+           a->journal_size == b->journal_size;
+}
+
+uint32_t bookmark_hash(const char *name, size_t *len) {
+    uint32_t hash = 2166136261u;
+    const char *c = name;
+    for (; *c; c++) {
+        hash ^= (unsigned char) tolower((unsigned char) *c);
+        hash *= 16777619u;
+    }
+    *len = c - name;
+    return hash ? hash : 1;
+}
+
+int write_all(int fd, const void *buffer, size_t size) {
+    const char *cursor = buffer;
+    while (size > 0) {
+        ssize_t written = write(fd, cursor, size);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        cursor += written;
+        size -= written;
+    }
+    return 0;
+}
+
+char *get_bookmark_file_path(void) {
+    return get_bookmark_dir_entry_path(BOOKMARK_FILE);
+}
+
+char *get_bookmark_tsv_path(void) {
+    return get_bookmark_dir_entry_path(TSV_BOOKMARK_FILE);
+}
+
+char *get_bookmark_dir_path(void) {
+    return get_bookmark_dir_entry_path("");
+}
+
+char *get_bookmark_index_path(void) {
+    return get_bookmark_dir_entry_path(INDEX_FILE);
+}
+
+char *get_bookmark_journal_path(void) {
+    return get_bookmark_dir_entry_path(JOURNAL_FILE);
+}
+
+char *get_bookmark_lock_path(void) {
+    return get_bookmark_dir_entry_path(LOCK_FILE);
+}
+
+char *get_bookmark_socket_path(void) {
+    return get_bookmark_dir_entry_path(SOCKET_FILE);
+}
+
+char *get_bookmark_usage_path(void) {
+    return get_bookmark_dir_entry_path(USAGE_FILE);
+}
+
+void store_set_thread_context(const char *directory, bool quiet) {
+    thread_directory = directory;
+    thread_quiet = quiet;
+}
+
+void store_error(const char *format, ...) {
+    if (thread_quiet) return;
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+int store_entry_path(char *buffer, size_t size, const char *entry) {
+    if (thread_directory) {
+        int len = snprintf(buffer, size, "%s%s", thread_directory, entry);
+        return len < 0 || (size_t) len >= size;
+    }
+
+    const char *home = getenv("HOME");
+    if (!home) {
+        store_error("HOME environment variable is not set.\n");
+        return 1;
+    }
+
+    int len = snprintf(buffer, size, "%s%s%s", home, BOOKMARK_DIRECTORY, entry);
+    return len < 0 || (size_t) len >= size;
+}
+
+// Helper functions
+
+/*
+ * Loads the snapshot and journal into the store. Unless the caller holds the writer
+ * lock, nothing is locked: if a compaction replaced the snapshot while it was being
+ * read, the snapshot's inode changes and the read is retried. Only after repeated
+ * retries does the reader wait for the compaction by taking a shared lock.
+ * Returns 0 on success, 1 on error.
+ */
+static int load(BookmarkStore *store, StoreVersion *version, bool locked) {
+    memset(store, 0, sizeof(*store));
+    store->lock_fd = -1;
+
+    char *file_path = get_bookmark_file_path();
+    char *tsv_path = get_bookmark_tsv_path();
+    char *journal_path = get_bookmark_journal_path();
+    if (!file_path || !tsv_path || !journal_path) {
+        free(file_path);
+        free(tsv_path);
+        free(journal_path);
+        return 1;
+    }
+
+    bool writer = locked;
+    StoreVersion loaded;
+    bool from_tsv = false;
+    int lock_fd = -1;
+    int status;
+    for (int attempt = 0;; attempt++) {
+        if (!locked && attempt == STORE_READ_RETRIES) {
+            lock_fd = acquire_lock(LOCK_SH);
+            locked = true;
+        }
+
+        status = load_files(store, file_path, tsv_path, journal_path, &loaded, &from_tsv);
+
+        struct stat st;
+        if (status != 0 || locked ||
+            (stat_snapshot(file_path, tsv_path, &st) == 0 && (uint64_t) st.st_ino == loaded.snapshot_ino)) {
+            break;
+        }
+
+        store_free(store);
+    }
+
+    if (lock_fd != -1) close(lock_fd);
+
+    // Migrate a bookmarks.tsv the first time it is loaded. A writer already holds the lock, so it
+    // saves the store it loaded; the version it gets back is then the one of the new snapshot
+    if (status == 0 && from_tsv && writer) {
+        if (store_save(store) == 0) store_version(&loaded);
+    }
+    else if (status == 0 && from_tsv && !thread_directory) {
+        migrate_tsv(file_path, tsv_path, journal_path);
+    }
+
+    free(file_path);
+    free(tsv_path);
+    free(journal_path);
+
+    if (status == 0 && version) *version = loaded;
+    return status;
+}
+
+/*
+ * Reads the snapshot (bookmarks.snap, else bookmarks.tsv) with a single read, then replays
+ * bookmarks.journal on top of it.
+ * version receives the identity of the files that were read, and from_tsv whether the snapshot was bookmarks.tsv.
+ * Returns 0 on success, 1 on error.
+ */
+static int load_files(BookmarkStore *store, const char *file_path, const char *tsv_path, const char *journal_path,
+                      StoreVersion *version, bool *from_tsv) {
+    int fd = open_snapshot(file_path, tsv_path, from_tsv);
+    if (fd == -1) {
+        store_error("Failed to open %s: %s\n", file_path, strerror(errno));
+        return 1;
+    }
+
+    char *contents;
+    size_t size;
+    struct stat snapshot;
+    if (read_fd(fd, *from_tsv ? tsv_path : file_path, &contents, &size, &snapshot) != 0) return 1;
+    if (store_load_buffer(store, contents, size) != 0) return 1;
+
+    // The journal is optional: it only exists once a mutation has been recorded since the first snapshot
+    char *journal = NULL;
+    size_t journal_size = 0;
+    struct stat journal_stat = {0};
+    if (access(journal_path, F_OK) == 0 && read_file(journal_path, &journal, &journal_size, &journal_stat) != 0) {
+        return 1;
+    }
+
+    if (journal) {
+        replay_journal(store, journal, journal_size);
+        free(journal);
+    }
+    store->journal_size = journal_size;
+
+    version->snapshot_ino = snapshot.st_ino;
+    version->snapshot_size = snapshot.st_size;
+    version->snapshot_mtime_sec = snapshot.st_mtim.tv_sec;
+    version->snapshot_mtime_nsec = snapshot.st_mtim.tv_nsec;
+    version->journal_ino = journal ? journal_stat.st_ino : 0;
+    version->journal_size = journal_size;
+    return 0;
+}
+
+/*
+ * Rewrites a bookmarks.tsv that a reader just loaded as bookmarks.snap. The store is loaded
+ * again under the writer lock, so no mutation recorded in the meantime is lost, and only if
+ * no other process migrated it first.
+ */
+static void migrate_tsv(const char *file_path, const char *tsv_path, const char *journal_path) {
+    int lock_fd = acquire_lock(LOCK_EX);
+    if (lock_fd == -1) return;
+
+    BookmarkStore store;
+    memset(&store, 0, sizeof(store));
+    store.lock_fd = -1;
+    StoreVersion version;
+    bool from_tsv;
+    if (load_files(&store, file_path, tsv_path, journal_path, &version, &from_tsv) == 0 && from_tsv) {
+        store_save(&store);
+    }
+    store_free(&store);
+    close(lock_fd);
+}
+
+/*
+ * Opens bookmarks.lock and takes a flock() on it (LOCK_EX for writers, LOCK_SH for readers).
+ * Returns the locked file descriptor, or -1 on error.
+ */
+static int acquire_lock(int operation) {
+    char *lock_path = get_bookmark_lock_path();
+    if (!lock_path) return -1;
+
+    int fd = open(lock_path, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        store_error("Failed to open %s: %s\n", lock_path, strerror(errno));
+        free(lock_path);
+        return -1;
+    }
+
+    while (flock(fd, operation) == -1) {
+        if (errno == EINTR) continue;
+        store_error("Failed to lock %s: %s\n", lock_path, strerror(errno));
+        close(fd);
+        free(lock_path);
+        return -1;
+    }
+
+    free(lock_path);
+    return fd;
+}
+
+/*
+ * Opens bookmarks.snap, or bookmarks.tsv if it hasn't been migrated yet. If bookmarks.tsv is
+ * gone too, a migration just replaced it, so bookmarks.snap is tried once more.
+ * from_tsv receives whether bookmarks.tsv was opened.
+ * Returns the file descriptor, or -1 on error.
+ */
+static int open_snapshot(const char *file_path, const char *tsv_path, bool *from_tsv) {
+    *from_tsv = false;
+    int fd = open(file_path, O_RDONLY);
+    if (fd != -1 || errno != ENOENT) return fd;
+
+    fd = open(tsv_path, O_RDONLY);
+    if (fd != -1) {
+        *from_tsv = true;
+        return fd;
+    }
+    if (errno != ENOENT) return -1;
+
+    return open(file_path, O_RDONLY);
+}
+
+/*
+ * Stats bookmarks.snap, or bookmarks.tsv if it hasn't been migrated yet.
+ * Returns 0 on success, -1 if neither can be stat'ed.
+ */
+static int stat_snapshot(const char *file_path, const char *tsv_path, struct stat *st) {
+    if (stat(file_path, st) == 0) return 0;
+    if (errno != ENOENT) return -1;
+    if (stat(tsv_path, st) == 0) return 0;
+    return stat(file_path, st);
+}
+
+/*
+ * Reads exactly size bytes, retrying on short reads.
+ * Returns 0 on success, 1 on error or at the end of the file (errno is then EBADMSG).
+ */
+static int read_exact(int fd, void *buffer, size_t size) {
+    char *cursor = buffer;
+    while (size > 0) {
+        ssize_t bytes = read(fd, cursor, size);
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        if (bytes == 0) {
+            errno = EBADMSG;
+            return 1;
+        }
+        cursor += bytes;
+        size -= bytes;
+    }
+    return 0;
+}
+
+/*
+ * Reads a whole file into a null-terminated buffer with a single open and fstat.
+ * If source is not NULL, it receives the stat of the file that was read.
+ * Returns 0 on success, 1 on error.
+ */
+static int read_file(const char *file_path, char **contents, size_t *size, struct stat *source) {
+    int fd = open(file_path, O_RDONLY);
+    if (fd == -1) {
+        store_error("Failed to open %s: %s\n", file_path, strerror(errno));
+        return 1;
+    }
+    return read_fd(fd, file_path, contents, size, source);
+}
+
+/*
+ * Reads the whole file open on fd (named file_path in errors) like read_file, and closes it.
+ * Returns 0 on success, 1 on error.
+ */
+static int read_fd(int fd, const char *file_path, char **contents, size_t *size, struct stat *source) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        store_error("Failed to stat %s: %s\n", file_path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    if (source) *source = st;
+
+    char *buffer = malloc(st.st_size + 1);
+    if (!buffer) {
+        store_error("Failed to load bookmarks due to insufficient memory.\n");
+        close(fd);
+        return 1;
+    }
+
+    size_t total = 0;
+    while (total < (size_t) st.st_size) {
+        ssize_t bytes = read(fd, buffer + total, st.st_size - total);
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            store_error("Failed to read %s: %s\n", file_path, strerror(errno));
+            free(buffer);
+            close(fd);
+            return 1;
+        }
+        if (bytes == 0) break;  // File shrank while reading
+        total += bytes;
+    }
+    buffer[total] = '\0';
+
+    if (close(fd) == -1) {
+        store_error("Failed to close %s: %s\n", file_path, strerror(errno));
+    }
+
+    *contents = buffer;
+    *size = total;
+    return 0;
+}
+
+/*
+ * Parses the arena in place into records. Lines are "name<TAB>path<TAB>id[<TAB>#tags]", where the
+ * name is padded with spaces for alignment. The first line is the header, which
+ * carries the snapshot generation and the next id in a third and fourth column.
+ * Older files have neither, nor ids on their lines: those bookmarks get the next
+ * ids in file order, which every reader derives the same way until a save persists them.
+ * Names and paths are null-terminated in place, so nothing is copied.
+ */
+static void parse_bookmarks(BookmarkStore *store) {
+    char *end = store->arena + store->arena_size - 1;
+    char *line = memchr(store->arena, '\n', end - store->arena); // Skip headers
+    store->next_id = 1;
+    if (!line) return;
+
+    parse_header(store->arena, line, &store->generation, &store->next_id);
+
+    bool missing_ids = false;
+    line++;
+    while (line < end) {
+        char *newline = memchr(line, '\n', end - line);
+        char *line_end = newline ? newline : end;
+        char *next = newline ? newline + 1 : end;
+
+        StreamedBookmark row;
+        uint32_t id;
+        if (parse_line(line, line_end, &row, &id)) {
+            Bookmark *bookmark = &store->records[store->count++];
+            bookmark->name_offset = row.name - store->arena;
+            bookmark->name_len = row.name_len;
+            bookmark->path_offset = row.path - store->arena;
+            bookmark->path_len = row.path_len;
+            bookmark->tags_offset = row.tags_len ? row.tags - store->arena : 0;
+            bookmark->tags_len = row.tags_len;
+            bookmark->id = id;
+            if (id == 0) missing_ids = true;
+            if (id >= store->next_id) store->next_id = id + 1;
+        }
+
+        line = next;
+    }
+
+    if (missing_ids) {
+        for (size_t i = 0; i < store->count; i++) {
+            if (store->records[i].id == 0) store->records[i].id = store->next_id++;
+        }
+    }
+}
+
+/*
+ * Reads the generation and the next id from the third and fourth column of the header line
+ * of bookmarks.tsv. Either is left unchanged if the header doesn't have it.
+ */
+static void parse_header(const char *line, const char *line_end, uint64_t *generation, uint32_t *next_id) {
+    const char *column = memchr(line, '\t', line_end - line);
+    if (column) column = memchr(column + 1, '\t', line_end - column - 1);
+    if (column) {
+        char *end;
+        *generation = strtoull(column + 1, &end, 10);
+        if (*end == '\t') *next_id = strtoul(end + 1, NULL, 10);
+    }
+}
+
+/*
+ * Splits one line of bookmarks.tsv ("name<spaces>\tpath[\tid[\t#tags]]") in place, null-terminating
+ * the name, the path and the tags. id receives 0 if the line has no id column.
+ * Returns true if the line holds a valid bookmark, false otherwise.
+ */
+static bool parse_line(char *line, char *line_end, StreamedBookmark *bookmark, uint32_t *id) {
+    char *tab = memchr(line, '\t', line_end - line);
+    if (!tab || tab + 1 >= line_end) return false;
+
+    char *name_end = line;
+    while (name_end < tab && !isspace((unsigned char) *name_end)) name_end++;
+    *name_end = '\0';
+    *line_end = '\0';
+
+    // The id and the tags are the last columns, so paths may still contain tabs.
+    // Tags only count after an id, which every saved line has.
+    char *path_end = line_end;
+    bookmark->tags = "";
+    bookmark->tags_len = 0;
+    char *tags_tab = find_last_tab(tab + 1, line_end);
+    if (tags_tab && tags_tab[1] == '#') {
+        char *id_tab = find_last_tab(tab + 1, tags_tab);
+        if (id_tab && is_number(id_tab + 1, tags_tab)) {
+            bookmark->tags = tags_tab + 2;
+            bookmark->tags_len = line_end - bookmark->tags;
+            path_end = tags_tab;
+            *path_end = '\0';
+        }
+    }
+
+    *id = 0;
+    char *id_tab = find_last_tab(tab + 1, path_end);
+    if (id_tab && is_number(id_tab + 1, path_end)) {
+        *id = strtoul(id_tab + 1, NULL, 10);
+        path_end = id_tab;
+        *path_end = '\0';
+    }
+
+    size_t name_len = name_end - line;
+    size_t path_len = path_end - (tab + 1);
+    bookmark->name = line;
+    bookmark->name_len = name_len;
+    bookmark->path = tab + 1;
+    bookmark->path_len = path_len;
+    return name_len > 0 && name_len < MAX_NAME && path_len > 0 && path_len < MAX_PATH;
+}
+
+/*
+ * Returns the last tab in [start, end), or NULL if there is none.
+ */
+static char *find_last_tab(char *start, char *end) {
+    while (end > start) {
+        if (*--end == '\t') return end;
+    }
+    return NULL;
+}
+
+/*
+ * Checks if [start, end) is a non-empty run of decimal digits.
+ */
+static bool is_number(const char *start, const char *end) {
+    if (start == end) return false;
+    for (const char *c = start; c < end; c++) {
+        if (*c < '0' || *c > '9') return false;
+    }
+    return true;
+}
+
+/*
+ * Finds the next line of a stream, refilling the buffer as needed. The line is
+ * [*line, *line_end), where *line_end is the newline (or the end of the last line)
+ * and may be overwritten. Lines that don't fit in the buffer are skipped.
+ * Returns 1 if a line was found, 0 at the end of the file, -1 on a read error.
+ */
+static int next_line(StoreStream *stream, char **line, char **line_end) {
+    for (;;) {
+        char *start = stream->buffer + stream->start;
+        char *newline = memchr(start, '\n', stream->end - stream->start);
+        if (newline && stream->discarding) {
+            stream->discarding = false;
+            stream->start = newline + 1 - stream->buffer;
+            continue;
+        }
+        if (newline) {
+            *line = start;
+            *line_end = newline;
+            stream->start = newline + 1 - stream->buffer;
+            return 1;
+        }
+
+        if (stream->eof) {
+            if (stream->start == stream->end || stream->discarding) return 0;
+            // Last line without a trailing newline: there's always room for a terminator
+            *line = start;
+            *line_end = stream->buffer + stream->end;
+            stream->start = stream->end;
+            return 1;
+        }
+
+        // Keep the partial line, then read behind it
+        if (stream->start == 0 && stream->end == STORE_STREAM_BUFFER - 1) {
+            stream->end = 0;    // A line longer than the buffer can't be a valid bookmark: drop it
+            stream->discarding = true;
+        }
+        memmove(stream->buffer, start, stream->end - stream->start);
+        stream->end -= stream->start;
+        stream->start = 0;
+
+        ssize_t bytes = read(stream->fd, stream->buffer + stream->end, STORE_STREAM_BUFFER - 1 - stream->end);
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (bytes == 0) stream->eof = true;
+        stream->end += bytes;
+    }
+}
+
+/*
+ * Decodes the next record of a snapshot stream, reading and checking the next block when
+ * the current one is used up. The record is copied out of the block so its strings can be
+ * null-terminated, and its path is rebuilt on top of the previous one.
+ * Returns 1 if a bookmark was read, 0 at the end of the file, -1 on a read error or a corrupt block.
+ */
+static int next_snapshot_record(StoreStream *stream, StreamedBookmark *bookmark) {
+    while (stream->entries_left == 0) {
+        if (stream->blocks_left == 0) return 0;
+
+        SnapshotBlock info;
+        if (read_exact(stream->fd, &info, sizeof(info)) != 0) return -1;
+        if (info.size > STORE_STREAM_BUFFER) {
+            errno = EBADMSG;
+            return -1;
+        }
+        if (read_exact(stream->fd, stream->buffer, info.size) != 0) return -1;
+        if (crc32c(stream->buffer, info.size) != info.checksum) {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        stream->start = 0;
+        stream->end = info.size;
+        stream->entries_left = info.entry_count;
+        stream->blocks_left--;
+        stream->path_len = 0;   // Front coding starts over in every block
+    }
+
+    SnapshotRecord record;
+    size_t used = snapshot_next_record(stream->buffer + stream->start, stream->end - stream->start, &record);
+    if (used == 0 || record.shared > stream->path_len || record.shared + record.suffix_len == 0 ||
+        record.shared + record.suffix_len >= MAX_PATH) {
+        errno = EBADMSG;
+        return -1;
+    }
+    stream->start += used;
+    stream->entries_left--;
+
+    memcpy(stream->name, record.name, record.name_len);
+    stream->name[record.name_len] = '\0';
+    memcpy(stream->path + record.shared, record.suffix, record.suffix_len);
+    stream->path_len = record.shared + record.suffix_len;
+    stream->path[stream->path_len] = '\0';
+    memcpy(stream->tags, record.tags, record.tags_len);
+    stream->tags[record.tags_len] = '\0';
+
+    bookmark->id = record.id;
+    bookmark->name = stream->name;
+    bookmark->name_len = record.name_len;
+    bookmark->path = stream->path;
+    bookmark->path_len = stream->path_len;
+    bookmark->tags = stream->tags;
+    bookmark->tags_len = record.tags_len;
+    return 1;
+}
+
+/*
+ * Formats a journal record of the given snapshot generation, stamped with the current time.
+ * arg2 is ignored for JOURNAL_DEL.
+ * Returns the length of the record (JOURNAL_RECORD_MAX at most), or -1 if it doesn't fit.
+ */
+static int format_record(char *record, uint64_t generation, JournalOp op, const char *arg1, const char *arg2) {
+    int len;
+    if (op == JOURNAL_DEL) {
+        len = snprintf(record, JOURNAL_RECORD_MAX, "%llu@%lld\t%s\t%s", (unsigned long long) generation,
+                       (long long) time(NULL), journal_ops[op], arg1);
+    }
+    else {
+        len = snprintf(record, JOURNAL_RECORD_MAX, "%llu@%lld\t%s\t%s\t%s", (unsigned long long) generation,
+                       (long long) time(NULL), journal_ops[op], arg1, arg2);
+    }
+    if (len < 0 || (size_t) len + 11 >= JOURNAL_RECORD_MAX) {
+        store_error("Failed to record change: journal record is too long.\n");
+        return -1;
+    }
+    len += sprintf(record + len, "\t%08x\n", checksum(record, len));
+    return len;
+}
+
+/*
+ * Appends records to bookmarks.journal with a single write, and waits for them to reach the disk.
+ * Returns 0 on success, 1 on error.
+ */
+static int append_journal(const char *data, size_t len) {
+    char *journal_path = get_bookmark_journal_path();
+    if (!journal_path) return 1;
+
+    int fd = open(journal_path, O_RDWR | O_APPEND | O_CREAT, 0600);
+    if (fd == -1) {
+        store_error("Failed to open %s: %s\n", journal_path, strerror(errno));
+        free(journal_path);
+        return 1;
+    }
+
+    // A record torn by a crash has no newline; terminate it so the new record starts on its own line
+    struct stat st;
+    char last = '\n';
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && pread(fd, &last, 1, st.st_size - 1) == 1 && last != '\n') {
+        write_all(fd, "\n", 1);
+    }
+
+    if (write_all(fd, data, len) != 0 || fdatasync(fd) == -1) {
+        store_error("Failed to write %s: %s\n", journal_path, strerror(errno));
+        close(fd);
+        free(journal_path);
+        return 1;
+    }
+
+    if (close(fd) == -1) {
+        store_error("Failed to close %s: %s\n", journal_path, strerror(errno));
+    }
+    free(journal_path);
+    return 0;
+}
+
+/*
+ * Appends the pending records of the store to the journal, behind a MARK record that makes them one change.
+ * Returns 0 on success, 1 on error.
+ */
+static int journal_pending(BookmarkStore *store) {
+    char mark[JOURNAL_RECORD_MAX], count[24];
+    snprintf(count, sizeof(count), "%zu", store->pending_count);
+    int mark_len = format_record(mark, store->generation, JOURNAL_MARK, count, store->change[0] ? store->change : "changes");
+    if (mark_len < 0) return 1;
+
+    char *group = malloc(mark_len + store->pending_size);
+    if (!group) {
+        store_error("Failed to allocate memory for the journal: %s\n", strerror(errno));
+        return 1;
+    }
+    memcpy(group, mark, mark_len);
+    memcpy(group + mark_len, store->pending, store->pending_size);
+    int status = append_journal(group, mark_len + store->pending_size);
+    free(group);
+    if (status != 0) return 1;
+
+    store->journal_size += mark_len + store->pending_size;
+    store->pending_size = store->pending_count = 0;
+    store->change[0] = '\0';
+    return 0;
+}
+
+/*
+ * Applies the journal records of the store's generation, in order.
+ * Records of other generations were already folded into a snapshot.
+ */
+static void replay_journal(BookmarkStore *store, char *journal, size_t size) {
+    bool removed = false;
+    store_scan_journal(journal, size, store->generation, store->generation, apply_scanned_record, store, &removed);
+    if (removed) store_purge_removed(store);
+}
+
+static void apply_scanned_record(void *context, BookmarkStore *store, char **fields, int field_count) {
+    *(bool *) context |= store_apply_record(store, fields, field_count);
+}
+
+/*
+ * Checks that the count records following a MARK record are all there and intact.
+ * *next receives the end of the group, or of its first broken record.
+ */
+static bool group_complete(const char *start, const char *end, uint64_t generation, unsigned long count, const char **next) {
+    const char *line = start;
+    for (unsigned long i = 0; i < count; i++) {
+        const char *newline = memchr(line, '\n', end - line);
+        if (!newline) {
+            *next = end;
+            return false;
+        }
+
+        const char *stored = newline - 9;
+        if (stored < line || *stored != '\t' || strtoul(stored + 1, NULL, 16) != checksum(line, stored - line) ||
+            strtoull(line, NULL, 10) != generation) {
+            *next = newline + 1;
+            return false;
+        }
+        line = newline + 1;
+    }
+    *next = line;
+    return true;
+}
+
+/*
+ * Makes sure the records array can hold count bookmarks.
+ * Returns 0 on success, 1 on error.
+ */
+static int reserve_records(BookmarkStore *store, size_t count) {
+    if (count <= store->capacity) return 0;
+
+    size_t capacity = store->capacity ? store->capacity * 2 : 16;
+    if (capacity < count) capacity = count;
+
+    Bookmark *records = realloc(store->records, capacity * sizeof(Bookmark));
+    if (!records) {
+        store_error("Failed to allocate memory for bookmark: %s\n", strerror(errno));
+        return 1;
+    }
+
+    store->records = records;
+    store->capacity = capacity;
+    return 0;
+}
+
+/*
+ * Copies a null-terminated string to the end of the arena, growing it if needed.
+ * Returns 0 on success, 1 on error.
+ */
+static int intern(BookmarkStore *store, const char *text, uint32_t *offset, uint16_t *len) {
+    size_t text_len = strlen(text);
+
+    if (store->arena_size + text_len + 1 > store->arena_capacity) {
+        size_t capacity = store->arena_capacity ? store->arena_capacity * 2 : 4096;
+        while (capacity < store->arena_size + text_len + 1) capacity *= 2;
+
+        char *arena = realloc(store->arena, capacity);
+        if (!arena) {
+            store_error("Failed to allocate memory for bookmark: %s\n", strerror(errno));
+            return 1;
+        }
+        store->arena = arena;
+        store->arena_capacity = capacity;
+    }
+
+    memcpy(store->arena + store->arena_size, text, text_len + 1);
+    *offset = store->arena_size;
+    *len = text_len;
+    store->arena_size += text_len + 1;
+    return 0;
+}
+
+/*
+ * Rebuilds the hash table with at least slot_count slots (0 picks a size from the record count).
+ * Returns 0 on success, 1 on error.
+ */
+static int rebuild_slots(BookmarkStore *store, size_t slot_count) {
+    // Keep the load factor at or below 0.5 so lookups stay at a probe or two
+    size_t count = 16;
+    while (count < slot_count || count < store->count * 2) count <<= 1;
+
+    uint32_t *slots = calloc(count, sizeof(uint32_t));
+    if (!slots) {
+        store_error("Failed to allocate memory for the bookmark table: %s\n", strerror(errno));
+        return 1;
+    }
+
+    free(store->slots);
+    store->slots = slots;
+    store->slot_count = count;
+    store->slots_used = 0;
+
+    for (size_t i = 0; i < store->count; i++) {
+        if (store->records[i].name_len != 0) insert_slot(store, i);
+    }
+    return 0;
+}
+
+/*
+ * Adds a record to the hash table, growing the table when it gets half full.
+ * Returns 0 on success, 1 on error (the table is dropped and rebuilt on the next lookup).
+ */
+static int insert_slot(BookmarkStore *store, size_t record) {
+    if ((store->slots_used + 1) * 2 > store->slot_count) {
+        if (rebuild_slots(store, store->slot_count * 2) != 0) {
+            free(store->slots);
+            store->slots = NULL;
+            return 1;
+        }
+        // The rebuild already inserted every live record, including this one
+        return 0;
+    }
+
+    size_t len;
+    uint32_t hash = bookmark_hash(bookmark_name(store, &store->records[record]), &len);
+    size_t mask = store->slot_count - 1;
+
+    size_t i = hash & mask;
+    while (store->slots[i] != 0) i = (i + 1) & mask;
+    store->slots[i] = record + 1;
+    store->slots_used++;
+    return 0;
+}
+
+/*
+ * FNV-1a over a journal record, used to reject records torn by a crash.
+ */
+static uint32_t checksum(const char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Writes a new snapshot from a forked child so the command that crossed the
+ * threshold doesn't pay for the rewrite. Falls back to compacting in place.
+ */
+static void compact_in_background(BookmarkStore *store) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(store_save(store));
+    }
+    if (pid == -1) {
+        store_save(store);
+    }
+}
+
+/*
+ * Returns the path to an entry inside ~/.bm/.
+ * If the HOME environment variable is not set, NULL is returned.
+ */
+static char *get_bookmark_dir_entry_path(const char *entry) {
+    if (thread_directory) {
+        char *path = malloc(strlen(thread_directory) + strlen(entry) + 1);
+        if (!path) {
+            store_error("Failed to allocate memory for path: %s\n", strerror(errno));
+            return NULL;
+        }
+        sprintf(path, "%s%s", thread_directory, entry);
+        return path;
+    }
+
+    const char *home = getenv("HOME");
+    if (!home) {
+        store_error("HOME environment variable is not set.\n");
+        return NULL;
+    }
+
+    char *path = malloc(strlen(home) + strlen(BOOKMARK_DIRECTORY) + strlen(entry) + 1); //home + "/.bm/" + entry + null terminator
+    if (!path) {
+        store_error("Failed to allocate memory for path: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    sprintf(path, "%s%s%s", home, BOOKMARK_DIRECTORY, entry);
+    return path;
+}
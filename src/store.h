@@ -0,0 +1,432 @@
+#ifndef STORE_H
+
+#define STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "bookmarks.h"
+
+#define JOURNAL_FILE "bookmarks.journal"
+#define LOCK_FILE "bookmarks.lock"
+#define SOCKET_FILE "bm.sock"
+
+#define JOURNAL_COMPACT_SIZE (64 * 1024) // Journal size that triggers compaction, unless the snapshot is larger
+
+#define STORE_READ_RETRIES 8    // Lock-free read attempts before a reader waits for a compaction to finish
+
+/*
+ * A bookmark is a set of offset/length views into the store's arena.
+ * Names and paths are stored null-terminated, so they can be printed directly.
+ * Tags are a comma-separated list (see tags.h); tags_len is 0 for an untagged bookmark.
+ * The id is assigned once, when the bookmark is added, and survives renames,
+ * edits and compactions. Ids are never reused, so they can key per-bookmark data.
+ */
+typedef struct {
+    uint32_t name_offset;
+    uint32_t path_offset;
+    uint32_t tags_offset;
+    uint32_t id;
+    uint16_t name_len;
+    uint16_t path_len;
+    uint16_t tags_len;
+} Bookmark;
+
+/*
+ * In-memory bookmark store: one arena holding the interned name and path bytes,
+ * and a packed array of Bookmark records in file order.
+ * The arena starts out as the strings decoded from bookmarks.snap (see snapshot.h),
+ * or as the contents of a legacy bookmarks.tsv, parsed in place.
+ * A case-insensitive hash table over the records makes lookups O(1).
+ */
+typedef struct {
+    Bookmark *records;
+    size_t count;
+    size_t capacity;
+    char *arena;
+    size_t arena_size;
+    size_t arena_capacity;
+    uint32_t *slots;            // Record index + 1 for each used slot, 0 if empty
+    size_t slot_count;
+    size_t slots_used;
+    uint64_t generation;        // Generation of the snapshot the store was loaded from
+    uint32_t next_id;           // Id of the next bookmark to be added (ids start at 1)
+    size_t snapshot_size;
+    size_t journal_size;
+    int lock_fd;                // Writer lock held by the store, or -1 for read-only stores
+    char *pending;              // Journal records of changes recorded with store_record, written by store_save
+    size_t pending_size;
+    size_t pending_capacity;
+    size_t pending_count;
+    char change[32];            // What the pending records do as a whole ("import", "undo 12"), for 'bm history'
+} BookmarkStore;
+
+/*
+ * Identifies the exact snapshot and bookmarks.journal a view of the store
+ * was built from. The snapshot is replaced by rename(), so its inode changes on
+ * every compaction, while the journal only ever grows between compactions.
+ */
+typedef struct {
+    uint64_t snapshot_ino;
+    uint64_t snapshot_size;
+    int64_t snapshot_mtime_sec;
+    int64_t snapshot_mtime_nsec;
+    uint64_t journal_ino;       // 0 if there is no journal
+    uint64_t journal_size;
+} StoreVersion;
+
+#define STORE_STREAM_BUFFER 65536   // Read size of a StoreStream; every line and snapshot block fits in it
+
+/*
+ * Reads the snapshot a block at a time (or a legacy bookmarks.tsv line by line in fixed-size
+ * chunks), for commands that only need one pass over the bookmarks in file order and
+ * shouldn't load the whole store.
+ */
+typedef struct {
+    int fd;
+    size_t start;               // Unparsed bytes are buffer[start, end)
+    size_t end;
+    bool eof;
+    bool discarding;            // Skipping the rest of a line too long for the buffer
+    bool binary;                // Reading bookmarks.snap rather than bookmarks.tsv
+    uint32_t next_id;           // From the header (0 if a legacy bookmarks.tsv has none)
+    uint32_t blocks_left;       // Snapshot blocks not read yet
+    uint32_t entries_left;      // Records left in the block in the buffer
+    size_t path_len;
+    char name[MAX_NAME];        // The decoded record
+    char path[MAX_PATH];        // Also the previous path, which the next one is front-coded against
+    char tags[MAX_TAG_LIST];
+    char buffer[STORE_STREAM_BUFFER];
+} StoreStream;
+
+/*
+ * A bookmark read from a StoreStream. The strings are null-terminated inside the
+ * stream's buffer and stay valid until the next call to store_stream_next.
+ */
+typedef struct {
+    const char *name;
+    const char *path;
+    const char *tags;           // Comma-separated, "" if untagged
+    uint32_t id;                // 0 for a line of a legacy bookmarks.tsv without one
+    uint16_t name_len;
+    uint16_t path_len;
+    uint16_t tags_len;
+} StreamedBookmark;
+
+/*
+ * Operations recorded in bookmarks.journal. A record is one line:
+ *   <snapshot generation>@<unix time><TAB><op><TAB><arg1>[<TAB><arg2>]<TAB><checksum>
+ * Records written before times were added have no "@<unix time>".
+ */
+typedef enum {
+    JOURNAL_ADD,                // ADD <name> <path>
+    JOURNAL_DEL,                // DEL <name>
+    JOURNAL_REN,                // REN <old_name> <new_name>
+    JOURNAL_EDIT,               // EDIT <name> <path>
+    JOURNAL_TAGS,               // TAGS <name> <tags>, replacing the whole list
+    JOURNAL_UNDEL,              // UNDEL <name> <id><TAB><path>, adding back a deleted bookmark under its old id
+    JOURNAL_MARK,               // MARK <count> <change>: the next count records are one change, applied all or nothing
+} JournalOp;
+
+/*
+ * Returns the name of a bookmark as a null-terminated string inside the arena.
+ */
+static inline const char *bookmark_name(const BookmarkStore *store, const Bookmark *bookmark) {
+    return store->arena + bookmark->name_offset;
+}
+
+/*
+ * Returns the path of a bookmark as a null-terminated string inside the arena.
+ */
+static inline const char *bookmark_path(const BookmarkStore *store, const Bookmark *bookmark) {
+    return store->arena + bookmark->path_offset;
+}
+
+/*
+ * Returns the tags of a bookmark as a null-terminated, comma-separated string ("" if untagged).
+ */
+static inline const char *bookmark_tags(const BookmarkStore *store, const Bookmark *bookmark) {
+    return bookmark->tags_len ? store->arena + bookmark->tags_offset : "";
+}
+
+/*
+ * Load the snapshot into the store with a single read, then replay bookmarks.journal on top of it.
+ * Readers never take the lock, and retry if a compaction replaces the snapshot mid-read.
+ * A legacy bookmarks.tsv is loaded too, then migrated to bookmarks.snap: by writers under
+ * their lock, and for readers of ~/.bm/ by taking the lock once. Other directories (project
+ * and system stores, which are often checked in and edited by hand) keep their bookmarks.tsv.
+ * If version is not NULL, it receives the identity of the files that were read.
+ * Returns 0 on success, 1 on error.
+ * Caller must release the store using store_free, even on error.
+ */
+int store_load(BookmarkStore *store, StoreVersion *version);
+
+/*
+ * Parses a buffer in the bookmarks.snap or bookmarks.tsv format into a new store, which takes ownership of it.
+ * The buffer must be malloc'd and null-terminated at contents[size].
+ * Returns 0 on success, 1 on error (including a snapshot that fails its checksums).
+ * Caller must release the store using store_free, even on error.
+ */
+int store_load_buffer(BookmarkStore *store, char *contents, size_t size);
+
+/*
+ * Takes the writer lock (an exclusive flock on bookmarks.lock), then loads the store.
+ * The lock serializes the whole read-modify-write of a mutation and is released by store_free.
+ * Returns 0 on success, 1 on error.
+ * Caller must release the store using store_free, even on error.
+ */
+int store_load_for_update(BookmarkStore *store, StoreVersion *version);
+
+/*
+ * Records a mutation that has already been applied to the store by appending it to bookmarks.journal.
+ * Once the journal grows past its threshold, a background process compacts it into a new snapshot.
+ * The store must have been loaded with store_load_for_update.
+ * arg2 is ignored for JOURNAL_DEL.
+ * Returns 0 on success, 1 on error.
+ */
+int store_commit(BookmarkStore *store, JournalOp op, const char *arg1, const char *arg2);
+
+/*
+ * Adds a change that has already been applied to the store to its pending records, for commands
+ * that change many bookmarks and then save once (batch, import, doctor, restores).
+ * store_save journals them as one change (named by store->change) before writing the snapshot,
+ * so they reach the history and are never half applied.
+ * arg2 is ignored for JOURNAL_DEL.
+ * Returns 0 on success, 1 on error.
+ */
+int store_record(BookmarkStore *store, JournalOp op, const char *arg1, const char *arg2);
+
+/*
+ * Journals the pending records, writes the store to a fresh bookmarks.snap of the next generation,
+ * replaces the old one with rename(), moves the journal records it supersedes to the history
+ * (see history.h), empties the journal and removes a migrated bookmarks.tsv.
+ * Once pending records are journaled the change is committed, even if the snapshot then fails
+ * (which is reported): loads replay it from the journal.
+ * Returns 0 on success, 1 on error.
+ */
+int store_save(BookmarkStore *store);
+
+/*
+ * Splits a journal record (null-terminated, without its newline) in place into its generation,
+ * op, first argument and the rest, after checking its checksum.
+ * Returns the number of fields (3 or 4), or 0 if the record is torn or malformed.
+ */
+int store_split_record(char *record, char **fields);
+
+/*
+ * Looks up the op of a record split by store_split_record.
+ * Returns the op, or -1 if it is one this version doesn't know.
+ */
+int store_record_op(char **fields);
+
+/*
+ * Joins the fields of a record split by store_split_record back into the record, with its
+ * checksum and newline, in a buffer of size bytes.
+ * Returns the length of the record, or -1 if it doesn't fit.
+ */
+int store_join_record(char **fields, int field_count, char *record, size_t size);
+
+/*
+ * Applies a record split by store_split_record to the store, as a load replays the journal.
+ * Removals only mark the bookmark: call store_purge_removed once done.
+ * Returns true if a bookmark was marked as removed.
+ */
+bool store_apply_record(BookmarkStore *store, char **fields, int field_count);
+
+/*
+ * Called by store_scan_journal for each record, split by store_split_record.
+ */
+typedef void (*JournalVisitor)(void *context, BookmarkStore *store, char **fields, int field_count);
+
+/*
+ * Splits the records of a journal in place and passes those of generations first to last to visit,
+ * in order. Torn records are skipped, and so are MARK groups cut short by a crash, whole.
+ */
+void store_scan_journal(char *journal, size_t size, uint64_t first, uint64_t last, JournalVisitor visit,
+                        BookmarkStore *store, void *context);
+
+/*
+ * Writes an empty snapshot, for 'bm init'.
+ * Returns 0 on success, 1 on error.
+ */
+int store_create(void);
+
+/*
+ * Frees the records, the arena and the hash table of the store.
+ */
+void store_free(BookmarkStore *store);
+
+/*
+ * Finds a bookmark by name (case-insensitive).
+ * Returns the bookmark, or NULL if it doesn't exist.
+ */
+Bookmark *store_find(BookmarkStore *store, const char *name);
+
+/*
+ * Finds the bookmark whose path is the longest prefix of path on a component boundary:
+ * path itself, else its parent, and so on up to "/". Trailing slashes are ignored.
+ * Ties go to the first name in case-folded order, as in index_find_by_path.
+ * Returns the bookmark, or NULL if no bookmark contains path.
+ */
+const Bookmark *store_find_by_path(const BookmarkStore *store, const char *path);
+
+/*
+ * Builds the hash table now rather than on the first store_find, so threads can then
+ * share a loaded store for lookups without writing to it.
+ * Returns 0 on success, 1 on error.
+ */
+int store_prepare_lookups(BookmarkStore *store);
+
+/*
+ * Appends a bookmark to the store with the next unused id.
+ * Returns 0 on success, 1 on error.
+ */
+int store_add(BookmarkStore *store, const char *name, const char *path);
+
+/*
+ * Removes a bookmark from the store, keeping the order of the others.
+ */
+void store_remove(BookmarkStore *store, Bookmark *bookmark);
+
+/*
+ * Marks a bookmark as removed without shifting the others, so long runs of removals stay linear.
+ * Marked bookmarks can't be found anymore and are dropped by store_purge_removed.
+ */
+void store_mark_removed(BookmarkStore *store, Bookmark *bookmark);
+
+/*
+ * Drops every bookmark marked as removed in a single pass, keeping the order of the others.
+ */
+void store_purge_removed(BookmarkStore *store);
+
+/*
+ * Points a bookmark at a new name. The old bytes stay in the arena until the next load.
+ * Returns 0 on success, 1 on error.
+ */
+int store_rename(BookmarkStore *store, Bookmark *bookmark, const char *new_name);
+
+/*
+ * Points a bookmark at a new path. The old bytes stay in the arena until the next load.
+ * Returns 0 on success, 1 on error.
+ */
+int store_set_path(BookmarkStore *store, Bookmark *bookmark, const char *new_path);
+
+/*
+ * Replaces the tags of a bookmark with a comma-separated list ("" removes them all).
+ * The old bytes stay in the arena until the next load.
+ * Returns 0 on success, 1 on error.
+ */
+int store_set_tags(BookmarkStore *store, Bookmark *bookmark, const char *tags);
+
+/*
+ * Stats the snapshot (bookmarks.snap, else bookmarks.tsv) and bookmarks.journal without
+ * reading them or taking the lock.
+ * Returns 0 on success, 1 if neither snapshot exists or can't be accessed.
+ */
+int store_version(StoreVersion *version);
+
+/*
+ * Opens the snapshot for streaming. Streaming is only possible while the journal is
+ * empty (e.g. right after a compaction): then the snapshot alone is the current state.
+ * Returns 0 on success, 1 if the journal has records to replay (use store_load) or on error.
+ * On success the caller must close the stream with store_stream_close.
+ */
+int store_stream_open(StoreStream *stream);
+
+/*
+ * Reads the next bookmark.
+ * Returns 1 if a bookmark was read, 0 at the end of the file, -1 on a read error or a corrupt block.
+ */
+int store_stream_next(StoreStream *stream, StreamedBookmark *bookmark);
+
+/*
+ * Closes a stream opened with store_stream_open.
+ */
+void store_stream_close(StoreStream *stream);
+
+/*
+ * Checks if two versions refer to the same contents of the store.
+ */
+bool store_version_equal(const StoreVersion *a, const StoreVersion *b);
+
+/*
+ * FNV-1a over the case-folded name. Also reports the name's length.
+ * Never returns 0, so callers can use 0 to mark empty hash slots.
+ */
+uint32_t bookmark_hash(const char *name, size_t *len);
+
+/*
+ * Writes the whole buffer, retrying on short writes.
+ * Returns 0 on success, 1 on error.
+ */
+int write_all(int fd, const void *buffer, size_t size);
+
+/*
+ * Sets where the calling thread's store operations find the bookmark files, and whether
+ * they print their errors. directory must end with '/' and outlive its use; NULL selects ~/.bm/.
+ * libbm sets this around each call, so the CLI (which never does) keeps the defaults.
+ */
+void store_set_thread_context(const char *directory, bool quiet);
+
+/*
+ * Prints an error message to stderr, unless the calling thread was made quiet with store_set_thread_context.
+ */
+void store_error(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/*
+ * Writes the path to an entry inside ~/.bm/ (e.g. BOOKMARK_FILE) into buffer, without allocating.
+ * Returns 0 on success, 1 if the HOME environment variable is not set or the path doesn't fit.
+ */
+int store_entry_path(char *buffer, size_t size, const char *entry);
+
+/*
+ * Returns the path to bookmarks.snap.
+ * If the HOME environment variable is not set, NULL is returned.
+ */
+char *get_bookmark_file_path(void);
+
+/*
+ * Returns the path to bookmarks.tsv, the text format the snapshot is migrated from.
+ * If the HOME environment variable is not set, NULL is returned.
+ */
+char *get_bookmark_tsv_path(void);
+
+/*
+ * Returns the path to /.bm/ unless the HOME environment variable is not set
+ * If it is not set, then NULL is returned
+ */
+char *get_bookmark_dir_path(void);
+
+/*
+ * Returns the path to bookmarks.idx, the hashed index kept next to the snapshot.
+ * If the HOME environment variable is not set, NULL is returned.
+ */
+char *get_bookmark_index_path(void);
+
+/*
+ * Returns the path to bookmarks.journal, the log of mutations since the last snapshot.
+ * If the HOME environment variable is not set, NULL is returned.
+ */
+char *get_bookmark_journal_path(void);
+
+/*
+ * Returns the path to bookmarks.lock, which writers lock to serialize mutations.
+ * If the HOME environment variable is not set, NULL is returned.
+ */
+char *get_bookmark_lock_path(void);
+
+/*
+ * Returns the path to bm.sock, the socket a running 'bm daemon' listens on.
+ * If the HOME environment variable is not set, NULL is returned.
+ */
+char *get_bookmark_socket_path(void);
+
+/*
+ * Returns the path to bookmarks.usage, the visit counters kept next to the snapshot.
+ * If the HOME environment variable is not set, NULL is returned.
+ */
+char *get_bookmark_usage_path(void);
+
+#endif
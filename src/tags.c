@@ -0,0 +1,386 @@
+#include "tags.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RUN_MAX 0xffffffffull       // Longest run of clean words in one marker
+#define LITERALS_MAX 0x7fffffffull  // Most literal words after one marker
+
+// One tag of one bookmark, while grouping the tags of a store
+typedef struct {
+    const char *tag;
+    uint32_t len;
+    uint32_t position;
+} TagOccurrence;
+
+// Helper functions
+static int compare_occurrences(const void *a, const void *b);
+static int append_words(TagTable *table, size_t *marker, uint64_t word, uint64_t repeat);
+static bool next_tag(const char **cursor, char *tag);
+static size_t split_tags(const char *tags, const char **items, size_t *lens, size_t max);
+
+bool tag_normalize(char *tag) {
+    size_t len = 0;
+    for (char *c = tag; *c; c++, len++) {
+        *c = tolower((unsigned char) *c);
+        if (!isalnum((unsigned char) *c) && *c != '.' && *c != '_' && *c != '-') return false;
+    }
+    return len > 0 && len < MAX_TAG;
+}
+
+bool tags_contain(const char *tags, const char *tag) {
+    size_t len = strlen(tag);
+    for (const char *item = tags; *item;) {
+        const char *comma = strchr(item, ',');
+        size_t item_len = comma ? (size_t) (comma - item) : strlen(item);
+        if (item_len == len && memcmp(item, tag, len) == 0) return true;
+        if (!comma) break;
+        item = comma + 1;
+    }
+    return false;
+}
+
+int tags_insert(char *buffer, const char *tags, const char *tag) {
+    const char *items[MAX_TAGS + 1];
+    size_t lens[MAX_TAGS + 1];
+    size_t count = split_tags(tags, items, lens, MAX_TAGS);
+    size_t len = strlen(tag);
+
+    // Keep the list sorted, so equal sets are equal strings
+    size_t at = 0;
+    while (at < count) {
+        size_t shorter = lens[at] < len ? lens[at] : len;
+        int order = memcmp(items[at], tag, shorter);
+        if (order == 0 && lens[at] == len) {
+            snprintf(buffer, MAX_TAG_LIST, "%s", tags);
+            return 0;
+        }
+        if (order > 0 || (order == 0 && lens[at] > len)) break;
+        at++;
+    }
+    if (count == MAX_TAGS) return 1;
+
+    memmove(items + at + 1, items + at, (count - at) * sizeof(items[0]));
+    memmove(lens + at + 1, lens + at, (count - at) * sizeof(lens[0]));
+    items[at] = tag;
+    lens[at] = len;
+    count++;
+
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) buffer[offset++] = ',';
+        memcpy(buffer + offset, items[i], lens[i]);
+        offset += lens[i];
+    }
+    buffer[offset] = '\0';
+    return 0;
+}
+
+void tags_remove(char *buffer, const char *tags, const char *tag) {
+    const char *items[MAX_TAGS];
+    size_t lens[MAX_TAGS];
+    size_t count = split_tags(tags, items, lens, MAX_TAGS);
+    size_t len = strlen(tag);
+
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (lens[i] == len && memcmp(items[i], tag, len) == 0) continue;
+        if (offset > 0) buffer[offset++] = ',';
+        memcpy(buffer + offset, items[i], lens[i]);
+        offset += lens[i];
+    }
+    buffer[offset] = '\0';
+}
+
+int tag_table_build(TagTable *table, const BookmarkStore *store) {
+    table->tags = NULL;
+    table->count = 0;
+    table->word_count = (store->count + 63) / 64;
+    table->words = NULL;
+    table->words_size = 0;
+    table->words_capacity = 0;
+
+    size_t total = 0;
+    for (size_t i = 0; i < store->count; i++) {
+        const Bookmark *bookmark = &store->records[i];
+        if (bookmark->tags_len == 0) continue;
+        total++;
+        for (const char *c = bookmark_tags(store, bookmark); *c; c++) {
+            if (*c == ',') total++;
+        }
+    }
+    if (total == 0) return 0;
+
+    TagOccurrence *occurrences = malloc(total * sizeof(TagOccurrence));
+    if (!occurrences) {
+        store_error("Failed to allocate memory for the tag bitmaps: %s\n", strerror(errno));
+        return 1;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < store->count; i++) {
+        const Bookmark *bookmark = &store->records[i];
+        if (bookmark->tags_len == 0) continue;
+        const char *item = bookmark_tags(store, bookmark);
+        for (;;) {
+            const char *comma = strchr(item, ',');
+            size_t len = comma ? (size_t) (comma - item) : strlen(item);
+            if (len > 0 && len < MAX_TAG) {
+                occurrences[count].tag = item;
+                occurrences[count].len = len;
+                occurrences[count].position = i;
+                count++;
+            }
+            if (!comma) break;
+            item = comma + 1;
+        }
+    }
+
+    // Grouping by sorting keeps the build O(n log n) however many distinct tags there are
+    qsort(occurrences, count, sizeof(TagOccurrence), compare_occurrences);
+
+    size_t distinct = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || occurrences[i - 1].len != occurrences[i].len ||
+            memcmp(occurrences[i - 1].tag, occurrences[i].tag, occurrences[i].len) != 0) {
+            distinct++;
+        }
+    }
+    table->tags = calloc(distinct ? distinct : 1, sizeof(TagBitmap));
+    if (!table->tags) {
+        store_error("Failed to allocate memory for the tag bitmaps: %s\n", strerror(errno));
+        free(occurrences);
+        return 1;
+    }
+
+    // Occurrences are grouped by tag and ordered by position, so each bitmap is appended word by word
+    TagBitmap *current = NULL;
+    size_t marker = 0, next_word = 0, pending_word = 0;
+    uint64_t pending = 0;
+    for (size_t i = 0; i <= count; i++) {
+        const TagOccurrence *occurrence = i < count ? &occurrences[i] : NULL;
+        size_t word = occurrence ? occurrence->position / 64 : 0;
+        bool new_tag = !current || !occurrence || strlen(current->name) != occurrence->len ||
+                       memcmp(current->name, occurrence->tag, occurrence->len) != 0;
+
+        // Flush the word being filled once the next occurrence is past it, and the zeros up to that
+        if (current && (new_tag || word != pending_word)) {
+            if (append_words(table, &marker, 0, pending_word - next_word) != 0 ||
+                append_words(table, &marker, pending, 1) != 0) {
+                free(occurrences);
+                return 1;
+            }
+            next_word = pending_word + 1;
+            pending = 0;
+        }
+        if (current && new_tag) {
+            if (append_words(table, &marker, 0, table->word_count - next_word) != 0) {
+                free(occurrences);
+                return 1;
+            }
+            current->words_size = table->words_size - current->words_offset;
+        }
+        if (!occurrence) break;
+
+        if (new_tag) {
+            current = &table->tags[table->count++];
+            memcpy(current->name, occurrence->tag, occurrence->len);
+            current->name[occurrence->len] = '\0';
+            current->words_offset = table->words_size;
+            marker = SIZE_MAX;
+            next_word = 0;
+        }
+        pending_word = word;
+        pending |= 1ull << (occurrence->position % 64);
+    }
+
+    free(occurrences);
+    return 0;
+}
+
+bool tag_table_lookup(const void *source, const char *tag, uint64_t *words, size_t word_count) {
+    const TagTable *table = source;
+    size_t low = 0, high = table->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = strcmp(table->tags[middle].name, tag);
+        if (order == 0) {
+            const TagBitmap *bitmap = &table->tags[middle];
+            return bitmap_expand(table->words + bitmap->words_offset, bitmap->words_size, words, word_count);
+        }
+        if (order < 0) low = middle + 1;
+        else high = middle;
+    }
+    return false;
+}
+
+void tag_table_free(TagTable *table) {
+    free(table->tags);
+    free(table->words);
+    table->tags = NULL;
+    table->count = 0;
+    table->words = NULL;
+    table->words_size = 0;
+    table->words_capacity = 0;
+}
+
+bool bitmap_expand(const uint64_t *compressed, size_t size, uint64_t *words, size_t word_count) {
+    size_t filled = 0;
+    for (size_t i = 0; i < size;) {
+        uint64_t marker = compressed[i++];
+        uint64_t run = (marker >> 1) & RUN_MAX;
+        uint64_t literals = marker >> 33;
+        if (run > word_count - filled || literals > word_count - filled - run || literals > size - i) return false;
+
+        memset(words + filled, marker & 1 ? 0xff : 0, run * sizeof(uint64_t));
+        filled += run;
+        memcpy(words + filled, compressed + i, literals * sizeof(uint64_t));
+        filled += literals;
+        i += literals;
+    }
+    return filled == word_count;
+}
+
+uint64_t *tags_select(const char *all, const char *any, const char *none, TagLookup lookup, const void *source, size_t bit_count) {
+    size_t word_count = (bit_count + 63) / 64;
+    uint64_t *result = malloc((word_count ? word_count : 1) * 3 * sizeof(uint64_t));
+    if (!result) {
+        store_error("Failed to allocate memory for the tag query: %s\n", strerror(errno));
+        return NULL;
+    }
+    uint64_t *words = result + word_count;
+    uint64_t *matched = words + word_count;
+    memset(result, 0xff, word_count * sizeof(uint64_t));
+
+    // Each condition is one pass over the words, which the compiler vectorizes
+    char tag[MAX_TAG];
+    const char *cursor = all;
+    while (next_tag(&cursor, tag)) {
+        if (!lookup(source, tag, words, word_count)) {
+            memset(result, 0, word_count * sizeof(uint64_t));
+            break;
+        }
+        for (size_t i = 0; i < word_count; i++) result[i] &= words[i];
+    }
+
+    if (any && *any) {
+        memset(matched, 0, word_count * sizeof(uint64_t));
+        cursor = any;
+        while (next_tag(&cursor, tag)) {
+            if (!lookup(source, tag, words, word_count)) continue;
+            for (size_t i = 0; i < word_count; i++) matched[i] |= words[i];
+        }
+        for (size_t i = 0; i < word_count; i++) result[i] &= matched[i];
+    }
+
+    cursor = none;
+    while (next_tag(&cursor, tag)) {
+        if (!lookup(source, tag, words, word_count)) continue;
+        for (size_t i = 0; i < word_count; i++) result[i] &= ~words[i];
+    }
+
+    if (bit_count % 64) result[word_count - 1] &= (1ull << (bit_count % 64)) - 1;
+    return result;
+}
+
+// Helper functions
+
+/*
+ * Orders tag occurrences by tag in byte order, then by position.
+ */
+static int compare_occurrences(const void *a, const void *b) {
+    const TagOccurrence *first = a, *second = b;
+    uint32_t shorter = first->len < second->len ? first->len : second->len;
+    int order = memcmp(first->tag, second->tag, shorter);
+    if (order != 0) return order;
+    if (first->len != second->len) return first->len < second->len ? -1 : 1;
+    return (first->position > second->position) - (first->position < second->position);
+}
+
+/*
+ * Appends repeat copies of a word to the compressed bitmap being built at the end of table->words.
+ * marker is the position of the bitmap's last marker word, SIZE_MAX before its first; clean words
+ * extend its run while it has no literals, dirty ones are added as its literals.
+ * Returns 0 on success, 1 on error.
+ */
+static int append_words(TagTable *table, size_t *marker, uint64_t word, uint64_t repeat) {
+    bool clean = word == 0 || word == ~0ull;
+    uint64_t value = word == ~0ull;
+    while (repeat > 0) {
+        // A marker and a literal at most
+        if (table->words_size + 2 > table->words_capacity) {
+            size_t capacity = table->words_capacity ? table->words_capacity * 2 : 64;
+            uint64_t *words = realloc(table->words, capacity * sizeof(uint64_t));
+            if (!words) {
+                store_error("Failed to allocate memory for the tag bitmaps: %s\n", strerror(errno));
+                return 1;
+            }
+            table->words = words;
+            table->words_capacity = capacity;
+        }
+
+        uint64_t current = *marker != SIZE_MAX ? table->words[*marker] : 0;
+        uint64_t run = (current >> 1) & RUN_MAX;
+        uint64_t literals = current >> 33;
+        if (clean) {
+            if (*marker == SIZE_MAX || literals > 0 || (current & 1) != value || run == RUN_MAX) {
+                *marker = table->words_size++;
+                table->words[*marker] = value;
+                run = 0;
+            }
+            uint64_t added = repeat < RUN_MAX - run ? repeat : RUN_MAX - run;
+            table->words[*marker] = value | (run + added) << 1;
+            repeat -= added;
+        }
+        else {
+            if (*marker == SIZE_MAX || literals == LITERALS_MAX) {
+                *marker = table->words_size++;
+                table->words[*marker] = 0;
+            }
+            table->words[table->words_size++] = word;
+            table->words[*marker] += 1ull << 33;
+            repeat--;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Copies the next tag of a comma-separated list into tag, normalized, and advances the cursor.
+ * A tag that isn't valid comes out as "", which no bookmark has.
+ * Returns false at the end of the list (or if the list is NULL).
+ */
+static bool next_tag(const char **cursor, char *tag) {
+    const char *item = *cursor;
+    if (!item || !*item) return false;
+
+    const char *comma = strchr(item, ',');
+    size_t len = comma ? (size_t) (comma - item) : strlen(item);
+    *cursor = comma ? comma + 1 : item + len;
+
+    if (len >= MAX_TAG) len = 0;
+    memcpy(tag, item, len);
+    tag[len] = '\0';
+    if (!tag_normalize(tag)) tag[0] = '\0';
+    return true;
+}
+
+/*
+ * Splits a comma-separated list into at most max items, without copying.
+ * Returns the number of items.
+ */
+static size_t split_tags(const char *tags, const char **items, size_t *lens, size_t max) {
+    size_t count = 0;
+    for (const char *item = tags; *item && count < max;) {
+        const char *comma = strchr(item, ',');
+        items[count] = item;
+        lens[count] = comma ? (size_t) (comma - item) : strlen(item);
+        count++;
+        if (!comma) break;
+        item = comma + 1;
+    }
+    return count;
+}
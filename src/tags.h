@@ -0,0 +1,106 @@
+#ifndef TAGS_H
+
+#define TAGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "store.h"
+
+/*
+ * Tags are lowercase words of letters, digits, '.', '_' and '-', kept with each bookmark
+ * as a sorted, comma-separated list ("env.prod,team-a").
+ *
+ * For queries, each tag maps to a bitmap with one bit per bookmark, by position in the
+ * store. Combining tags is then an AND, OR or AND NOT over 64-bit words, 64 bookmarks
+ * at a time. bookmarks.idx keeps the bitmaps compressed: a marker word holds a run of
+ * all-zero or all-one words (bit 0 is the run's value, bits 1-32 its length) and the
+ * number of literal words that follow it (bits 33-63).
+ */
+
+// The bitmaps of every tag in a store, compressed, each word_count words once expanded
+typedef struct {
+    char name[MAX_TAG];
+    size_t words_offset;        // Into TagTable.words
+    size_t words_size;
+} TagBitmap;
+
+typedef struct {
+    TagBitmap *tags;            // Sorted by name
+    size_t count;
+    size_t word_count;
+    uint64_t *words;            // Every compressed bitmap, one after the other
+    size_t words_size;
+    size_t words_capacity;
+} TagTable;
+
+/*
+ * Fills words (word_count long) with the bitmap of a tag.
+ * Returns true if the tag exists, false otherwise.
+ */
+typedef bool (*TagLookup)(const void *source, const char *tag, uint64_t *words, size_t word_count);
+
+/*
+ * Lowercases a tag in place and checks its characters and length.
+ * Returns true if the tag is valid, false otherwise.
+ */
+bool tag_normalize(char *tag);
+
+/*
+ * Checks if a comma-separated list contains a tag.
+ */
+bool tags_contain(const char *tags, const char *tag);
+
+/*
+ * Writes the sorted union of a comma-separated list and one tag into buffer (MAX_TAG_LIST long).
+ * Returns 0 on success, 1 if the bookmark would have more than MAX_TAGS tags.
+ */
+int tags_insert(char *buffer, const char *tags, const char *tag);
+
+/*
+ * Writes a comma-separated list without one tag into buffer (MAX_TAG_LIST long).
+ */
+void tags_remove(char *buffer, const char *tags, const char *tag);
+
+/*
+ * Builds the bitmap of every tag in the store, one bit per record position. Each bitmap is
+ * compressed as it is built, so memory grows with the number of tag occurrences, not with
+ * the number of tags times the number of bookmarks.
+ * Returns 0 on success, 1 on error.
+ * Caller must release the table using tag_table_free, even on error.
+ */
+int tag_table_build(TagTable *table, const BookmarkStore *store);
+
+/*
+ * A TagLookup over a TagTable.
+ */
+bool tag_table_lookup(const void *table, const char *tag, uint64_t *words, size_t word_count);
+
+/*
+ * Frees the bitmaps of the table.
+ */
+void tag_table_free(TagTable *table);
+
+/*
+ * Expands a compressed bitmap of size words into exactly word_count words.
+ * Returns true on success, false if the bitmap is malformed or of another length.
+ */
+bool bitmap_expand(const uint64_t *compressed, size_t size, uint64_t *words, size_t word_count);
+
+/*
+ * Selects the bookmarks that have every tag of all, at least one tag of any and none
+ * of the tags of none (comma-separated lists, NULL for no condition), looking the
+ * bitmaps up through lookup. Bits past bit_count are cleared.
+ * Returns a malloc'd bitmap of (bit_count + 63) / 64 words, or NULL on error.
+ */
+uint64_t *tags_select(const char *all, const char *any, const char *none, TagLookup lookup, const void *source, size_t bit_count);
+
+/*
+ * Checks if bit position is set in a bitmap.
+ */
+static inline bool bitmap_test(const uint64_t *words, size_t position) {
+    return (words[position / 64] >> (position % 64)) & 1;
+}
+
+#endif
@@ -0,0 +1,203 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+typedef enum {
+    COUNT_OPENS,
+    COUNT_READS,
+    COUNT_WRITES,
+    COUNT_ALLOCS,
+    COUNTER_COUNT,
+} TraceCounter;
+
+typedef struct {
+    const char *name;
+    int64_t start_ns;
+    uint64_t start_counts[COUNTER_COUNT];
+    int64_t elapsed_ns;
+    uint64_t counts[COUNTER_COUNT];
+} TracePhase;
+
+bool trace_enabled = false;
+
+static const char *trace_command;
+static const char *trace_file;      // NULL for stderr
+static int64_t trace_start_ns;
+static TracePhase phases[TRACE_MAX_PHASES];
+static int phase_count;
+
+// Updated from any thread (validate.c and daemon.c run workers)
+static uint64_t counters[COUNTER_COUNT];
+
+// The real functions, resolved by 'ld --wrap'
+int __real_open(const char *path, int flags, ...);
+FILE *__real_fopen(const char *path, const char *mode);
+ssize_t __real_read(int fd, void *buffer, size_t size);
+size_t __real_fread(void *buffer, size_t size, size_t count, FILE *file);
+ssize_t __real_write(int fd, const void *buffer, size_t size);
+ssize_t __real_writev(int fd, const struct iovec *parts, int count);
+size_t __real_fwrite(const void *buffer, size_t size, size_t count, FILE *file);
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+char *__real_strdup(const char *string);
+
+// Helper functions
+static int64_t now_ns(void);
+static void count(TraceCounter counter);
+static void end_phase(void);
+
+void trace_start(bool requested, const char *command) {
+    const char *setting = getenv(TRACE_ENV);
+    bool from_env = setting && setting[0] && strcmp(setting, "0") != 0;
+    if (!requested && !from_env) return;
+
+    trace_file = from_env && strcmp(setting, "1") != 0 && strcmp(setting, "stderr") != 0 ? setting : NULL;
+    trace_command = command;
+    trace_start_ns = now_ns();
+    trace_enabled = true;
+    trace_phase("setup");
+}
+
+void trace_phase(const char *name) {
+    if (phase_count > 0) end_phase();
+    if (phase_count < TRACE_MAX_PHASES) phases[phase_count++].name = name;     // Out of room: keep adding to the last phase
+
+    TracePhase *phase = &phases[phase_count - 1];
+    phase->start_ns = now_ns();
+    for (int i = 0; i < COUNTER_COUNT; i++) phase->start_counts[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+}
+
+void trace_finish(int status) {
+    if (!trace_enabled) return;
+    end_phase();
+    trace_enabled = false;      // The report itself shouldn't be counted
+
+    char report[TRACE_MAX_PHASES * 160 + 256];
+    size_t length = 0;
+    pid_t pid = getpid();
+    for (int i = 0; i < phase_count; i++) {
+        const TracePhase *phase = &phases[i];
+        length += snprintf(report + length, sizeof(report) - length,
+                           "bm_trace pid=%d command=%s phase=%s us=%lld opens=%llu reads=%llu writes=%llu allocs=%llu\n",
+                           (int) pid, trace_command, phase->name, (long long) (phase->elapsed_ns / 1000),
+                           (unsigned long long) phase->counts[COUNT_OPENS], (unsigned long long) phase->counts[COUNT_READS],
+                           (unsigned long long) phase->counts[COUNT_WRITES], (unsigned long long) phase->counts[COUNT_ALLOCS]);
+        if (length >= sizeof(report)) return;
+    }
+    length += snprintf(report + length, sizeof(report) - length,
+                       "bm_trace pid=%d command=%s phase=total us=%lld opens=%llu reads=%llu writes=%llu allocs=%llu status=%d\n",
+                       (int) pid, trace_command, (long long) ((now_ns() - trace_start_ns) / 1000),
+                       (unsigned long long) counters[COUNT_OPENS], (unsigned long long) counters[COUNT_READS],
+                       (unsigned long long) counters[COUNT_WRITES], (unsigned long long) counters[COUNT_ALLOCS], status);
+    if (length >= sizeof(report)) return;
+
+    int fd = STDERR_FILENO;
+    if (trace_file) {
+        fd = __real_open(trace_file, O_WRONLY | O_APPEND | O_CREAT, 0600);
+        if (fd == -1) {
+            fprintf(stderr, "Failed to open %s: %s\n", trace_file, strerror(errno));
+            return;
+        }
+    }
+    if (__real_write(fd, report, length) != (ssize_t) length) {
+        fprintf(stderr, "Failed to write the trace report: %s\n", strerror(errno));
+    }
+    if (trace_file) close(fd);
+}
+
+// Wrappers installed with 'ld --wrap': count the call, then forward it
+
+int __wrap_open(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+    count(COUNT_OPENS);
+    return __real_open(path, flags, mode);
+}
+
+FILE *__wrap_fopen(const char *path, const char *mode) {
+    count(COUNT_OPENS);
+    return __real_fopen(path, mode);
+}
+
+ssize_t __wrap_read(int fd, void *buffer, size_t size) {
+    count(COUNT_READS);
+    return __real_read(fd, buffer, size);
+}
+
+size_t __wrap_fread(void *buffer, size_t size, size_t items, FILE *file) {
+    count(COUNT_READS);
+    return __real_fread(buffer, size, items, file);
+}
+
+ssize_t __wrap_write(int fd, const void *buffer, size_t size) {
+    count(COUNT_WRITES);
+    return __real_write(fd, buffer, size);
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *parts, int part_count) {
+    count(COUNT_WRITES);
+    return __real_writev(fd, parts, part_count);
+}
+
+size_t __wrap_fwrite(const void *buffer, size_t size, size_t items, FILE *file) {
+    count(COUNT_WRITES);
+    return __real_fwrite(buffer, size, items, file);
+}
+
+void *__wrap_malloc(size_t size) {
+    count(COUNT_ALLOCS);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t items, size_t size) {
+    count(COUNT_ALLOCS);
+    return __real_calloc(items, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    count(COUNT_ALLOCS);
+    return __real_realloc(pointer, size);
+}
+
+char *__wrap_strdup(const char *string) {
+    count(COUNT_ALLOCS);
+    return __real_strdup(string);
+}
+
+// Helper functions
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void count(TraceCounter counter) {
+    if (trace_enabled) __atomic_fetch_add(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Closes the current phase: records its duration and the calls made since it started.
+ */
+static void end_phase(void) {
+    TracePhase *phase = &phases[phase_count - 1];
+    phase->elapsed_ns += now_ns() - phase->start_ns;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        phase->counts[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED) - phase->start_counts[i];
+    }
+}
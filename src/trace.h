@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+
+#define TRACE_H
+
+#include <stdbool.h>
+
+#define TRACE_ENV "BM_TRACE"
+#define TRACE_MAX_PHASES 32
+
+/*
+ * Opt-in instrumentation, enabled with 'bm --trace <command>' or BM_TRACE=1 (report to stderr)
+ * or BM_TRACE=<file> (append the report to a file).
+ *
+ * The run is split into named phases. Each phase records its wall-clock time (CLOCK_MONOTONIC)
+ * and how many open/fopen, read/fread, write/writev/fwrite and malloc/calloc/realloc/strdup calls bm
+ * made during it. The calls are counted by wrappers linked in with 'ld --wrap' (see the Makefile),
+ * so no call site needs to know about tracing.
+ *
+ * The report is one line per phase plus a total, as space-separated key=value pairs:
+ *   bm_trace pid=4242 command=go phase=index us=31 opens=1 reads=0 writes=0 allocs=1
+ *   bm_trace pid=4242 command=go phase=total us=412 opens=3 reads=1 writes=0 allocs=4 status=0
+ *
+ * When tracing is off, TRACE_PHASE is a single branch and each wrapped call one more.
+ */
+extern bool trace_enabled;
+
+#define TRACE_PHASE(name) do { if (trace_enabled) trace_phase(name); } while (0)
+
+/*
+ * Enables tracing if requested is true or BM_TRACE is set, and starts the "setup" phase.
+ */
+void trace_start(bool requested, const char *command);
+
+/*
+ * Ends the current phase and starts a new one. Use TRACE_PHASE instead of calling this directly.
+ */
+void trace_phase(const char *name);
+
+/*
+ * Ends the last phase and writes the report with a single write(), so reports from
+ * concurrent processes appended to the same file never interleave. No-op when tracing is off.
+ */
+void trace_finish(int status);
+
+#endif
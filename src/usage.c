@@ -0,0 +1,158 @@
+#include "usage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Helper functions
+static int map_file(UsageMap *usage, int fd, size_t size, int protection);
+
+int usage_open(UsageMap *usage) {
+    memset(usage, 0, sizeof(*usage));
+
+    char *path = get_bookmark_usage_path();
+    if (!path) return 1;
+
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1) return errno == ENOENT ? 0 : 1;
+
+    struct stat st;
+    int status = 1;
+    if (fstat(fd, &st) == 0) {
+        status = (size_t) st.st_size < sizeof(UsageHeader) ? 0 : map_file(usage, fd, st.st_size, PROT_READ);
+    }
+    close(fd);
+
+    if (status == 0 && usage->map && ((const UsageHeader *) usage->map)->magic != USAGE_MAGIC) {
+        usage_close(usage);     // Not a usage file (or a version we don't know): ignore it
+    }
+    return status;
+}
+
+void usage_close(UsageMap *usage) {
+    if (usage->map) munmap(usage->map, usage->map_size);
+    memset(usage, 0, sizeof(*usage));
+}
+
+const UsageRecord *usage_get(const UsageMap *usage, uint32_t id) {
+    if (id >= usage->count || usage->records[id].visits == 0) return NULL;
+    return &usage->records[id];
+}
+
+int usage_record_visit(uint32_t id) {
+    UsageMap usage;
+    if (usage_open_for_update(&usage, id) != 0) {
+        usage_close(&usage);
+        return 1;
+    }
+    usage_add(&usage, id, 1, time(NULL));
+    usage_close(&usage);
+    return 0;
+}
+
+int usage_open_for_update(UsageMap *usage, uint32_t max_id) {
+    memset(usage, 0, sizeof(*usage));
+
+    // Runs after every successful 'bm go', so the path stays on the stack
+    char path[MAX_PATH];
+    if (store_entry_path(path, sizeof(path), USAGE_FILE) != 0) return 1;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        store_error("Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // posix_fallocate never shrinks a file, so racing processes can only grow it
+    size_t records = ((size_t) max_id / USAGE_GROWTH + 1) * USAGE_GROWTH;
+    size_t size = sizeof(UsageHeader) + records * sizeof(UsageRecord);
+    struct stat st;
+    int error = 0;
+    if (fstat(fd, &st) == -1) error = errno;
+    else if ((size_t) st.st_size < size) error = posix_fallocate(fd, 0, size);
+    if (error != 0) {
+        store_error("Failed to grow %s: %s\n", path, strerror(error));
+        close(fd);
+        return 1;
+    }
+
+    int status = map_file(usage, fd, size, PROT_READ | PROT_WRITE);
+    close(fd);
+    if (status != 0) return 1;
+
+    // A fresh file is all zeros; every process that sees that stamps the same header
+    UsageHeader *header = usage->map;
+    uint32_t expected = 0;
+    if (!__atomic_compare_exchange_n(&header->magic, &expected, USAGE_MAGIC, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) &&
+        expected != USAGE_MAGIC) {
+        usage_close(usage);
+        return 1;
+    }
+    __atomic_store_n(&header->version, USAGE_VERSION, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void usage_add(UsageMap *usage, uint32_t id, uint64_t visits, int64_t last_visit) {
+    UsageRecord *record = &usage->records[id];
+    __atomic_fetch_add(&record->visits, visits, __ATOMIC_RELAXED);
+
+    int64_t previous = __atomic_load_n(&record->last_visit, __ATOMIC_RELAXED);
+    while (previous < last_visit &&
+           !__atomic_compare_exchange_n(&record->last_visit, &previous, last_visit, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void usage_reset(UsageMap *usage, uint32_t id) {
+    UsageRecord *record = &usage->records[id];
+    __atomic_store_n(&record->visits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&record->last_visit, 0, __ATOMIC_RELAXED);
+}
+
+double usage_frecency(const UsageRecord *record, time_t now) {
+    if (!record) return 0;
+
+    int64_t age = now - record->last_visit;
+    double weight = age < 3600 ? 4 : age < 86400 ? 2 : age < 604800 ? 0.5 : 0.25;
+    return record->visits * weight;
+}
+
+double *usage_frecency_table(const UsageMap *usage, const BookmarkStore *store, time_t now) {
+    double *frecency = malloc((store->count ? store->count : 1) * sizeof(double));
+    if (!frecency) {
+        store_error("Failed to allocate memory for frecency: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    for (size_t i = 0; i < store->count; i++) {
+        frecency[i] = usage_frecency(usage_get(usage, store->records[i].id), now);
+    }
+    return frecency;
+}
+
+// Helper functions
+
+/*
+ * Maps the first size bytes of the usage file (MAP_SHARED, so updates are visible to every process).
+ * Returns 0 on success, 1 on error.
+ */
+static int map_file(UsageMap *usage, int fd, size_t size, int protection) {
+    memset(usage, 0, sizeof(*usage));
+
+    void *map = mmap(NULL, size, protection, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        store_error("Failed to map the usage file: %s\n", strerror(errno));
+        return 1;
+    }
+
+    usage->map = map;
+    usage->map_size = size;
+    usage->records = (UsageRecord *) ((UsageHeader *) map + 1);
+    usage->count = (size - sizeof(UsageHeader)) / sizeof(UsageRecord);
+    return 0;
+}
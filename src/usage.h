@@ -0,0 +1,101 @@
+#ifndef USAGE_H
+
+#define USAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "store.h"
+
+#define USAGE_FILE "bookmarks.usage"
+
+#define USAGE_MAGIC 0x31475355u     // "USG1" in little-endian byte order
+#define USAGE_VERSION 1
+#define USAGE_GROWTH 256            // The file grows by this many records at a time
+
+/*
+ * On-disk layout of bookmarks.usage:
+ *   UsageHeader | UsageRecord[...]
+ *
+ * Record i belongs to the bookmark with id i (ids start at 1, so record 0 is unused).
+ * Records have a fixed size and are updated in place with atomic operations through
+ * a shared mapping, so recording a visit never rewrites the snapshot and never takes
+ * the writer lock. Since ids are never reused, records of deleted bookmarks are just left behind.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t reserved;
+} UsageHeader;
+
+typedef struct {
+    uint64_t visits;
+    int64_t last_visit;         // Seconds since the epoch, 0 if never visited
+} UsageRecord;
+
+typedef struct {
+    void *map;
+    size_t map_size;
+    UsageRecord *records;
+    size_t count;
+} UsageMap;
+
+/*
+ * Maps bookmarks.usage for reading. A missing file is an empty map, not an error.
+ * Returns 0 on success, 1 on error.
+ * Caller must release the map using usage_close, even on error.
+ */
+int usage_open(UsageMap *usage);
+
+/*
+ * Unmaps the usage file.
+ */
+void usage_close(UsageMap *usage);
+
+/*
+ * Returns the record of a bookmark, or NULL if it has never been visited.
+ */
+const UsageRecord *usage_get(const UsageMap *usage, uint32_t id);
+
+/*
+ * Counts a visit to a bookmark: atomically increments its counter and stamps the time.
+ * Concurrent visits from other processes are never lost. Creates or grows the file as needed.
+ * Returns 0 on success, 1 on error.
+ */
+int usage_record_visit(uint32_t id);
+
+/*
+ * Maps bookmarks.usage for writing, with records for every id up to max_id.
+ * Creates or grows the file as needed.
+ * Returns 0 on success, 1 on error.
+ * Caller must release the map using usage_close, even on error.
+ */
+int usage_open_for_update(UsageMap *usage, uint32_t max_id);
+
+/*
+ * Atomically adds visits to a bookmark's counter and moves its last visit forward to last_visit.
+ * The map must have been opened with usage_open_for_update, with room for id.
+ */
+void usage_add(UsageMap *usage, uint32_t id, uint64_t visits, int64_t last_visit);
+
+/*
+ * Clears the record of a bookmark, as if it had never been visited.
+ * The map must have been opened with usage_open_for_update, with room for id.
+ */
+void usage_reset(UsageMap *usage, uint32_t id);
+
+/*
+ * Ranks a bookmark by how often and how recently it was visited. Visits count
+ * 4x within the last hour, 2x within the last day, 1/2 within the last week and 1/4 after that.
+ */
+double usage_frecency(const UsageRecord *record, time_t now);
+
+/*
+ * Computes the frecency of every bookmark in the store, in record order.
+ * Returns a malloc'd array of store->count values, or NULL on error.
+ */
+double *usage_frecency_table(const UsageMap *usage, const BookmarkStore *store, time_t now);
+
+#endif
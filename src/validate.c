@@ -0,0 +1,255 @@
+#include "validate.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define POLL_INTERVAL_MS 50
+
+enum { JOB_PENDING, JOB_RUNNING, JOB_DONE };
+
+/*
+ * Shared state of one validate_paths call. It is reference counted because a
+ * thread stuck on a hung mount may outlive the call that started it.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    PathCheck *checks;          // Caller's results, only written while the caller still waits
+    char **paths;               // Private copies, so abandoned threads never read the caller's memory
+    struct timespec *started;
+    unsigned char *state;
+    size_t count;
+    size_t next;                // Next job to hand out
+    size_t done;
+    int refs;                   // Live threads plus the caller
+    bool abandoned;             // The caller returned; late results are dropped
+} Pool;
+
+// Helper functions
+static Pool *create_pool(PathCheck *checks, size_t count);
+static void release_pool(Pool *pool);
+static int spawn_worker(Pool *pool);
+static void *worker(void *arg);
+static void check_path(const char *path, PathCheck *result);
+static long elapsed_ms(const struct timespec *since, const struct timespec *now);
+
+int validate_paths(PathCheck *checks, size_t count, int timeout_ms) {
+    for (size_t i = 0; i < count; i++) {
+        checks[i].resolved = NULL;
+        checks[i].error = 0;
+    }
+    if (count == 0) return 0;
+
+    Pool *pool = create_pool(checks, count);
+    if (!pool) return 1;
+
+    pthread_mutex_lock(&pool->mutex);
+    size_t threads = count < VALIDATE_THREADS ? count : VALIDATE_THREADS;
+    size_t started = 0;
+    for (size_t i = 0; i < threads; i++) {
+        if (spawn_worker(pool) == 0) started++;
+    }
+    if (started == 0) {
+        fprintf(stderr, "Failed to start path validation threads.\n");
+        pthread_mutex_unlock(&pool->mutex);
+        release_pool(pool);
+        return 1;
+    }
+
+    // Jobs are handed out in order, so the running ones all sit between `oldest` and `next`
+    size_t oldest = 0;
+    while (pool->done < count) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        while (oldest < pool->next && pool->state[oldest] == JOB_DONE) oldest++;
+        for (size_t job = oldest; job < pool->next; job++) {
+            if (pool->state[job] != JOB_RUNNING || elapsed_ms(&pool->started[job], &now) < timeout_ms) continue;
+
+            // Give up on this path and replace its thread, which stays blocked in the kernel
+            pool->checks[job].status = PATH_UNREACHABLE;
+            pool->checks[job].error = ETIMEDOUT;
+            pool->state[job] = JOB_DONE;
+            pool->done++;
+            if (pool->next < count) spawn_worker(pool);
+        }
+        if (pool->done == count) break;
+
+        struct timespec deadline = now;
+        deadline.tv_nsec += POLL_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&pool->done_cond, &pool->mutex, &deadline);
+    }
+
+    pool->abandoned = true;
+    pthread_mutex_unlock(&pool->mutex);
+    release_pool(pool);
+    return 0;
+}
+
+const char *path_status_name(PathStatus status) {
+    switch (status) {
+        case PATH_OK: return "ok";
+        case PATH_MOVED: return "moved";
+        case PATH_MISSING: return "missing";
+        case PATH_NOT_DIRECTORY: return "not a directory";
+        case PATH_UNREACHABLE: return "unreachable";
+    }
+    return "unknown";
+}
+
+// Helper functions
+
+/*
+ * Allocates the pool with private copies of the paths. The caller holds the first reference.
+ * Returns the pool, or NULL on error.
+ */
+static Pool *create_pool(PathCheck *checks, size_t count) {
+    Pool *pool = calloc(1, sizeof(Pool));
+    if (!pool) {
+        fprintf(stderr, "Failed to allocate memory for path validation: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    pool->checks = checks;
+    pool->count = count;
+    pool->refs = 1;
+    pool->paths = calloc(count, sizeof(char *));
+    pool->started = calloc(count, sizeof(struct timespec));
+    pool->state = calloc(count, 1);
+    bool ok = pool->paths && pool->started && pool->state;
+    for (size_t i = 0; ok && i < count; i++) {
+        pool->paths[i] = strdup(checks[i].path);
+        ok = pool->paths[i] != NULL;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->done_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&pool->mutex, NULL);
+
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate memory for path validation: %s\n", strerror(errno));
+        release_pool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/*
+ * Drops one reference, freeing the pool once the caller and every thread are done with it.
+ */
+static void release_pool(Pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    bool last = --pool->refs == 0;
+    pthread_mutex_unlock(&pool->mutex);
+    if (!last) return;
+
+    if (pool->paths) {
+        for (size_t i = 0; i < pool->count; i++) free(pool->paths[i]);
+    }
+    free(pool->paths);
+    free(pool->started);
+    free(pool->state);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool);
+}
+
+/*
+ * Starts a detached worker thread. Must be called with the pool's mutex held.
+ * Returns 0 on success, 1 on error.
+ */
+static int spawn_worker(Pool *pool) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t thread;
+    pool->refs++;
+    int error = pthread_create(&thread, &attr, worker, pool);
+    pthread_attr_destroy(&attr);
+    if (error != 0) {
+        pool->refs--;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Takes jobs until there are none left. A thread whose job timed out retires
+ * when (if ever) its check returns, since a replacement already took its place.
+ */
+static void *worker(void *arg) {
+    Pool *pool = arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->abandoned && pool->next < pool->count) {
+        size_t job = pool->next++;
+        pool->state[job] = JOB_RUNNING;
+        clock_gettime(CLOCK_MONOTONIC, &pool->started[job]);
+        const char *path = pool->paths[job];
+        pthread_mutex_unlock(&pool->mutex);
+
+        PathCheck result = {0};
+        check_path(path, &result);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (pool->abandoned || pool->state[job] != JOB_RUNNING) {
+            free(result.resolved);
+            break;
+        }
+        pool->checks[job].status = result.status;
+        pool->checks[job].resolved = result.resolved;
+        pool->checks[job].error = result.error;
+        pool->state[job] = JOB_DONE;
+        pool->done++;
+        pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    release_pool(pool);
+    return NULL;
+}
+
+/*
+ * Resolves a path and checks that it is a directory.
+ */
+static void check_path(const char *path, PathCheck *result) {
+    char *resolved = realpath(path, NULL);
+    struct stat st;
+    if (!resolved || stat(resolved, &st) == -1) {
+        result->error = errno;
+        result->status = (errno == ENOENT || errno == ENOTDIR) ? PATH_MISSING : PATH_UNREACHABLE;
+        free(resolved);
+        return;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        result->status = PATH_NOT_DIRECTORY;
+        result->error = ENOTDIR;
+        free(resolved);
+        return;
+    }
+
+    result->status = strcmp(resolved, path) == 0 ? PATH_OK : PATH_MOVED;
+    result->resolved = resolved;
+}
+
+/*
+ * Milliseconds between two monotonic timestamps.
+ */
+static long elapsed_ms(const struct timespec *since, const struct timespec *now) {
+    return (now->tv_sec - since->tv_sec) * 1000L + (now->tv_nsec - since->tv_nsec) / 1000000L;
+}
@@ -0,0 +1,39 @@
+#ifndef VALIDATE_H
+
+#define VALIDATE_H
+
+#include <stddef.h>
+
+#define VALIDATE_THREADS 16         // Upper bound on concurrent path checks
+#define VALIDATE_TIMEOUT_MS 2000    // Default time a single path check may take before it counts as unreachable
+
+typedef enum {
+    PATH_OK,                // Exists, is a directory and is already canonical
+    PATH_MOVED,             // Exists, but resolves to a different canonical path (e.g. through a symlink)
+    PATH_MISSING,           // Doesn't exist anymore
+    PATH_NOT_DIRECTORY,     // Exists, but isn't a directory
+    PATH_UNREACHABLE,       // Failed with an I/O error, or didn't answer before the timeout
+} PathStatus;
+
+typedef struct {
+    const char *path;       // Input: the path to check
+    PathStatus status;      // Output
+    char *resolved;         // Output: malloc'd canonical path for PATH_OK and PATH_MOVED, NULL otherwise
+    int error;              // Output: errno of the failed check, or ETIMEDOUT
+} PathCheck;
+
+/*
+ * Resolves and stats every path concurrently on a bounded pool of threads.
+ * A check that takes longer than timeout_ms is reported as PATH_UNREACHABLE and
+ * abandoned, so a hung NFS or autofs mount can't stall the whole run.
+ * Returns 0 on success, 1 if the threads couldn't be started.
+ * The caller must free each check's resolved path.
+ */
+int validate_paths(PathCheck *checks, size_t count, int timeout_ms);
+
+/*
+ * Returns a short, lowercase description of a status for reports.
+ */
+const char *path_status_name(PathStatus status);
+
+#endif
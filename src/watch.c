@@ -0,0 +1,219 @@
+#include "watch.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define WATCH_MASK (IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_ONLYDIR)
+
+// The first half of a rename, waiting for the IN_MOVED_TO with the same cookie
+typedef struct {
+    uint32_t cookie;
+    char path[MAX_PATH];
+} PendingMove;
+
+// Helper functions
+static int add_watch(Watcher *watcher, const char *directory, bool *known);
+static int event_path(const Watcher *watcher, const struct inotify_event *event, char *buffer);
+static bool path_within(const char *path, const char *directory, size_t len);
+static void relocate(const char *old_path, const char *new_path);
+static void report_lost(const BookmarkStore *store, const char *path, bool subtree, const char *reason);
+
+void watcher_init(Watcher *watcher) {
+    watcher->fd = -1;
+    watcher->directories = NULL;
+    watcher->capacity = 0;
+    watcher->full = false;
+}
+
+int watcher_track(Watcher *watcher, const BookmarkStore *store) {
+    // A fresh instance drops every old watch at once, and numbers the new ones from 1
+    watcher_free(watcher);
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->fd == -1) {
+        fprintf(stderr, "Failed to start watching directories: %s\n", strerror(errno));
+        return 1;
+    }
+
+    char directory[MAX_PATH];
+    for (size_t i = 0; i < store->count && !watcher->full; i++) {
+        const Bookmark *bookmark = &store->records[i];
+        if (bookmark->path_len == 0 || bookmark->path_len >= MAX_PATH) continue;
+        memcpy(directory, bookmark_path(store, bookmark), bookmark->path_len + 1);
+
+        // Walk up from the parent until reaching a directory another bookmark already watches
+        size_t len = bookmark->path_len;
+        while (len > 1) {
+            while (len > 1 && directory[len - 1] != '/') len--;
+            if (len > 1) len--;
+            directory[len] = '\0';
+
+            bool known;
+            if (add_watch(watcher, directory, &known) != 0 || known) break;
+        }
+    }
+    return 0;
+}
+
+void watcher_handle(Watcher *watcher, const BookmarkStore *store) {
+    if (watcher->fd == -1) return;
+
+    char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)] __attribute__((aligned(__alignof__(struct inotify_event))));
+    PendingMove moves[WATCH_MOVES_MAX];
+    size_t move_count = 0;
+    char path[MAX_PATH];
+
+    // Both halves of a rename are queued together, so draining the queue pairs them up
+    ssize_t len;
+    while ((len = read(watcher->fd, buffer, sizeof(buffer))) > 0) {
+        for (char *cursor = buffer; cursor < buffer + len;) {
+            const struct inotify_event *event = (const struct inotify_event *) cursor;
+            cursor += sizeof(struct inotify_event) + event->len;
+            if (!(event->mask & IN_ISDIR) || event_path(watcher, event, path) != 0) continue;
+
+            if (event->mask & IN_MOVED_FROM) {
+                if (move_count == WATCH_MOVES_MAX) {
+                    report_lost(store, moves[0].path, true, "was moved");
+                    memmove(moves, moves + 1, (WATCH_MOVES_MAX - 1) * sizeof(PendingMove));
+                    move_count--;
+                }
+                moves[move_count].cookie = event->cookie;
+                strcpy(moves[move_count].path, path);
+                move_count++;
+            }
+            else if (event->mask & IN_MOVED_TO) {
+                for (size_t i = 0; i < move_count; i++) {
+                    if (moves[i].cookie != event->cookie) continue;
+                    relocate(moves[i].path, path);
+                    moves[i] = moves[--move_count];
+                    break;
+                }
+            }
+            else if (event->mask & IN_DELETE) {
+                // rm -r deletes the contents first, so each bookmarked directory gets its own event
+                report_lost(store, path, false, "was deleted");
+            }
+        }
+    }
+
+    // Moved out of every watched directory: the new path is unknown
+    for (size_t i = 0; i < move_count; i++) {
+        report_lost(store, moves[i].path, true, "was moved out of sight");
+    }
+}
+
+void watcher_free(Watcher *watcher) {
+    if (watcher->fd != -1) close(watcher->fd);
+    for (size_t i = 0; i < watcher->capacity; i++) {
+        free(watcher->directories[i]);
+    }
+    free(watcher->directories);
+    watcher_init(watcher);
+}
+
+// Helper functions
+
+/*
+ * Watches a directory and remembers its path under the watch descriptor.
+ * known is set if the directory was already watched, so its ancestors are too.
+ * Returns 0 on success, 1 if the watch couldn't be added (the directory may be gone).
+ */
+static int add_watch(Watcher *watcher, const char *directory, bool *known) {
+    *known = false;
+    int wd = inotify_add_watch(watcher->fd, directory, WATCH_MASK);
+    if (wd == -1) {
+        if (errno == ENOSPC) {
+            fprintf(stderr, "Ran out of inotify watches; raise fs.inotify.max_user_watches to watch every bookmark.\n");
+            watcher->full = true;
+        }
+        return 1;
+    }
+
+    if ((size_t) wd >= watcher->capacity) {
+        size_t capacity = watcher->capacity ? watcher->capacity : 256;
+        while (capacity <= (size_t) wd) capacity *= 2;
+        char **grown = realloc(watcher->directories, capacity * sizeof(char *));
+        if (!grown) return 1;
+        memset(grown + watcher->capacity, 0, (capacity - watcher->capacity) * sizeof(char *));
+        watcher->directories = grown;
+        watcher->capacity = capacity;
+    }
+
+    // inotify hands out the same descriptor for an inode that is already watched
+    if (watcher->directories[wd]) {
+        *known = true;
+        return 0;
+    }
+    watcher->directories[wd] = strdup(directory);
+    return watcher->directories[wd] ? 0 : 1;
+}
+
+/*
+ * Writes the full path of the entry an event is about.
+ * Returns 0 on success, 1 if the watch is unknown or the path doesn't fit.
+ */
+static int event_path(const Watcher *watcher, const struct inotify_event *event, char *buffer) {
+    if (event->len == 0 || event->wd < 0 || (size_t) event->wd >= watcher->capacity) return 1;
+    const char *directory = watcher->directories[event->wd];
+    if (!directory) return 1;
+
+    int written = snprintf(buffer, MAX_PATH, "%s/%s", strcmp(directory, "/") == 0 ? "" : directory, event->name);
+    return written > 0 && written < MAX_PATH ? 0 : 1;
+}
+
+/*
+ * Checks if path is directory itself or inside it.
+ */
+static bool path_within(const char *path, const char *directory, size_t len) {
+    return strncmp(path, directory, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+/*
+ * Points every bookmark inside old_path at the same place under new_path, with one
+ * journal record per bookmark instead of a rewrite of the snapshot.
+ */
+static void relocate(const char *old_path, const char *new_path) {
+    BookmarkStore store;
+    if (store_load_for_update(&store, NULL) != 0) {
+        store_free(&store);
+        return;
+    }
+
+    size_t old_len = strlen(old_path);
+    char updated[MAX_PATH];
+    for (size_t i = 0; i < store.count; i++) {
+        Bookmark *bookmark = &store.records[i];
+        const char *path = bookmark_path(&store, bookmark);
+        if (!path_within(path, old_path, old_len)) continue;
+
+        // Copied out first: store_set_path may move the arena
+        int written = snprintf(updated, sizeof(updated), "%s%s", new_path, path + old_len);
+        if (written < 0 || (size_t) written >= sizeof(updated)) continue;
+        if (store_set_path(&store, bookmark, updated) != 0 ||
+            store_commit(&store, JOURNAL_EDIT, bookmark_name(&store, bookmark), updated) != 0) {
+            break;
+        }
+        printf("'%s' --> %s\n", bookmark_name(&store, bookmark), updated);
+    }
+    fflush(stdout);
+    store_free(&store);
+}
+
+/*
+ * Reports the bookmarks of path, or with subtree also those inside it, as no longer valid.
+ */
+static void report_lost(const BookmarkStore *store, const char *path, bool subtree, const char *reason) {
+    size_t len = strlen(path);
+    for (size_t i = 0; i < store->count; i++) {
+        const Bookmark *bookmark = &store->records[i];
+        const char *bookmarked = bookmark_path(store, bookmark);
+        if (subtree ? !path_within(bookmarked, path, len) : strcmp(bookmarked, path) != 0) continue;
+        printf("'%s' --> %s %s. Run 'bm doctor' to fix it.\n", bookmark_name(store, bookmark), bookmarked, reason);
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,49 @@
+#ifndef WATCH_H
+
+#define WATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "store.h"
+
+#define WATCH_MOVES_MAX 64  // Renames whose destination is still awaited while draining events
+
+/*
+ * Follows the bookmarked directories on disk for 'bm daemon --watch'. Every ancestor of a
+ * bookmarked path is watched with inotify, so renaming or deleting the directory itself, or
+ * any directory above it, shows up as an event in a watched parent.
+ */
+typedef struct {
+    int fd;                     // inotify instance, -1 when nothing is watched
+    char **directories;         // Path of each watch descriptor, indexed by wd (NULL if unused)
+    size_t capacity;
+    bool full;                  // Ran out of inotify watches (fs.inotify.max_user_watches)
+} Watcher;
+
+/*
+ * Initializes a watcher that watches nothing yet.
+ */
+void watcher_init(Watcher *watcher);
+
+/*
+ * Replaces the watches with the ancestors of every bookmarked path in the store.
+ * Costs about one inotify_add_watch per bookmark plus one per distinct parent directory.
+ * Returns 0 on success, 1 if inotify isn't available.
+ */
+int watcher_track(Watcher *watcher, const BookmarkStore *store);
+
+/*
+ * Drains pending events. Bookmarks inside a renamed directory are pointed at its new path
+ * through the journal. Deleted bookmarked directories, and directories moved somewhere
+ * unwatched, are reported on stdout for 'bm doctor' to deal with.
+ * store is the daemon's copy, used to name the reported bookmarks.
+ */
+void watcher_handle(Watcher *watcher, const BookmarkStore *store);
+
+/*
+ * Removes every watch and frees the watcher.
+ */
+void watcher_free(Watcher *watcher);
+
+#endif